@@ -0,0 +1,366 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET backend. -b afpacket[:iface=dev,...] attaches each configured
+ * interface to the Linux network device of the same name, or to the device
+ * given for it, with a TPACKET_V3 receive ring and a transmit ring shared
+ * with the kernel through one mmap per interface.
+ *
+ * The kernel fills the receive ring a block of frames at a time, and frames
+ * are handed to the router in place in the ring. A block goes back to the
+ * kernel on the recv_batch after the one that finished it, when nothing
+ * refers to its frames any more. Frames in the ring are not pool buffers,
+ * so anything keeping one (the ARP queue) copies it.
+ *
+ * Sent frames are written into free transmit ring slots, and one send()
+ * per interface per batch tells the kernel to transmit them straight from
+ * the ring.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_backend.h"
+
+#define SR_AFP_MAX        16           /* interfaces */
+#define SR_AFP_BLOCK_SIZE (256 * 1024) /* receive ring block */
+#define SR_AFP_BLOCKS     16           /* receive ring blocks */
+#define SR_AFP_BLOCK_TOV  1            /* ms before a part filled block is retired */
+#define SR_AFP_FRAME_SIZE 2048         /* transmit ring slot */
+#define SR_AFP_TX_FRAMES  512          /* transmit ring slots */
+#define SR_AFP_POLL_MS    100          /* recv_batch returns empty handed after this */
+
+/* data offset in a transmit slot, what the kernel expects without PACKET_TX_HAS_OFF */
+#define SR_AFP_TX_DATA (TPACKET3_HDRLEN - sizeof(struct sockaddr_ll))
+
+struct sr_afp_ring {
+  int fd;
+  struct sr_if *iface;
+  uint8_t *map;          /* receive blocks, then transmit slots */
+  size_t map_len;
+  unsigned int block;    /* receive block being read */
+  int open;              /* reading block has started */
+  uint32_t left;         /* frames left in it */
+  uint8_t *pkt;          /* next frame in it */
+  uint8_t *tx;           /* first transmit slot */
+  unsigned int tx_next;
+  int tx_pending;        /* slots filled since the last send() */
+  unsigned long rx, tx_sent, tx_dropped;
+};
+
+struct sr_afp {
+  int n;
+  struct sr_afp_ring ring[SR_AFP_MAX];
+  int next;                                /* ring to read first */
+  struct tpacket_block_desc *done[SR_BACKEND_BATCH]; /* finished last time */
+  int ndone;
+};
+
+/* The device name for iface: from an iface=dev list, or the same name. */
+static void sr_afp_devname(const char *arg, const char *iface, char *dev)
+{
+  size_t n = strlen(iface);
+  const char *p = arg;
+
+  strncpy(dev, iface, IFNAMSIZ - 1);
+  dev[IFNAMSIZ - 1] = '\0';
+  while(p && *p)
+  {
+    if(strncmp(p, iface, n) == 0 && p[n] == '=')
+    {
+      size_t len = strcspn(p + n + 1, ",");
+      if(len >= IFNAMSIZ)
+      { len = IFNAMSIZ - 1; }
+      memcpy(dev, p + n + 1, len);
+      dev[len] = '\0';
+      return;
+    }
+    if((p = strchr(p, ',')) != NULL)
+    { p++; }
+  }
+}
+
+static int sr_afp_ring_open(struct sr_afp_ring *r, const char *dev)
+{
+  struct tpacket_req3 req;
+  struct sockaddr_ll ll;
+  int version = TPACKET_V3, one = 1;
+  size_t rx_len = (size_t)SR_AFP_BLOCK_SIZE * SR_AFP_BLOCKS;
+
+  if((r->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+  {
+    perror("afpacket backend: socket");
+    return -1;
+  }
+  if(setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+  { goto fail; }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = SR_AFP_BLOCK_SIZE;
+  req.tp_block_nr = SR_AFP_BLOCKS;
+  req.tp_frame_size = SR_AFP_FRAME_SIZE;
+  req.tp_frame_nr = SR_AFP_BLOCK_SIZE / SR_AFP_FRAME_SIZE * SR_AFP_BLOCKS;
+  req.tp_retire_blk_tov = SR_AFP_BLOCK_TOV;
+  if(setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+  { goto fail; }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = SR_AFP_BLOCK_SIZE;
+  req.tp_block_nr = SR_AFP_TX_FRAMES * SR_AFP_FRAME_SIZE / SR_AFP_BLOCK_SIZE;
+  req.tp_frame_size = SR_AFP_FRAME_SIZE;
+  req.tp_frame_nr = SR_AFP_TX_FRAMES;
+  if(setsockopt(r->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0)
+  { goto fail; }
+
+  /* frames we send are not queued behind a qdisc, and not seen by our own
+     receive ring; not fatal if the kernel is too old */
+  setsockopt(r->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+  r->map_len = rx_len + (size_t)SR_AFP_TX_FRAMES * SR_AFP_FRAME_SIZE;
+  r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, r->fd, 0);
+  if(r->map == MAP_FAILED)
+  { r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0); }
+  if(r->map == MAP_FAILED)
+  {
+    r->map = NULL;
+    goto fail;
+  }
+  r->tx = r->map + rx_len;
+
+  memset(&ll, 0, sizeof(ll));
+  ll.sll_family = AF_PACKET;
+  ll.sll_protocol = htons(ETH_P_ALL);
+  if((ll.sll_ifindex = if_nametoindex(dev)) == 0 ||
+     bind(r->fd, (struct sockaddr *)&ll, sizeof(ll)) < 0)
+  { goto fail; }
+  return 0;
+
+fail:
+  fprintf(stderr, "afpacket backend: cannot attach to %s: %s\n", dev, strerror(errno));
+  if(r->map)
+  { munmap(r->map, r->map_len); }
+  close(r->fd);
+  return -1;
+}
+
+static void sr_afp_ring_close(struct sr_afp_ring *r)
+{
+  munmap(r->map, r->map_len);
+  close(r->fd);
+}
+
+static int sr_afp_open(struct sr_instance *sr, const char *arg)
+{
+  struct sr_afp *afp;
+  struct sr_if *iface;
+  char dev[IFNAMSIZ];
+
+  if((afp = calloc(1, sizeof(struct sr_afp))) == NULL)
+  { return -1; }
+  for(iface = sr->if_list; iface; iface = iface->next)
+  {
+    if(afp->n == SR_AFP_MAX)
+    {
+      fprintf(stderr, "afpacket backend: more than %d interfaces\n", SR_AFP_MAX);
+      break;
+    }
+    sr_afp_devname(arg, iface->name, dev);
+    if(sr_afp_ring_open(&(afp->ring[afp->n]), dev) != 0)
+    { break; }
+    afp->ring[afp->n++].iface = iface;
+    Debug("afpacket backend: %s on %s\n", iface->name, dev);
+  }
+  if(iface)
+  {
+    while(afp->n > 0)
+    { sr_afp_ring_close(&(afp->ring[--afp->n])); }
+    free(afp);
+    return -1;
+  }
+  sr->backend_state = afp;
+  return 0;
+}
+
+static struct tpacket_block_desc *sr_afp_block(struct sr_afp_ring *r)
+{
+  return (struct tpacket_block_desc *)(r->map + (size_t)r->block * SR_AFP_BLOCK_SIZE);
+}
+
+/* Take up to max frames from r's receive ring. Finished blocks that frames
+   were taken from are added to afp->done. Those stay TP_STATUS_USER until
+   the next call, so one call visits each block at most once: going round
+   the ring again would hand their frames out a second time. */
+static int sr_afp_ring_read(struct sr_afp *afp, struct sr_afp_ring *r,
+  struct sr_frame *frames, int max)
+{
+  int n = 0, visited;
+
+  for(visited = 0; n < max && visited < SR_AFP_BLOCKS; visited++)
+  {
+    struct tpacket_block_desc *bd = sr_afp_block(r);
+    int first = n;
+
+    if(!r->open)
+    {
+      if(!(__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+      { break; }
+      r->open = 1;
+      r->left = bd->hdr.bh1.num_pkts;
+      r->pkt = (uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+    }
+    while(r->left > 0 && n < max)
+    {
+      struct tpacket3_hdr *h = (struct tpacket3_hdr *)r->pkt;
+      struct sockaddr_ll *ll = (struct sockaddr_ll *)(r->pkt + TPACKET_ALIGN(sizeof(*h)));
+
+      if(ll->sll_pkttype != PACKET_OUTGOING)
+      {
+        frames[n].buf = r->pkt + h->tp_mac;
+        frames[n].len = h->tp_snaplen;
+        frames[n].iface = r->iface;
+        n++;
+      }
+      r->pkt += h->tp_next_offset;
+      r->left--;
+    }
+    if(r->left > 0)
+    { break; }
+
+    /* block finished: back to the kernel now if nothing points into it */
+    if(n > first)
+    { afp->done[afp->ndone++] = bd; }
+    else
+    { __atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL, __ATOMIC_RELEASE); }
+    r->open = 0;
+    r->block = (r->block + 1) % SR_AFP_BLOCKS;
+  }
+  r->rx += n;
+  return n;
+}
+
+static int sr_afp_recv_batch(struct sr_instance *sr, struct sr_frame *frames, int max)
+{
+  struct sr_afp *afp = sr->backend_state;
+  struct pollfd pfd[SR_AFP_MAX];
+  int i, pass, n = 0;
+
+  /* the previous batch has been handled */
+  for(i = 0; i < afp->ndone; i++)
+  { __atomic_store_n(&(afp->done[i]->hdr.bh1.block_status), TP_STATUS_KERNEL, __ATOMIC_RELEASE); }
+  afp->ndone = 0;
+
+  if(max > SR_BACKEND_BATCH)
+  { max = SR_BACKEND_BATCH; }
+  for(pass = 0; pass < 2 && n == 0; pass++)
+  {
+    if(pass == 1)
+    {
+      for(i = 0; i < afp->n; i++)
+      {
+        pfd[i].fd = afp->ring[i].fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+      }
+      if(poll(pfd, afp->n, SR_AFP_POLL_MS) < 0 && errno != EINTR)
+      { return -1; }
+    }
+    /* one block's worth of frames from each ring in turn would need more
+       bookkeeping than it saves; rotating the first ring is fair enough */
+    for(i = 0; i < afp->n && n < max; i++)
+    {
+      struct sr_afp_ring *r = &(afp->ring[(afp->next + i) % afp->n]);
+      n += sr_afp_ring_read(afp, r, frames + n, max - n);
+    }
+  }
+  if(afp->n > 0)
+  { afp->next = (afp->next + 1) % afp->n; }
+  return n;
+}
+
+static int sr_afp_send_batch(struct sr_instance *sr, const struct sr_frame *frames, int n)
+{
+  struct sr_afp *afp = sr->backend_state;
+  int i, d, ret = 0;
+
+  for(i = 0; i < n; i++)
+  {
+    struct sr_afp_ring *r;
+    struct tpacket3_hdr *h;
+
+    for(d = 0; d < afp->n && afp->ring[d].iface != frames[i].iface; d++);
+    if(d == afp->n)
+    {
+      ret = -1;
+      continue;
+    }
+    r = &(afp->ring[d]);
+    h = (struct tpacket3_hdr *)(r->tx + (size_t)r->tx_next * SR_AFP_FRAME_SIZE);
+
+    if(__atomic_load_n(&(h->tp_status), __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE && r->tx_pending)
+    {
+      /* ring full: have the kernel send what is queued and try once more */
+      send(r->fd, NULL, 0, 0);
+      r->tx_pending = 0;
+    }
+    if(__atomic_load_n(&(h->tp_status), __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE ||
+       frames[i].len > SR_AFP_FRAME_SIZE - SR_AFP_TX_DATA)
+    {
+      r->tx_dropped++;
+      ret = -1;
+      continue;
+    }
+    memcpy((uint8_t *)h + SR_AFP_TX_DATA, frames[i].buf, frames[i].len);
+    h->tp_len = frames[i].len;
+    h->tp_snaplen = frames[i].len;
+    __atomic_store_n(&(h->tp_status), TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    r->tx_next = (r->tx_next + 1) % SR_AFP_TX_FRAMES;
+    r->tx_pending++;
+  }
+
+  for(d = 0; d < afp->n; d++)
+  {
+    struct sr_afp_ring *r = &(afp->ring[d]);
+    if(!r->tx_pending)
+    { continue; }
+    if(send(r->fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN)
+    { ret = -1; }
+    r->tx_sent += r->tx_pending;
+    r->tx_pending = 0;
+  }
+  return ret;
+}
+
+static void sr_afp_close(struct sr_instance *sr)
+{
+  struct sr_afp *afp = sr->backend_state;
+  int i;
+
+  for(i = 0; i < afp->n; i++)
+  {
+    struct sr_afp_ring *r = &(afp->ring[i]);
+    fprintf(stderr, "afpacket backend: %s %lu frames received, %lu sent, %lu dropped\n",
+            r->iface->name, r->rx, r->tx_sent, r->tx_dropped);
+    sr_afp_ring_close(r);
+  }
+  free(afp);
+  sr->backend_state = NULL;
+}
+
+const struct sr_backend sr_afpacket_backend = {
+  "afpacket", 1, sr_afp_open, sr_afp_recv_batch, sr_afp_send_batch, sr_afp_close
+};
@@ -10,6 +10,7 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_bufpool.h"
 /* 
   This function gets called every second. For each request sent out, we keep
   checking whether we should resend an request or destroy the arp request.
@@ -58,6 +59,8 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. You should free the passed *packet.
+   A packet that lives in a pool buffer is kept by reference instead of
+   copied, see sr_bufpool.h.
    
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
@@ -88,8 +91,19 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     if (packet && packet_len && iface) {
         struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
+        /* keep a frame in a slot by reference. Copy anything else, into a
+           slot when it fits, so a request does not pin a whole chunk */
+        if (sr_buf_hold_slot(packet)) {
+            new_pkt->buf = packet;
+        }
+        else if (packet_len <= SR_BUFPOOL_SLOT &&
+                 (new_pkt->buf = sr_buf_alloc()) != NULL) {
+            memcpy(new_pkt->buf, packet, packet_len);
+        }
+        else {
+            new_pkt->buf = (uint8_t *)malloc(packet_len);
+            memcpy(new_pkt->buf, packet, packet_len);
+        }
         new_pkt->len = packet_len;
 		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
         strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
@@ -176,7 +190,7 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
             if (pkt->buf)
-                free(pkt->buf);
+                sr_buf_free(pkt->buf);
             if (pkt->iface)
                 free(pkt->iface);
             free(pkt);
@@ -75,7 +75,8 @@
 #define SR_ARPCACHE_TO    15.0
 
 struct sr_packet {
-    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
+    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty.
+                                   Release with sr_buf_free */
     unsigned int len;           /* Length of raw Ethernet frame */
     char *iface;                /* The outgoing interface */
     struct sr_packet *next;
@@ -113,7 +114,8 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
    that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   freed by the caller. A packet in a pool buffer (sr_bufpool.h) is queued by
+   reference, anything else is copied.
 
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
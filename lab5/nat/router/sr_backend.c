@@ -0,0 +1,308 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_backend.c
+ *
+ * Description:
+ *
+ * Backend selection, the receive loop and the transmit queue shared by all
+ * packet I/O backends, see sr_backend.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_nat.h"
+#include "sr_bufpool.h"
+#include "sr_backend.h"
+#include "sr_pcaplog.h"
+#include "sr_flightrec.h"
+
+/* Frames waiting to be handed to the backend. Pool frames are queued by
+   reference, anything else is copied into copy[]. Frames are queued while a
+   receive batch is in progress and sent together when it ends, or earlier
+   when the queue fills up or its oldest frame has waited
+   SR_BACKEND_TX_DELAY_US. */
+struct sr_txq {
+  struct sr_frame frames[SR_BACKEND_TX_FRAMES];
+  uint8_t *held[SR_BACKEND_TX_FRAMES];
+  unsigned int nheld;
+  unsigned int nframes;
+  uint8_t copy[SR_BACKEND_TX_BYTES];
+  unsigned int ncopy;
+  unsigned int batch;   /* receive batches in progress */
+  struct timeval first; /* when the oldest queued frame was queued */
+  pthread_mutex_t lock;
+};
+
+static const struct sr_backend *sr_backends[] = {
+  &sr_vns_backend,
+  &sr_vns_uring_backend,
+  &sr_pcap_backend,
+  &sr_tap_backend,
+  &sr_afpacket_backend,
+  &sr_shm_backend,
+  NULL
+};
+
+const struct sr_backend *sr_backend_find(const char *spec)
+{
+  size_t n = strcspn(spec, ":");
+  int i;
+
+  for(i = 0; sr_backends[i]; i++)
+  {
+    if(strlen(sr_backends[i]->name) == n && strncmp(sr_backends[i]->name, spec, n) == 0)
+    { return sr_backends[i]; }
+  }
+  return NULL;
+}
+
+int sr_backend_open(struct sr_instance *sr, const struct sr_backend *be, const char *spec)
+{
+  const char *arg = strchr(spec, ':');
+
+  if(!sr->txq)
+  {
+    if((sr->txq = calloc(1, sizeof(struct sr_txq))) == NULL)
+    { return -1; }
+    pthread_mutex_init(&(sr->txq->lock), NULL);
+  }
+  sr->backend = be;
+  if(be->open(sr, arg ? arg + 1 : "") != 0)
+  {
+    sr->backend = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_arp_req_not_for_us(..)
+ * Scope:  Local
+ *
+ * ARP requests for other routers on a shared segment are dropped before
+ * they reach the router. Requests for a NAT pool address arriving on the
+ * NAT's external interface are answered like ones for the interface itself.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_arp_req_not_for_us(struct sr_nat *nat /* borrowed */,
+                                 const struct sr_frame *frame)
+{
+  struct sr_ethernet_hdr* e_hdr = 0;
+  struct sr_arp_hdr*       a_hdr = 0;
+
+  if (frame->len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+  { return 0; }
+
+  e_hdr = (struct sr_ethernet_hdr*)frame->buf;
+  a_hdr = (struct sr_arp_hdr*)(frame->buf + sizeof(struct sr_ethernet_hdr));
+
+  if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
+          (a_hdr->ar_op      == htons(arp_op_request))   &&
+          (a_hdr->ar_tip     != frame->iface->ip ) &&
+          !(nat && frame->iface == nat->ext_if && sr_nat_is_pool_addr(nat, a_hdr->ar_tip)) )
+  { return 1; }
+
+  return 0;
+} /* -- sr_arp_req_not_for_us -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tx_flush(..)
+ * Scope:  Local
+ *
+ * Hand every queued frame to the backend and drop the references to pool
+ * frames. Called with the queue locked.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tx_flush(struct sr_instance *sr, struct sr_txq *q)
+{
+  int ret = sr->backend->send_batch(sr, q->frames, q->nframes);
+  unsigned int i;
+
+  for(i = 0; i < q->nheld; i++)
+  { sr_buf_free(q->held[i]); }
+  q->nheld = q->nframes = q->ncopy = 0;
+  return ret;
+} /* -- sr_tx_flush -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tx_batch(..)
+ * Scope:  Local
+ *
+ * Enter (delta 1) or leave (delta -1) a receive batch. Frames sent during a
+ * batch are queued, and sent when the last batch ends.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_tx_batch(struct sr_instance *sr, int delta)
+{
+  struct sr_txq *q = sr->txq;
+
+  pthread_mutex_lock(&(q->lock));
+  q->batch += delta;
+  if(q->batch == 0 && q->nframes > 0)
+  { sr_tx_flush(sr, q); }
+  pthread_mutex_unlock(&(q->lock));
+} /* -- sr_tx_batch -- */
+
+int sr_backend_poll(struct sr_instance *sr, struct sr_nat *nat)
+{
+  struct sr_frame frames[SR_BACKEND_BATCH];
+  int i, n;
+
+  n = sr->backend->recv_batch(sr, frames, SR_BACKEND_BATCH);
+  if(n <= 0)
+  { return n; }
+
+  /* replies are queued until the whole batch is handled */
+  sr_tx_batch(sr, 1);
+  for(i = 0; i < n; i++)
+  {
+    struct sr_frame *frame = &(frames[i]);
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if(sr_arp_req_not_for_us(nat, frame))
+    { continue; }
+
+    /* -- log packet -- */
+    sr_pcaplog_packet(frame->buf, frame->len);
+    sr_flightrec_packet(frame->buf, frame->len);
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, nat, frame->buf, frame->len, frame->iface);
+  }
+  sr_tx_batch(sr, -1);
+  return n;
+}
+
+void sr_backend_close(struct sr_instance *sr)
+{
+  if(!sr->backend)
+  { return; }
+  pthread_mutex_lock(&(sr->txq->lock));
+  if(sr->txq->nframes > 0)
+  { sr_tx_flush(sr, sr->txq); }
+  pthread_mutex_unlock(&(sr->txq->lock));
+  sr->backend->close(sr);
+  sr->backend = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ether_addrs_match_interface(..)
+ * Scope: Local
+ *
+ * Make sure ethernet addresses are sane so we don't muck uo the system.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int
+sr_ether_addrs_match_interface( struct sr_if* iface, /* borrowed */
+                                uint8_t* buf /* borrowed */ )
+{
+  struct sr_ethernet_hdr* ether_hdr = (struct sr_ethernet_hdr*)buf;
+
+  if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
+    fprintf( stderr, "** Error, source address does not match interface\n");
+    return 0;
+  }
+
+  /* TODO */
+  /* Check destination, hardware address.  If it is private (i.e. destined
+   * to a virtual interface) ensure it is going to the correct topology
+   * Note: This check should really be done server side ...
+   */
+
+  return 1;
+
+} /* -- sr_ether_addrs_match_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) of length 'len' out of the
+ * named interface. Inside a receive batch the packet is queued and sent
+ * with the rest of the batch; buf may be freed or reused as soon as this
+ * returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* name /* borrowed */)
+{
+  struct sr_txq *q;
+  struct sr_frame *frame;
+  struct sr_if *iface;
+  struct timeval now;
+  int ret = 0;
+
+  /* REQUIRES */
+  assert(sr);
+  assert(buf);
+  assert(name);
+
+  /* don't waste my time ... */
+  if ( len < sizeof(struct sr_ethernet_hdr) ){
+    fprintf(stderr , "** Error: packet is wayy to short \n");
+    return -1;
+  }
+  if ( len > SR_BACKEND_TX_BYTES || !sr->backend ){
+    fprintf(stderr , "** Error: cannot send packet of length %u\n", len);
+    return -1;
+  }
+  if ( (iface = sr_get_interface(sr, name)) == 0 ){
+    fprintf( stderr, "** Error, interface %s, does not exist\n", name);
+    return -1;
+  }
+
+  /* -- log packet -- */
+  sr_pcaplog_packet(buf, len);
+  sr_flightrec_packet(buf, len);
+
+  if ( ! sr_ether_addrs_match_interface( iface, buf) ){
+    fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+    return -1;
+  }
+
+  q = sr->txq;
+  pthread_mutex_lock(&(q->lock));
+  if ( q->nframes == SR_BACKEND_TX_FRAMES || q->ncopy + len > SR_BACKEND_TX_BYTES )
+  { sr_tx_flush(sr, q); }
+
+  frame = &(q->frames[q->nframes]);
+  frame->len = len;
+  frame->iface = iface;
+  if ( sr_buf_hold(buf) ){
+    q->held[q->nheld++] = buf;
+    frame->buf = buf;
+  }
+  else {
+    memcpy(q->copy + q->ncopy, buf, len);
+    frame->buf = q->copy + q->ncopy;
+    q->ncopy += len;
+  }
+
+  gettimeofday(&now, NULL);
+  if ( q->nframes++ == 0 )
+  { q->first = now; }
+
+  if ( q->batch == 0 ||
+       (now.tv_sec - q->first.tv_sec) * 1000000 + (now.tv_usec - q->first.tv_usec) >=
+       SR_BACKEND_TX_DELAY_US )
+  { ret = sr_tx_flush(sr, q); }
+  pthread_mutex_unlock(&(q->lock));
+
+  return ret;
+} /* -- sr_send_packet -- */
@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_backend.h
+ *
+ * Description:
+ *
+ * Packet I/O backends. The router core only sees batches of Ethernet frames
+ * tagged with an interface; a backend moves them to and from somewhere:
+ *
+ *   vns        the VNS server over TCP (the default)
+ *   vns-uring  the same, with the socket I/O done through io_uring
+ *   pcap       replay frames from a pcap file
+ *   tap        one Linux TAP device per interface
+ *   afpacket   Linux network devices through AF_PACKET mmap rings
+ *   shm        shared memory rings to a local packet source, see sr_shm.h
+ *
+ * Backends other than vns have no server to describe the interfaces, so
+ * those come from a file, see sr_load_if.
+ *
+ * sr_backend_poll receives one batch and runs it through sr_handlepacket.
+ * Frames sent while a batch is being handled are queued and handed to the
+ * backend together when it is done, see sr_send_packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BACKEND_H
+#define SR_BACKEND_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_BACKEND_BATCH     64          /* frames per receive batch */
+#define SR_BACKEND_TX_FRAMES 64          /* frames queued before a send */
+#define SR_BACKEND_TX_BYTES  (64 * 1024) /* bytes of copied frames queued */
+#define SR_BACKEND_TX_DELAY_US 500       /* max time a frame stays queued */
+
+struct sr_instance;
+struct sr_nat;
+struct sr_if;
+
+/* One Ethernet frame. Received frames belong to the backend and stay valid
+   until its next recv_batch call; anything that wants one for longer takes a
+   reference with sr_buf_hold (frames are normally in pool buffers) or copies
+   it. */
+struct sr_frame {
+  uint8_t *buf;
+  unsigned int len;
+  struct sr_if *iface; /* interface received on or to send on */
+};
+
+struct sr_backend {
+  const char *name;
+  int need_if_config; /* interfaces come from sr_load_if, not the backend */
+
+  /* Start the backend. arg is whatever followed "name:" in -b. 0 on success. */
+  int  (*open)(struct sr_instance *sr, const char *arg);
+
+  /* Wait for frames and store up to max of them. Returns the number stored,
+     which may be 0 if the backend only had other work to do, or -1 when
+     there will be no more input. */
+  int  (*recv_batch)(struct sr_instance *sr, struct sr_frame *frames, int max);
+
+  /* Send n frames. The frames are only borrowed. Returns 0, or -1 if any
+     could not be sent. */
+  int  (*send_batch)(struct sr_instance *sr, const struct sr_frame *frames, int n);
+
+  void (*close)(struct sr_instance *sr);
+};
+
+extern const struct sr_backend sr_vns_backend;
+extern const struct sr_backend sr_vns_uring_backend;
+extern const struct sr_backend sr_pcap_backend;
+extern const struct sr_backend sr_tap_backend;
+extern const struct sr_backend sr_afpacket_backend;
+extern const struct sr_backend sr_shm_backend;
+
+/* Look up a backend by the part of spec before any ':'. */
+const struct sr_backend *sr_backend_find(const char *spec);
+
+/* Open sr's backend with the part of spec after the ':' (or "" if none) and
+   set up the transmit queue. 0 on success. */
+int  sr_backend_open(struct sr_instance *sr, const struct sr_backend *be, const char *spec);
+
+/* Receive one batch and hand it to sr_handlepacket. Returns the number of
+   frames handled, or -1 when the backend has no more input. */
+int  sr_backend_poll(struct sr_instance *sr, struct sr_nat *nat);
+
+/* Write out anything still queued and close the backend. */
+void sr_backend_close(struct sr_instance *sr);
+
+#endif /* -- SR_BACKEND_H -- */
@@ -0,0 +1,160 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bufpool.c
+ *
+ * Description:
+ *
+ * Reference counted frame buffer pool, see sr_bufpool.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "sr_bufpool.h"
+
+/* One size class: nslots buffers of size bytes laid out back to back, so the
+   buffer containing a pointer is found by division. */
+struct sr_bufpool_class {
+  uint8_t *base;
+  size_t size;
+  unsigned int nslots;
+  unsigned int *refs;
+  unsigned int *free;  /* stack of free slot indexes */
+  unsigned int nfree;
+  unsigned long misses;
+};
+
+static struct sr_bufpool_class bufpool_slots = { 0, SR_BUFPOOL_SLOT, SR_BUFPOOL_SLOTS };
+static struct sr_bufpool_class bufpool_chunks = { 0, SR_BUFPOOL_CHUNK, SR_BUFPOOL_CHUNKS };
+static pthread_mutex_t bufpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t bufpool_once = PTHREAD_ONCE_INIT;
+
+static void sr_bufpool_class_init(struct sr_bufpool_class *cls)
+{
+  unsigned int i;
+
+  cls->base = malloc(cls->nslots * cls->size);
+  cls->refs = calloc(cls->nslots, sizeof(unsigned int));
+  cls->free = malloc(cls->nslots * sizeof(unsigned int));
+  if(!cls->base || !cls->refs || !cls->free)
+  {
+    fprintf(stderr, "sr_bufpool: cannot allocate %u buffers of %lu bytes, using malloc\n",
+            cls->nslots, (unsigned long)cls->size);
+    free(cls->base);
+    free(cls->refs);
+    free(cls->free);
+    cls->base = NULL;
+    return;
+  }
+  /* stacked in reverse so buffers are handed out from the start */
+  for(i = 0; i < cls->nslots; i++)
+  { cls->free[i] = cls->nslots - 1 - i; }
+  cls->nfree = cls->nslots;
+}
+
+static void sr_bufpool_init(void)
+{
+  sr_bufpool_class_init(&bufpool_slots);
+  sr_bufpool_class_init(&bufpool_chunks);
+}
+
+/* The class and slot index containing p, or NULL if p is not in the pool. */
+static struct sr_bufpool_class *sr_buf_find(const uint8_t *p, unsigned int *idx)
+{
+  struct sr_bufpool_class *classes[2];
+  int i;
+
+  classes[0] = &bufpool_slots;
+  classes[1] = &bufpool_chunks;
+  for(i = 0; i < 2; i++)
+  {
+    struct sr_bufpool_class *cls = classes[i];
+    if(cls->base && p >= cls->base && p < cls->base + cls->nslots * cls->size)
+    {
+      *idx = (p - cls->base) / cls->size;
+      return cls;
+    }
+  }
+  return NULL;
+}
+
+static uint8_t *sr_buf_take(struct sr_bufpool_class *cls)
+{
+  unsigned int idx = 0;
+  int found = 0;
+
+  pthread_once(&bufpool_once, sr_bufpool_init);
+  pthread_mutex_lock(&bufpool_lock);
+  if(cls->nfree > 0)
+  {
+    idx = cls->free[--cls->nfree];
+    found = 1;
+  }
+  else
+  { cls->misses++; }
+  pthread_mutex_unlock(&bufpool_lock);
+
+  if(!found)
+  { return NULL; }
+  __atomic_store_n(&(cls->refs[idx]), 1, __ATOMIC_RELAXED);
+  return cls->base + idx * cls->size;
+}
+
+uint8_t *sr_buf_alloc(void)
+{
+  return sr_buf_take(&bufpool_slots);
+}
+
+uint8_t *sr_buf_alloc_chunk(void)
+{
+  return sr_buf_take(&bufpool_chunks);
+}
+
+int sr_buf_hold(const uint8_t *p)
+{
+  unsigned int idx;
+  struct sr_bufpool_class *cls = sr_buf_find(p, &idx);
+
+  if(!cls)
+  { return 0; }
+  __atomic_fetch_add(&(cls->refs[idx]), 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+int sr_buf_hold_slot(const uint8_t *p)
+{
+  unsigned int idx;
+
+  if(sr_buf_find(p, &idx) != &bufpool_slots)
+  { return 0; }
+  __atomic_fetch_add(&(bufpool_slots.refs[idx]), 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+void sr_buf_free(uint8_t *p)
+{
+  unsigned int idx;
+  struct sr_bufpool_class *cls = sr_buf_find(p, &idx);
+
+  if(!cls)
+  {
+    free(p);
+    return;
+  }
+  if(__atomic_sub_fetch(&(cls->refs[idx]), 1, __ATOMIC_ACQ_REL) != 0)
+  { return; }
+
+  pthread_mutex_lock(&bufpool_lock);
+  cls->free[cls->nfree++] = idx;
+  pthread_mutex_unlock(&bufpool_lock);
+}
+
+void sr_bufpool_stats(unsigned int *in_use, unsigned long *misses)
+{
+  pthread_mutex_lock(&bufpool_lock);
+  *in_use = (bufpool_slots.base ? bufpool_slots.nslots - bufpool_slots.nfree : 0) +
+            (bufpool_chunks.base ? bufpool_chunks.nslots - bufpool_chunks.nfree : 0);
+  *misses = bufpool_slots.misses + bufpool_chunks.misses;
+  pthread_mutex_unlock(&bufpool_lock);
+}
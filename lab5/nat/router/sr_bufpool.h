@@ -0,0 +1,57 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bufpool.h
+ *
+ * Description:
+ *
+ * Fixed size, reference counted frame buffers for the VNS client. There are
+ * two sizes: slots big enough for one command, and chunks that the stream
+ * reader fills with many commands at a time. Frames are handled in place in
+ * their buffer, and anything that wants to keep one after sr_handlepacket
+ * returns (the ARP queue, a worker thread) takes a reference instead of
+ * copying it. A reference pins the whole buffer, so something that may keep
+ * a frame for long, like the ARP queue, only holds frames in a slot and
+ * copies one inside a chunk into a slot of its own. A buffer goes back on
+ * its free list when its last reference is dropped. References may be taken
+ * and dropped from any thread.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BUFPOOL_H
+#define SR_BUFPOOL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_BUFPOOL_SLOT   10000 /* bytes per slot, the longest VNS command */
+#define SR_BUFPOOL_SLOTS  512   /* slots in the pool */
+#define SR_BUFPOOL_CHUNK  (128 * 1024) /* bytes per stream reader chunk */
+#define SR_BUFPOOL_CHUNKS 16    /* chunks in the pool */
+
+/* A free slot with one reference, or NULL if the pool is exhausted. The pool
+   is set up on first use. */
+uint8_t *sr_buf_alloc(void);
+
+/* The same for a SR_BUFPOOL_CHUNK byte chunk. */
+uint8_t *sr_buf_alloc_chunk(void);
+
+/* Take another reference to the pool buffer containing p, which may point
+   anywhere inside the buffer. Returns 0 if p is not in the pool, in which case
+   the caller has to copy the data it wants to keep. */
+int sr_buf_hold(const uint8_t *p);
+
+/* The same, but only if p is in a slot. Returns 0 for a chunk too. */
+int sr_buf_hold_slot(const uint8_t *p);
+
+/* Drop a reference to the buffer containing p. Anything not in the pool is
+   passed to free(), so p may also be the start of a malloc'd buffer. */
+void sr_buf_free(uint8_t *p);
+
+/* Buffers currently referenced, and allocations that found the pool empty. */
+void sr_bufpool_stats(unsigned int *in_use, unsigned long *misses);
+
+#endif /* -- SR_BUFPOOL_H -- */
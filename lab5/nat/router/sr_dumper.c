@@ -2,6 +2,7 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <string.h>
 #include "sr_dumper.h"
 
 static void
@@ -63,6 +64,93 @@ sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp)
         (void)fwrite((char *)sp, h->caplen, 1, fp);
 }
 
+static void
+ng_write_u32(FILE *fp, uint32_t v)
+{
+        (void)fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void
+ng_write_opt(FILE *fp, uint16_t code, const void *val, uint16_t len)
+{
+        static const char pad[4];
+
+        (void)fwrite(&code, sizeof(code), 1, fp);
+        (void)fwrite(&len, sizeof(len), 1, fp);
+        (void)fwrite(val, len, 1, fp);
+        (void)fwrite(pad, (4 - (len & 3)) & 3, 1, fp);
+}
+
+/*
+ * pcapng: a section header in host byte order, then an interface
+ * description block per interface, named and with nanosecond timestamps.
+ */
+FILE *
+sr_dump_ng_open(const char *fname, const char **ifnames, int nif, int snaplen)
+{
+        FILE *fp;
+        int i;
+
+        if (fname[0] == '-' && fname[1] == '\0')
+                fp = stdout;
+        else {
+                fp = fopen(fname, "w");
+                if (fp == NULL) {
+                        fprintf(stderr, "sr_dump_ng_open: can't open %s",
+                            fname);
+                        return (NULL);
+                }
+        }
+
+        /* type, length, byte order, version 1.0, section length unknown */
+        ng_write_u32(fp, PCAPNG_SHB);
+        ng_write_u32(fp, 28);
+        ng_write_u32(fp, PCAPNG_BYTE_ORDER_MAGIC);
+        ng_write_u32(fp, 1);
+        ng_write_u32(fp, 0xffffffff);
+        ng_write_u32(fp, 0xffffffff);
+        ng_write_u32(fp, 28);
+
+        for (i = 0; i < nif; i++) {
+                uint16_t namelen = strlen(ifnames[i]);
+                uint32_t len = 20 + 4 + ((namelen + 3) & ~3) + 8 + 4;
+                uint8_t tsresol = 9;
+
+                ng_write_u32(fp, PCAPNG_IDB);
+                ng_write_u32(fp, len);
+                ng_write_u32(fp, LINKTYPE_ETHERNET);  /* and 16 reserved bits */
+                ng_write_u32(fp, snaplen);
+                ng_write_opt(fp, PCAPNG_OPT_IF_NAME, ifnames[i], namelen);
+                ng_write_opt(fp, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+                ng_write_opt(fp, PCAPNG_OPT_END, NULL, 0);
+                ng_write_u32(fp, len);
+        }
+
+        return fp;
+}
+
+/*
+ * Output a packet as an enhanced packet block.
+ */
+void
+sr_dump_ng(FILE *fp, int ifidx, uint64_t ts_ns, const unsigned char *sp,
+           uint32_t caplen, uint32_t len)
+{
+        static const char pad[4];
+        uint32_t blen = 32 + ((caplen + 3) & ~3);
+
+        ng_write_u32(fp, PCAPNG_EPB);
+        ng_write_u32(fp, blen);
+        ng_write_u32(fp, ifidx);
+        ng_write_u32(fp, (uint32_t)(ts_ns >> 32));
+        ng_write_u32(fp, (uint32_t)ts_ns);
+        ng_write_u32(fp, caplen);
+        ng_write_u32(fp, len);
+        (void)fwrite(sp, caplen, 1, fp);
+        (void)fwrite(pad, (4 - (caplen & 3)) & 3, 1, fp);
+        ng_write_u32(fp, blen);
+}
+
 void
 sr_dump_close(FILE *fp)
 {
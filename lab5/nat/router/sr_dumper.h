@@ -20,6 +20,17 @@
 #define PCAP_PROTO_LEN 2
 
 #define TCPDUMP_MAGIC 0xa1b2c3d4
+#define TCPDUMP_MAGIC_NSEC 0xa1b23c4d /* tv_usec holds nanoseconds */
+
+/* pcapng block types, and the byte order magic in a section header */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
 
 #define LINKTYPE_ETHERNET 1
 
@@ -73,6 +84,19 @@ FILE* sr_dump_open(const char *fname, int thiszone, int snaplen);
  */
 void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
 
+/**
+ * Open a pcapng dump file with one Ethernet interface per name, so each
+ * packet can say which interface it was seen on. Timestamps are in
+ * nanoseconds.
+ */
+FILE* sr_dump_ng_open(const char *fname, const char **ifnames, int nif, int snaplen);
+
+/**
+ * Write a packet seen on interface ifidx (an index into ifnames) at ts_ns
+ */
+void sr_dump_ng(FILE *fp, int ifidx, uint64_t ts_ns, const unsigned char *sp,
+                uint32_t caplen, uint32_t len);
+
 /**
  * Close the file
  */
@@ -0,0 +1,192 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flightrec.c
+ *
+ * Description:
+ *
+ * Packet flight recorder, see sr_flightrec.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "sr_dumper.h"
+#include "sr_flightrec.h"
+
+static struct sr_flightrec_hdr *flightrec;
+static uint8_t *flightrec_data;
+static unsigned int flightrec_snaplen;
+static unsigned char flightrec_lock; /* frames come from more than one thread */
+
+/* Move tail past the records that lie before end - size. */
+static void sr_flightrec_evict(uint64_t end)
+{
+  struct pcap_sf_pkthdr h;
+  uint64_t size = flightrec->size;
+  uint64_t tail = flightrec->tail;
+
+  while(end - tail > size)
+  {
+    uint64_t off = tail % size;
+    if(size - off < sizeof(h))
+    {
+      tail += size - off;
+      continue;
+    }
+    memcpy(&h, flightrec_data + off, sizeof(h));
+    tail += (h.caplen == SR_FLIGHTREC_PAD) ? size - off : sizeof(h) + h.caplen;
+  }
+  /* readers must see the new tail before anything it gave up changes */
+  __atomic_store_n(&(flightrec->tail), tail, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void sr_flightrec_packet(const uint8_t *buf, unsigned int len)
+{
+  struct pcap_sf_pkthdr h;
+  struct timeval now;
+  uint64_t head, off, size;
+  unsigned int caplen;
+
+  if(!__atomic_load_n(&flightrec, __ATOMIC_RELAXED))
+  { return; }
+  caplen = (len < flightrec_snaplen) ? len : flightrec_snaplen;
+  gettimeofday(&now, NULL);
+  h.ts.tv_sec = now.tv_sec;
+  h.ts.tv_usec = now.tv_usec;
+  h.caplen = caplen;
+  h.len = len;
+
+  while(__atomic_test_and_set(&flightrec_lock, __ATOMIC_ACQUIRE))
+  ;
+  if(!flightrec)
+  {
+    /* closed meanwhile */
+    __atomic_clear(&flightrec_lock, __ATOMIC_RELEASE);
+    return;
+  }
+  size = flightrec->size;
+  head = flightrec->head;
+  off = head % size;
+  if(size - off < sizeof(h) + caplen)
+  {
+    /* no room before the end: pad it out and start at the beginning */
+    sr_flightrec_evict(head + size - off);
+    if(size - off >= sizeof(h))
+    {
+      struct pcap_sf_pkthdr pad;
+      memset(&pad, 0, sizeof(pad));
+      pad.caplen = SR_FLIGHTREC_PAD;
+      memcpy(flightrec_data + off, &pad, sizeof(pad));
+    }
+    head += size - off;
+    off = 0;
+  }
+  sr_flightrec_evict(head + sizeof(h) + caplen);
+  memcpy(flightrec_data + off, &h, sizeof(h));
+  memcpy(flightrec_data + off + sizeof(h), buf, caplen);
+  __atomic_store_n(&(flightrec->head), head + sizeof(h) + caplen, __ATOMIC_RELEASE);
+  __atomic_clear(&flightrec_lock, __ATOMIC_RELEASE);
+}
+
+int sr_flightrec_open(const char *spec)
+{
+  struct sr_flightrec_hdr *hdr;
+  char path[1024];
+  const char *comma = strchr(spec, ',');
+  size_t n = comma ? (size_t)(comma - spec) : strlen(spec);
+  unsigned long mb = SR_FLIGHTREC_MB, snaplen = SR_FLIGHTREC_SNAPLEN;
+  uint64_t size;
+  struct stat st;
+  int fd;
+
+  if(n == 0 || n >= sizeof(path))
+  {
+    fprintf(stderr, "flight recorder: expected file[,size=MB][,snap=bytes]\n");
+    return -1;
+  }
+  memcpy(path, spec, n);
+  path[n] = '\0';
+  while(comma)
+  {
+    const char *opt = comma + 1;
+    comma = strchr(opt, ',');
+    if(strncmp(opt, "size=", 5) == 0)
+    { mb = strtoul(opt + 5, NULL, 10); }
+    else if(strncmp(opt, "snap=", 5) == 0)
+    { snaplen = strtoul(opt + 5, NULL, 10); }
+    else
+    {
+      fprintf(stderr, "flight recorder: unknown option %s\n", opt);
+      return -1;
+    }
+  }
+  size = (uint64_t)mb * 1024 * 1024;
+  if(mb == 0 || snaplen == 0 || snaplen > size / 4)
+  {
+    fprintf(stderr, "flight recorder: bad size or snaplen\n");
+    return -1;
+  }
+
+  if((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) != 0)
+  {
+    perror(path);
+    if(fd >= 0)
+    { close(fd); }
+    return -1;
+  }
+  /* allocate every block now, so a full disk cannot fault a later store */
+  if((uint64_t)st.st_size != SR_FLIGHTREC_HDR + size &&
+     (ftruncate(fd, 0) != 0 || posix_fallocate(fd, 0, SR_FLIGHTREC_HDR + size) != 0))
+  {
+    fprintf(stderr, "flight recorder: cannot allocate %lu MB for %s\n", mb, path);
+    close(fd);
+    return -1;
+  }
+  hdr = mmap(NULL, SR_FLIGHTREC_HDR + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(hdr == MAP_FAILED)
+  {
+    perror("flight recorder: mmap");
+    return -1;
+  }
+
+  /* carry on with a ring left by an earlier run, unless it does not fit */
+  if(hdr->magic != SR_FLIGHTREC_MAGIC || hdr->version != SR_FLIGHTREC_VERSION ||
+     hdr->hdr_size != SR_FLIGHTREC_HDR || hdr->size != size || hdr->head < hdr->tail ||
+     hdr->head - hdr->tail > size)
+  {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = SR_FLIGHTREC_MAGIC;
+    hdr->version = SR_FLIGHTREC_VERSION;
+    hdr->hdr_size = SR_FLIGHTREC_HDR;
+    hdr->size = size;
+    hdr->linktype = LINKTYPE_ETHERNET;
+  }
+  /* the snaplen written out covers records from earlier runs too */
+  if(snaplen > hdr->snaplen)
+  { hdr->snaplen = snaplen; }
+  flightrec_snaplen = snaplen;
+  flightrec_data = (uint8_t *)hdr + SR_FLIGHTREC_HDR;
+  __atomic_store_n(&flightrec, hdr, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void sr_flightrec_close(void)
+{
+  struct sr_flightrec_hdr *hdr = __atomic_exchange_n(&flightrec, NULL, __ATOMIC_ACQ_REL);
+
+  if(!hdr)
+  { return; }
+  /* a frame being recorded holds the lock */
+  while(__atomic_test_and_set(&flightrec_lock, __ATOMIC_ACQUIRE))
+  ;
+  munmap(hdr, SR_FLIGHTREC_HDR + hdr->size);
+  __atomic_clear(&flightrec_lock, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,67 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flightrec.h
+ *
+ * Description:
+ *
+ * Packet flight recorder (-D). The last few megabytes of traffic are kept
+ * in a preallocated file mapped into the router: a page of header, then a
+ * circular area of pcap records in sr_dumper's on-disk format (a
+ * pcap_sf_pkthdr and the frame cut to the snaplen). Recording a frame is
+ * a memcpy into the mapping, with no system call; the page cache carries
+ * it to the file, so the ring survives the router dying.
+ *
+ * Positions are byte counts that only grow, reduced modulo the area size
+ * on access. A record never wraps: one that does not fit before the end
+ * starts again at the beginning, behind a pad record if there is room for
+ * one. tail is the oldest whole record, moved past any record before it
+ * is overwritten; head is the end of the newest, moved after it is
+ * written. A reader that copies the area between loading head and tail
+ * can trust the records from that tail up to that head.
+ *
+ * sr_frdump turns a ring, live or left behind, into a normal pcap file.
+ * A router started on an existing ring of the same size carries on
+ * from where it ended.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLIGHTREC_H
+#define SR_FLIGHTREC_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_FLIGHTREC_MAGIC   0x53524652 /* "SRFR" */
+#define SR_FLIGHTREC_VERSION 1
+#define SR_FLIGHTREC_HDR     4096       /* records start here */
+#define SR_FLIGHTREC_MB      64         /* default ring size */
+#define SR_FLIGHTREC_SNAPLEN 128        /* default bytes kept per frame */
+#define SR_FLIGHTREC_PAD     0xffffffff /* caplen of a pad record */
+
+/* At the start of the file, in host byte order. */
+struct sr_flightrec_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdr_size;  /* SR_FLIGHTREC_HDR */
+  uint64_t size;      /* bytes of records after the header */
+  uint32_t snaplen;
+  uint32_t linktype;  /* LINKTYPE_ETHERNET */
+  uint64_t head;      /* see above */
+  uint64_t tail;
+};
+
+/* Start recording into path, which is created or picked up again. spec is
+   path[,size=MB][,snap=bytes]. 0 on success. */
+int sr_flightrec_open(const char *spec);
+
+/* Record a frame. Does nothing if no recorder is open. */
+void sr_flightrec_packet(const uint8_t *buf, unsigned int len);
+
+/* Unmap the ring. What it holds stays in the file. */
+void sr_flightrec_close(void);
+
+#endif /* -- SR_FLIGHTREC_H -- */
@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flowdump.c
+ *
+ * Description:
+ *
+ * Convert NAT flow record files written by sr -F to CSV on stdout.
+ *
+ *   sr_flowdump file [file ...]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "sr_flowlog.h"
+
+static const char *event_name(uint8_t event)
+{
+  switch(event)
+  {
+    case sr_flowlog_create:        return "create";
+    case sr_flowlog_expire:        return "expire";
+    case sr_flowlog_evict:         return "evict";
+    case sr_flowlog_block_assign:  return "block_assign";
+    case sr_flowlog_block_release: return "block_release";
+  }
+  return "unknown";
+}
+
+static int dump_file(const char *path)
+{
+  struct sr_flowlog_hdr hdr;
+  struct sr_flowlog_rec rec;
+  FILE *fp = fopen(path, "rb");
+
+  if(!fp)
+  {
+    perror(path);
+    return -1;
+  }
+  if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || ntohl(hdr.magic) != SR_FLOWLOG_MAGIC ||
+     ntohs(hdr.version) != SR_FLOWLOG_VERSION || ntohs(hdr.rec_size) != sizeof(rec))
+  {
+    fprintf(stderr, "%s: not a flow record file\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  while(fread(&rec, sizeof(rec), 1, fp) == 1)
+  {
+    char ip_int[INET_ADDRSTRLEN], ip_ext[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec.ip_int, ip_int, sizeof(ip_int));
+    inet_ntop(AF_INET, &rec.ip_ext, ip_ext, sizeof(ip_ext));
+    printf("%u.%06u,%s,%s,%s,%u,%s,%u\n",
+           ntohl(rec.ts_sec), ntohl(rec.ts_usec), event_name(rec.event),
+           rec.event >= sr_flowlog_block_assign ? "" : (rec.type == 0 ? "icmp" : "tcp"),
+           ip_int, ntohs(rec.aux_int), ip_ext, ntohs(rec.aux_ext));
+  }
+  fclose(fp);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int i, ret = 0;
+
+  if(argc < 2)
+  {
+    fprintf(stderr, "usage: %s file [file ...]\n", argv[0]);
+    return 1;
+  }
+  printf("time,event,type,ip_int,aux_int,ip_ext,aux_ext\n");
+  for(i = 1; i < argc; i++)
+  {
+    if(dump_file(argv[i]) != 0)
+    { ret = 1; }
+  }
+  return ret;
+}
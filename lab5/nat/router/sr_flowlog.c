@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flowlog.c
+ *
+ * Description:
+ *
+ * NAT flow record export, see sr_flowlog.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "sr_logring.h"
+#include "sr_flowlog.h"
+
+static struct sr_logring flowlog = {
+  "sr_flowlog", SR_FLOWLOG_RING, SR_FLOWLOG_KEEP, SR_FLOWLOG_IDLE_US, SR_FLOWLOG_ROTATE, 0
+};
+
+void sr_flowlog_emit(uint8_t event, uint8_t type, uint32_t ip_int, uint16_t aux_int,
+  uint32_t ip_ext, uint16_t aux_ext)
+{
+  struct sr_flowlog_rec rec;
+  struct timeval now;
+  struct iovec iov;
+
+  if(!sr_logring_running(&flowlog))
+  { return; }
+  gettimeofday(&now, NULL);
+  rec.ts_sec = htonl((uint32_t)now.tv_sec);
+  rec.ts_usec = htonl((uint32_t)now.tv_usec);
+  rec.event = event;
+  rec.type = type;
+  rec.pad = 0;
+  rec.ip_int = ip_int;
+  rec.ip_ext = ip_ext;
+  rec.aux_int = aux_int;
+  rec.aux_ext = aux_ext;
+  iov.iov_base = &rec;
+  iov.iov_len = sizeof(rec);
+  sr_logring_put(&flowlog, &iov, 1);
+}
+
+unsigned long sr_flowlog_dropped(void)
+{ return sr_logring_dropped(&flowlog); }
+
+int sr_flowlog_open(const char *path)
+{
+  struct sr_flowlog_hdr hdr;
+
+  hdr.magic = htonl(SR_FLOWLOG_MAGIC);
+  hdr.version = htons(SR_FLOWLOG_VERSION);
+  hdr.rec_size = htons(sizeof(struct sr_flowlog_rec));
+  if(sr_logring_open(&flowlog, path, &hdr, sizeof(hdr)) != 0)
+  { return -1; }
+  printf("Writing NAT flow records to %s\n", path);
+  return 0;
+}
+
+void sr_flowlog_close(void)
+{
+  if(!sr_logring_running(&flowlog))
+  { return; }
+  sr_logring_close(&flowlog);
+  if(sr_flowlog_dropped())
+  { printf("NAT flow log: %lu records dropped\n", sr_flowlog_dropped()); }
+}
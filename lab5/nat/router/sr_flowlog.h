@@ -0,0 +1,75 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flowlog.h
+ *
+ * Description:
+ *
+ * NAT flow records. A fixed size binary record is emitted when a mapping is
+ * created or removed (or, in port-block mode, when a block is assigned or
+ * released). Records go through the per-thread rings of sr_logring.h, so the
+ * forwarding path never takes a lock or does I/O, into a file that is
+ * rotated by size. Records that do not fit in a full ring are dropped and
+ * counted. sr_flowdump converts the files to CSV.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOWLOG_H
+#define SR_FLOWLOG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_FLOWLOG_MAGIC       0x53524c46 /* "SRLF" */
+#define SR_FLOWLOG_VERSION     1
+#define SR_FLOWLOG_RING        (128 * 1024) /* bytes per producer ring, power of two */
+#define SR_FLOWLOG_ROTATE      (64 * 1024 * 1024) /* bytes per file */
+#define SR_FLOWLOG_KEEP        4     /* rotated files kept as path.1..path.N */
+#define SR_FLOWLOG_IDLE_US     50000 /* writer sleep when the rings are empty */
+
+enum sr_flowlog_event {
+  sr_flowlog_create = 1,
+  sr_flowlog_expire = 2,   /* idle timeout */
+  sr_flowlog_evict = 3,    /* dropped to make room under the table cap */
+  sr_flowlog_block_assign = 4,
+  sr_flowlog_block_release = 5
+};
+
+/* Each file starts with this header, followed by records. */
+struct sr_flowlog_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t rec_size;
+} __attribute__ ((packed)) ;
+
+/* All addresses and ports in network byte order. For block records aux_int
+   and aux_ext are the first and last port of the block and type is 0. */
+struct sr_flowlog_rec {
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint8_t  event;
+  uint8_t  type;      /* sr_nat_mapping_type */
+  uint16_t pad;
+  uint32_t ip_int;
+  uint32_t ip_ext;
+  uint16_t aux_int;
+  uint16_t aux_ext;
+} __attribute__ ((packed)) ;
+
+/* Start writing records to path. 0 on success. */
+int sr_flowlog_open(const char *path);
+
+/* Drain the rings, stop the writer and close the file. */
+void sr_flowlog_close(void);
+
+/* Queue a record. Does nothing if no flow log is open. */
+void sr_flowlog_emit(uint8_t event, uint8_t type, uint32_t ip_int, uint16_t aux_int,
+  uint32_t ip_ext, uint16_t aux_ext);
+
+/* Records dropped because a ring was full. */
+unsigned long sr_flowlog_dropped(void);
+
+#endif /* -- SR_FLOWLOG_H -- */
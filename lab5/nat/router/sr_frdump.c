@@ -0,0 +1,103 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_frdump.c
+ *
+ * Description:
+ *
+ * Snapshot a flight recorder ring written by sr -D into a pcap file, oldest
+ * frame first. The router may still be recording into it.
+ *
+ *   sr_frdump ring out.pcap     (- for stdout)
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_dumper.h"
+#include "sr_flightrec.h"
+
+int main(int argc, char **argv)
+{
+  struct sr_flightrec_hdr *hdr;
+  struct pcap_sf_pkthdr sf;
+  struct pcap_pkthdr h;
+  struct stat st;
+  uint64_t size, head, tail, pos;
+  uint8_t *copy;
+  unsigned long frames = 0;
+  FILE *out;
+  int fd;
+
+  if(argc != 3)
+  {
+    fprintf(stderr, "usage: %s ring out.pcap\n", argv[0]);
+    return 1;
+  }
+  if((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(hdr == MAP_FAILED || (size_t)st.st_size < sizeof(*hdr) ||
+     hdr->magic != SR_FLIGHTREC_MAGIC || hdr->version != SR_FLIGHTREC_VERSION ||
+     (uint64_t)st.st_size != hdr->hdr_size + hdr->size)
+  {
+    fprintf(stderr, "%s: not a flight recorder ring\n", argv[1]);
+    return 1;
+  }
+  size = hdr->size;
+  if((copy = malloc(size)) == NULL)
+  {
+    perror("malloc");
+    return 1;
+  }
+
+  /* everything from the tail after the copy to the head before it is whole */
+  head = __atomic_load_n(&(hdr->head), __ATOMIC_ACQUIRE);
+  memcpy(copy, (uint8_t *)hdr + hdr->hdr_size, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  tail = __atomic_load_n(&(hdr->tail), __ATOMIC_RELAXED);
+  if(tail > head || head - tail > size)
+  { tail = head; }
+
+  if((out = sr_dump_open(argv[2], 0, hdr->snaplen)) == NULL)
+  { return 1; }
+  for(pos = tail; pos < head; )
+  {
+    uint64_t off = pos % size;
+    if(size - off < sizeof(sf))
+    {
+      pos += size - off;
+      continue;
+    }
+    memcpy(&sf, copy + off, sizeof(sf));
+    if(sf.caplen == SR_FLIGHTREC_PAD)
+    {
+      pos += size - off;
+      continue;
+    }
+    if(sf.caplen > size - off - sizeof(sf) || pos + sizeof(sf) + sf.caplen > head)
+    {
+      fprintf(stderr, "%s: bad record at %llu\n", argv[1], (unsigned long long)pos);
+      break;
+    }
+    h.ts.tv_sec = sf.ts.tv_sec;
+    h.ts.tv_usec = sf.ts.tv_usec;
+    h.caplen = sf.caplen;
+    h.len = sf.len;
+    sr_dump(out, &h, copy + off + sizeof(sf));
+    pos += sizeof(sf) + sf.caplen;
+    frames++;
+  }
+  sr_dump_close(out);
+  fprintf(stderr, "%lu frames\n", frames);
+  free(copy);
+  return 0;
+}
@@ -0,0 +1,462 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_gen.c
+ *
+ * Description:
+ *
+ * Synthetic traffic profiles and frames, see sr_gen.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <arpa/inet.h>
+
+#include "sr_gen.h"
+
+#define SR_GEN_ETH  sizeof(sr_ethernet_hdr_t)
+#define SR_GEN_IP   sizeof(sr_ip_hdr_t)
+#define SR_GEN_ICMP (sizeof(sr_icmp_hdr_t) + 4) /* with id and sequence */
+#define SR_GEN_UDPH 8
+#define SR_GEN_TCP  sizeof(sr_tcp_hdr_t)
+
+/* after the ICMP or UDP header */
+struct sr_gen_probe {
+  uint32_t magic;
+  uint32_t seq;
+} __attribute__ ((packed));
+
+struct sr_gen_udp_hdr {
+  uint16_t sport, dport, len, sum;
+} __attribute__ ((packed));
+
+static const char *sr_gen_proto_names[3] = { "icmp", "udp", "tcp" };
+static const uint8_t sr_gen_protos[3] = { ip_protocol_icmp, SR_GEN_UDP, ip_protocol_tcp };
+
+static uint32_t sr_gen_rand(struct sr_gen *g)
+{
+  /* xorshift32, never zero */
+  g->rng ^= g->rng << 13;
+  g->rng ^= g->rng >> 17;
+  g->rng ^= g->rng << 5;
+  return g->rng;
+}
+
+/* Add len bytes to a running ones' complement sum, unfolded. */
+static uint32_t sr_gen_sum(uint32_t sum, const void *data, unsigned int len)
+{
+  const uint8_t *p = data;
+
+  for(; len > 1; p += 2, len -= 2)
+  { sum += (p[0] << 8) | p[1]; }
+  if(len)
+  { sum += p[0] << 8; }
+  return sum;
+}
+
+static uint16_t sr_gen_fold(uint32_t sum)
+{
+  while(sum >> 16)
+  { sum = (sum & 0xffff) + (sum >> 16); }
+  return htons(~sum & 0xffff);
+}
+
+uint16_t sr_gen_cksum(const void *data, int len)
+{ return sr_gen_fold(sr_gen_sum(0, data, len)); }
+
+/* Over the pseudo header and the segment where it lies, which may be as
+   long as the frame it came in. */
+static uint16_t sr_gen_tcp_cksum(sr_ip_hdr_t *ip, unsigned int tcp_len)
+{
+  uint8_t pseudo[12];
+
+  memcpy(pseudo, &ip->ip_src, 4);
+  memcpy(pseudo + 4, &ip->ip_dst, 4);
+  pseudo[8] = 0;
+  pseudo[9] = ip_protocol_tcp;
+  pseudo[10] = tcp_len >> 8;
+  pseudo[11] = tcp_len & 0xff;
+  return sr_gen_fold(sr_gen_sum(sr_gen_sum(0, pseudo, sizeof(pseudo)),
+                                (uint8_t *)ip + ip->ip_hl * 4, tcp_len));
+}
+
+void sr_gen_defaults(struct sr_gen *g)
+{
+  memset(g, 0, sizeof(*g));
+  g->size[0] = 64;
+  g->weight[0] = 1;
+  g->nsize = 1;
+  g->proto_weight[0] = 1;
+  g->dist = sr_gen_uniform;
+  g->zipf_s = 1.0;
+}
+
+int sr_gen_set_sizes(struct sr_gen *g, const char *spec)
+{
+  char buf[256], *item, *save;
+  unsigned int size, weight;
+  int n = 0;
+
+  if(strcmp(spec, "imix") == 0)
+  { spec = "64:7,594:4,1518:1"; }
+  else if(strcmp(spec, "1500") == 0 || strcmp(spec, "mtu") == 0)
+  { spec = "1518"; }
+  strncpy(buf, spec, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for(item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save))
+  {
+    weight = 1;
+    if(n == SR_GEN_SIZES || sscanf(item, "%u:%u", &size, &weight) < 1 ||
+       size < 64 || size > SR_GEN_MAX_FRAME + 4 || weight == 0)
+    { return -1; }
+    g->size[n] = size;
+    g->weight[n] = weight;
+    n++;
+  }
+  if(n == 0)
+  { return -1; }
+  g->nsize = n;
+  return 0;
+}
+
+int sr_gen_set_protos(struct sr_gen *g, const char *spec)
+{
+  char buf[64], name[8], *item, *save;
+  unsigned int weight, w[3] = { 0, 0, 0 };
+  int i;
+
+  strncpy(buf, spec, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  if(strcmp(buf, "mix") == 0)
+  { strcpy(buf, "icmp,udp,tcp"); }
+  for(item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save))
+  {
+    weight = 1;
+    if(sscanf(item, "%7[a-z]:%u", name, &weight) < 1)
+    { return -1; }
+    for(i = 0; i < 3 && strcmp(name, sr_gen_proto_names[i]) != 0; i++);
+    if(i == 3)
+    { return -1; }
+    w[i] += weight;
+  }
+  if(w[0] + w[1] + w[2] == 0)
+  { return -1; }
+  memcpy(g->proto_weight, w, sizeof(w));
+  return 0;
+}
+
+int sr_gen_set_dist(struct sr_gen *g, const char *spec)
+{
+  if(strcmp(spec, "uniform") == 0)
+  { g->dist = sr_gen_uniform; }
+  else if(strcmp(spec, "rr") == 0)
+  { g->dist = sr_gen_rr; }
+  else if(strncmp(spec, "zipf", 4) == 0)
+  {
+    g->dist = sr_gen_zipf;
+    if(spec[4] == ':' && ((g->zipf_s = atof(spec + 5)) <= 0))
+    { return -1; }
+    else if(spec[4] != ':' && spec[4] != 0)
+    { return -1; }
+  }
+  else
+  { return -1; }
+  return 0;
+}
+
+int sr_gen_init(struct sr_gen *g, unsigned int nflows, uint32_t seed)
+{
+  unsigned int i, k, best;
+  int credit[3] = { 0, 0, 0 };
+  int wsum = g->proto_weight[0] + g->proto_weight[1] + g->proto_weight[2];
+  double sum = 0;
+
+  if(nflows == 0 || g->ndst == 0 || nflows > 65536 - 1024)
+  { return -1; }
+  if((g->flows = calloc(nflows, sizeof(struct sr_gen_flow))) == NULL)
+  { return -1; }
+  g->nflows = nflows;
+  g->rng = seed ? seed : 1;
+  g->next = 0;
+
+  for(i = 0; i < nflows; i++)
+  {
+    /* smooth weighted round robin over the protocols */
+    for(k = 0; k < 3; k++)
+    { credit[k] += g->proto_weight[k]; }
+    best = 0;
+    for(k = 1; k < 3; k++)
+    {
+      if(credit[k] > credit[best])
+      { best = k; }
+    }
+    credit[best] -= wsum;
+    k = best;
+    g->flows[i].proto = sr_gen_protos[k];
+    g->flows[i].id = htons(1024 + i);
+    g->flows[i].dst_ip = g->dst_ip[i % g->ndst];
+  }
+
+  g->weight_sum = 0;
+  for(i = 0; i < (unsigned int)g->nsize; i++)
+  { g->weight_sum += g->weight[i]; }
+
+  if(g->dist == sr_gen_zipf)
+  {
+    if((g->cdf = malloc(nflows * sizeof(double))) == NULL)
+    {
+      sr_gen_free(g);
+      return -1;
+    }
+    for(i = 0; i < nflows; i++)
+    {
+      sum += 1.0 / pow(i + 1, g->zipf_s);
+      g->cdf[i] = sum;
+    }
+    for(i = 0; i < nflows; i++)
+    { g->cdf[i] /= sum; }
+  }
+  return 0;
+}
+
+void sr_gen_free(struct sr_gen *g)
+{
+  free(g->flows);
+  free(g->cdf);
+  g->flows = NULL;
+  g->cdf = NULL;
+}
+
+static struct sr_gen_flow *sr_gen_pick(struct sr_gen *g)
+{
+  unsigned int lo = 0, hi, mid;
+  double u;
+
+  switch(g->dist)
+  {
+    case sr_gen_rr:
+      return &g->flows[g->next++ % g->nflows];
+    case sr_gen_zipf:
+      u = (sr_gen_rand(g) >> 8) / (double)(1 << 24);
+      hi = g->nflows - 1;
+      while(lo < hi)
+      {
+        mid = (lo + hi) / 2;
+        if(g->cdf[mid] <= u)
+        { lo = mid + 1; }
+        else
+        { hi = mid; }
+      }
+      return &g->flows[lo];
+    default:
+      return &g->flows[sr_gen_rand(g) % g->nflows];
+  }
+}
+
+static unsigned int sr_gen_size(struct sr_gen *g)
+{
+  unsigned int r, i;
+
+  if(g->nsize == 1)
+  { return g->size[0]; }
+  r = sr_gen_rand(g) % g->weight_sum;
+  for(i = 0; r >= g->weight[i]; i++)
+  { r -= g->weight[i]; }
+  return g->size[i];
+}
+
+unsigned int sr_gen_next(struct sr_gen *g, uint8_t *buf, uint32_t seq, int *dark)
+{
+  struct sr_gen_flow *f = sr_gen_pick(g);
+  sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)buf;
+  sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(buf + SR_GEN_ETH);
+  uint8_t *l4 = buf + SR_GEN_ETH + SR_GEN_IP;
+  struct sr_gen_probe probe;
+  unsigned int len = sr_gen_size(g) - 4, min, l4_len;
+
+  min = SR_GEN_ETH + SR_GEN_IP + ((f->proto == ip_protocol_tcp) ? SR_GEN_TCP :
+        ((f->proto == SR_GEN_UDP) ? SR_GEN_UDPH : SR_GEN_ICMP) + sizeof(probe));
+  if(len < min)
+  { len = min; }
+  l4_len = len - SR_GEN_ETH - SR_GEN_IP;
+  memset(buf, 0, len);
+
+  memcpy(eth->ether_dhost, g->gw_mac, ETHER_ADDR_LEN);
+  memcpy(eth->ether_shost, g->src_mac, ETHER_ADDR_LEN);
+  eth->ether_type = htons(ethertype_ip);
+  ip->ip_v = 4;
+  ip->ip_hl = 5;
+  ip->ip_len = htons(len - SR_GEN_ETH);
+  ip->ip_id = htons(seq & 0xffff);
+  ip->ip_ttl = 64;
+  ip->ip_p = f->proto;
+  ip->ip_src = g->src_ip;
+  ip->ip_dst = f->dst_ip;
+  *dark = 0;
+  if(g->dark_ip && g->miss_pct && sr_gen_rand(g) % 100 < g->miss_pct)
+  {
+    ip->ip_dst = g->dark_ip;
+    *dark = 1;
+  }
+  ip->ip_sum = sr_gen_cksum(ip, SR_GEN_IP);
+
+  probe.magic = htonl(SR_GEN_PROBE_MAGIC);
+  probe.seq = htonl(seq);
+  if(f->proto == ip_protocol_icmp)
+  {
+    sr_icmp_hdr_t *icmp = (sr_icmp_hdr_t *)l4;
+    icmp->icmp_type = 8;
+    memcpy(l4 + 4, &f->id, 2);
+    l4[6] = (seq >> 8) & 0xff;
+    l4[7] = seq & 0xff;
+    memcpy(l4 + SR_GEN_ICMP, &probe, sizeof(probe));
+    icmp->icmp_sum = sr_gen_cksum(icmp, l4_len);
+  }
+  else if(f->proto == SR_GEN_UDP)
+  {
+    struct sr_gen_udp_hdr *udp = (struct sr_gen_udp_hdr *)l4;
+    udp->sport = f->id;
+    udp->dport = htons(SR_GEN_ECHO_PORT);
+    udp->len = htons(l4_len);
+    memcpy(l4 + SR_GEN_UDPH, &probe, sizeof(probe));
+  }
+  else
+  {
+    sr_tcp_hdr_t *tcp = (sr_tcp_hdr_t *)l4;
+    tcp->tcp_sport = f->id;
+    tcp->tcp_dport = htons(SR_GEN_ECHO_PORT);
+    tcp->tcp_seq = htonl(seq);
+    tcp->tcp_off = (SR_GEN_TCP / 4) << 4;
+    tcp->tcp_flags = f->started ? TCP_FLAG_ACK : TCP_FLAG_SYN;
+    tcp->tcp_win = htons(65535);
+    tcp->tcp_sum = sr_gen_tcp_cksum(ip, l4_len);
+    f->started = 1;
+  }
+  return len;
+}
+
+/* The IP header and the payload length past it, or NULL. */
+static sr_ip_hdr_t *sr_gen_ip(const uint8_t *frame, unsigned int len, unsigned int *l4_len)
+{
+  sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(frame + SR_GEN_ETH);
+  unsigned int ip_len, hl;
+
+  if(len < SR_GEN_ETH + SR_GEN_IP ||
+     ntohs(((sr_ethernet_hdr_t *)frame)->ether_type) != ethertype_ip)
+  { return NULL; }
+  ip_len = ntohs(ip->ip_len);
+  hl = ip->ip_hl * 4;
+  if(hl < SR_GEN_IP || ip_len < hl || SR_GEN_ETH + ip_len > len)
+  { return NULL; }
+  *l4_len = ip_len - hl;
+  return ip;
+}
+
+int sr_gen_probe(const uint8_t *frame, unsigned int len, uint32_t *seq)
+{
+  unsigned int l4_len;
+  sr_ip_hdr_t *ip = sr_gen_ip(frame, len, &l4_len);
+  const uint8_t *l4;
+  struct sr_gen_probe probe;
+
+  if(!ip)
+  { return 0; }
+  l4 = (uint8_t *)ip + ip->ip_hl * 4;
+  switch(ip->ip_p)
+  {
+    case ip_protocol_icmp:
+      if(l4_len < SR_GEN_ICMP + sizeof(probe) || l4[0] != 0)
+      { return 0; }
+      memcpy(&probe, l4 + SR_GEN_ICMP, sizeof(probe));
+      break;
+    case SR_GEN_UDP:
+      if(l4_len < SR_GEN_UDPH + sizeof(probe) ||
+         ((struct sr_gen_udp_hdr *)l4)->sport != htons(SR_GEN_ECHO_PORT))
+      { return 0; }
+      memcpy(&probe, l4 + SR_GEN_UDPH, sizeof(probe));
+      break;
+    case ip_protocol_tcp:
+      if(l4_len < SR_GEN_TCP || ((sr_tcp_hdr_t *)l4)->tcp_sport != htons(SR_GEN_ECHO_PORT))
+      { return 0; }
+      *seq = ntohl(((sr_tcp_hdr_t *)l4)->tcp_ack);
+      return 1;
+    default:
+      return 0;
+  }
+  if(probe.magic != htonl(SR_GEN_PROBE_MAGIC))
+  { return 0; }
+  *seq = ntohl(probe.seq);
+  return 1;
+}
+
+unsigned int sr_gen_reflect(uint8_t *frame, unsigned int len, const uint8_t *mac)
+{
+  sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+  unsigned int l4_len;
+  sr_ip_hdr_t *ip = sr_gen_ip(frame, len, &l4_len);
+  uint8_t *l4;
+  uint32_t addr;
+  uint16_t port;
+
+  if(!ip)
+  { return 0; }
+  l4 = (uint8_t *)ip + ip->ip_hl * 4;
+  switch(ip->ip_p)
+  {
+    case ip_protocol_icmp:
+      if(l4_len < SR_GEN_ICMP || l4[0] != 8)
+      { return 0; }
+      break;
+    case SR_GEN_UDP:
+      if(l4_len < SR_GEN_UDPH ||
+         ((struct sr_gen_udp_hdr *)l4)->dport != htons(SR_GEN_ECHO_PORT))
+      { return 0; }
+      break;
+    case ip_protocol_tcp:
+      if(l4_len < SR_GEN_TCP || ((sr_tcp_hdr_t *)l4)->tcp_dport != htons(SR_GEN_ECHO_PORT) ||
+         (((sr_tcp_hdr_t *)l4)->tcp_flags & TCP_FLAG_RST))
+      { return 0; }
+      break;
+    default:
+      return 0;
+  }
+
+  memcpy(eth->ether_dhost, eth->ether_shost, ETHER_ADDR_LEN);
+  memcpy(eth->ether_shost, mac, ETHER_ADDR_LEN);
+  addr = ip->ip_src;
+  ip->ip_src = ip->ip_dst;
+  ip->ip_dst = addr;
+  ip->ip_ttl = 64;
+  ip->ip_sum = 0;
+  ip->ip_sum = sr_gen_cksum(ip, ip->ip_hl * 4);
+
+  if(ip->ip_p == ip_protocol_icmp)
+  {
+    sr_icmp_hdr_t *icmp = (sr_icmp_hdr_t *)l4;
+    icmp->icmp_type = 0;
+    icmp->icmp_sum = 0;
+    icmp->icmp_sum = sr_gen_cksum(icmp, l4_len);
+  }
+  else if(ip->ip_p == SR_GEN_UDP)
+  {
+    struct sr_gen_udp_hdr *udp = (struct sr_gen_udp_hdr *)l4;
+    port = udp->sport;
+    udp->sport = udp->dport;
+    udp->dport = port;
+    udp->sum = 0;
+  }
+  else
+  {
+    sr_tcp_hdr_t *tcp = (sr_tcp_hdr_t *)l4;
+    port = tcp->tcp_sport;
+    tcp->tcp_sport = tcp->tcp_dport;
+    tcp->tcp_dport = port;
+    tcp->tcp_ack = tcp->tcp_seq;
+    tcp->tcp_seq = 0;
+    tcp->tcp_flags = (tcp->tcp_flags & TCP_FLAG_SYN) ? (TCP_FLAG_SYN | TCP_FLAG_ACK) : TCP_FLAG_ACK;
+    tcp->tcp_sum = 0;
+    tcp->tcp_sum = sr_gen_tcp_cksum(ip, l4_len);
+  }
+  return SR_GEN_ETH + ntohs(ip->ip_len);
+}
@@ -0,0 +1,105 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_gen.h
+ *
+ * Description:
+ *
+ * Synthetic traffic for loading the router. A generator sends from one
+ * source host, through the router, over a set of flows to one or more
+ * destination hosts. A profile sets:
+ *
+ *   - frame sizes: 64, 1500, imix or size:weight,... in Ethernet frame
+ *     bytes including the FCS, as RFC 2544 counts them
+ *   - protocols: icmp, udp, tcp or a weighted mix, given to flows in turn
+ *   - how packets pick a flow: uniform, zipf[:s] or rr
+ *   - a share of packets sent to a dark address, one the router can route
+ *     but whose ARP is never answered
+ *
+ * Every frame carries a sequence number. A destination host turns an ICMP
+ * echo request, or UDP or TCP sent to the echo port, into the answer with
+ * sr_gen_reflect. The source matches the answer with sr_gen_probe. UDP is
+ * sent without a checksum. TCP flows start with a SYN and carry the
+ * sequence number in th_seq, which the answer returns in th_ack.
+ *
+ * Nothing here depends on the rest of the router, so the same frames can
+ * be fed to sr_vnsd or a benchmark.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_GEN_H
+#define SR_GEN_H
+
+#include "sr_protocol.h"
+
+#define SR_GEN_MAX_FRAME   1514 /* without the FCS */
+#define SR_GEN_SIZES       16
+#define SR_GEN_DSTS        16
+#define SR_GEN_ECHO_PORT   7
+#define SR_GEN_PROBE_MAGIC 0x7672736e /* "vrsn" */
+#define SR_GEN_UDP         ip_protocol_udp
+
+enum sr_gen_dist {
+  sr_gen_uniform,
+  sr_gen_zipf,
+  sr_gen_rr
+};
+
+struct sr_gen_flow {
+  uint8_t  proto;   /* ip_protocol_icmp, ip_protocol_tcp or SR_GEN_UDP */
+  uint8_t  started; /* TCP: SYN sent */
+  uint16_t id;      /* source port or ICMP id, network byte order */
+  uint32_t dst_ip;
+};
+
+struct sr_gen {
+  /* addresses, set by the caller before sr_gen_init */
+  uint8_t  src_mac[ETHER_ADDR_LEN];
+  uint8_t  gw_mac[ETHER_ADDR_LEN];  /* router on the source's link */
+  uint32_t src_ip;                  /* network byte order, as below */
+  uint32_t dst_ip[SR_GEN_DSTS];
+  int      ndst;
+  uint32_t dark_ip;
+
+  /* profile, defaults from sr_gen_defaults */
+  unsigned int size[SR_GEN_SIZES];  /* frame bytes with FCS */
+  unsigned int weight[SR_GEN_SIZES];
+  int      nsize;
+  unsigned int proto_weight[3];     /* icmp, udp, tcp */
+  enum sr_gen_dist dist;
+  double   zipf_s;
+  unsigned int miss_pct;
+
+  /* state */
+  struct sr_gen_flow *flows;
+  unsigned int nflows;
+  double  *cdf;                     /* zipf */
+  unsigned int weight_sum;
+  uint32_t rng;
+  unsigned long next;               /* rr */
+};
+
+/* 64 byte ICMP frames, one flow, uniform. */
+void sr_gen_defaults(struct sr_gen *g);
+
+/* Profile setters, 0 on success or -1 if spec does not parse. */
+int sr_gen_set_sizes(struct sr_gen *g, const char *spec);
+int sr_gen_set_protos(struct sr_gen *g, const char *spec);
+int sr_gen_set_dist(struct sr_gen *g, const char *spec);
+
+/* Set up nflows flows over the destinations. 0 on success. */
+int sr_gen_init(struct sr_gen *g, unsigned int nflows, uint32_t seed);
+void sr_gen_free(struct sr_gen *g);
+
+/* Build the next frame, carrying seq, into buf (SR_GEN_MAX_FRAME bytes).
+   Returns its length. *dark is set if it went to the dark address. */
+unsigned int sr_gen_next(struct sr_gen *g, uint8_t *buf, uint32_t seq, int *dark);
+
+/* 1 with the sequence number in *seq if frame answers a generated one. */
+int sr_gen_probe(const uint8_t *frame, unsigned int len, uint32_t *seq);
+
+/* Turn an ICMP echo request, or UDP or TCP to the echo port, into the
+   answer from mac, in place. Returns its length, 0 if there is none. */
+unsigned int sr_gen_reflect(uint8_t *frame, unsigned int len, const uint8_t *mac);
+
+uint16_t sr_gen_cksum(const void *data, int len);
+
+#endif /* -- SR_GEN_H -- */
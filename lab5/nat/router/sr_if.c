@@ -76,6 +76,8 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->index = 0;
+        sr->if_list->mss = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
         return;
     }
@@ -87,8 +89,10 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
 
     if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
     assert(if_walker->next);
+    if_walker->next->index = if_walker->index + 1;
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->mss = 0;
     if_walker->next = 0;
 } /* -- sr_add_interface -- */ 
 
@@ -140,6 +144,78 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_load_if(..)
+ * Scope: Global
+ *
+ * Set up the interface list from a file instead of the VNS hardware info,
+ * for the backends that have no server. One interface per line:
+ *
+ *   name  ethernet-address  ip-address
+ *   eth1  02:00:00:00:01:01 10.0.1.1
+ *
+ * Blank lines and lines starting with # are skipped. Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_if(struct sr_instance* sr, const char* filename)
+{
+    FILE* fp;
+    char  line[BUFSIZ];
+    char  name[sr_IFACE_NAMELEN];
+    char  mac[32];
+    char  ip[32];
+    unsigned int b[ETHER_ADDR_LEN];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr ip_addr;
+    int i, lineno = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    if((fp = fopen(filename,"r")) == 0)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    while( fgets(line,BUFSIZ,fp) != 0)
+    {
+        lineno++;
+        if(line[0] == '#' || sscanf(line,"%31s",mac) != 1)
+        { continue; }
+        if(sscanf(line,"%31s %31s %31s",name,mac,ip) != 3 ||
+           sscanf(mac,"%x:%x:%x:%x:%x:%x",&b[0],&b[1],&b[2],&b[3],&b[4],&b[5]) != 6 ||
+           inet_aton(ip,&ip_addr) == 0)
+        {
+            fprintf(stderr,"%s:%d: expected name, ethernet address and IP\n",
+                    filename,lineno);
+            fclose(fp);
+            return -1;
+        }
+        if(sr_get_interface(sr,name))
+        {
+            fprintf(stderr,"%s:%d: duplicate interface %s\n",filename,lineno,name);
+            fclose(fp);
+            return -1;
+        }
+        for(i = 0; i < ETHER_ADDR_LEN; i++)
+        { addr[i] = (unsigned char)b[i]; }
+        sr_add_interface(sr,name);
+        sr_set_ether_addr(sr,addr);
+        sr_set_ether_ip(sr,ip_addr.s_addr);
+    }
+    fclose(fp);
+
+    if(sr->if_list == 0)
+    {
+        fprintf(stderr,"%s: no interfaces\n",filename);
+        return -1;
+    }
+    return 0;
+} /* -- sr_load_if -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
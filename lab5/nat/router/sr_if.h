@@ -41,6 +41,8 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index; /* position in the interface list, from 0 */
+  uint16_t mss;       /* TCP MSS ceiling for SYNs leaving here, 0 for none */
   struct sr_if* next;
 };
 
@@ -48,6 +50,7 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+int sr_load_if(struct sr_instance*, const char* filename);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
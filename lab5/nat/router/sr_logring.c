@@ -0,0 +1,268 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_logring.c
+ *
+ * Description:
+ *
+ * Per-thread log rings and their rotating file writer, see sr_logring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "sr_logring.h"
+
+/* Single producer, single consumer ring of records laid end to end; a
+   record may wrap around the end. head and tail are byte counts that run
+   freely, written only by the producer and the writer respectively. The
+   data follows the struct in the same allocation. */
+struct sr_logring_ring {
+  unsigned long head;
+  unsigned long tail;
+  unsigned long dropped;
+  uint8_t *data;
+};
+
+static pthread_mutex_t logring_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static int logring_nlogs;
+static __thread struct sr_logring_ring *logring_mine[SR_LOGRING_LOGS];
+
+/* The calling thread's ring, registered on first use. */
+static struct sr_logring_ring *sr_logring_ring_get(struct sr_logring *log)
+{
+  struct sr_logring_ring **mine = &(logring_mine[log->id - 1]);
+
+  if(*mine)
+  { return *mine; }
+
+  pthread_mutex_lock(&logring_reg_lock);
+  if(log->nrings < SR_LOGRING_PRODUCERS &&
+     (*mine = calloc(1, sizeof(struct sr_logring_ring) + log->ring_size)) != NULL)
+  {
+    (*mine)->data = (uint8_t *)(*mine + 1);
+    log->rings[log->nrings] = *mine;
+    __atomic_store_n(&(log->nrings), log->nrings + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&logring_reg_lock);
+  return *mine;
+}
+
+int sr_logring_running(struct sr_logring *log)
+{ return __atomic_load_n(&(log->running), __ATOMIC_RELAXED); }
+
+int sr_logring_put(struct sr_logring *log, const struct iovec *parts, int n)
+{
+  struct sr_logring_ring *ring;
+  unsigned long head, len = 0;
+  int i;
+
+  if(!__atomic_load_n(&(log->running), __ATOMIC_RELAXED))
+  { return -1; }
+  if((ring = sr_logring_ring_get(log)) == NULL)
+  {
+    __atomic_fetch_add(&(log->unringed), 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++)
+  { len += parts[i].iov_len; }
+  head = ring->head;
+  if(log->ring_size - (head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE)) < len)
+  {
+    __atomic_fetch_add(&(ring->dropped), 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    unsigned long off = head & (log->ring_size - 1);
+    unsigned long first = parts[i].iov_len;
+    if(first > log->ring_size - off)
+    { first = log->ring_size - off; }
+    memcpy(ring->data + off, parts[i].iov_base, first);
+    memcpy(ring->data, (const uint8_t *)parts[i].iov_base + first, parts[i].iov_len - first);
+    head += parts[i].iov_len;
+  }
+  __atomic_store_n(&(ring->head), head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+unsigned long sr_logring_dropped(struct sr_logring *log)
+{
+  unsigned long dropped = __atomic_load_n(&(log->unringed), __ATOMIC_RELAXED);
+  unsigned int i, n = __atomic_load_n(&(log->nrings), __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++)
+  { dropped += __atomic_load_n(&(log->rings[i]->dropped), __ATOMIC_RELAXED); }
+  return dropped;
+}
+
+/*---------------------------------------------------------------------
+ * Writer side
+ *---------------------------------------------------------------------*/
+
+static int sr_logring_writev_all(int fd, struct iovec *iov, int n)
+{
+  while(n > 0)
+  {
+    ssize_t ret = writev(fd, iov, n);
+    if(ret < 0)
+    {
+      if(errno == EINTR)
+      { continue; }
+      return -1;
+    }
+    while(n > 0 && (size_t)ret >= iov->iov_len)
+    {
+      ret -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if(n > 0)
+    {
+      iov->iov_base = (uint8_t *)iov->iov_base + ret;
+      iov->iov_len -= ret;
+    }
+  }
+  return 0;
+}
+
+/* Open a fresh file at log->path and write its header. */
+static int sr_logring_start_file(struct sr_logring *log)
+{
+  struct iovec iov;
+
+  log->fd = open(log->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(log->fd < 0)
+  {
+    fprintf(stderr, "%s: %s: %s\n", log->what, log->path, strerror(errno));
+    return -1;
+  }
+  iov.iov_base = log->hdr;
+  iov.iov_len = log->hdr_len;
+  log->bytes = log->hdr_len;
+  log->started = time(NULL);
+  return sr_logring_writev_all(log->fd, &iov, 1);
+}
+
+/* path -> path.1 -> ... -> path.keep, dropping the oldest. */
+static void sr_logring_rotate(struct sr_logring *log)
+{
+  char from[1100], to[1100];
+  int i;
+
+  close(log->fd);
+  log->fd = -1;
+  for(i = log->keep - 1; i >= 1; i--)
+  {
+    snprintf(from, sizeof(from), "%s.%d", log->path, i);
+    snprintf(to, sizeof(to), "%s.%d", log->path, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", log->path);
+  rename(log->path, to);
+  sr_logring_start_file(log);
+}
+
+/* Move everything currently queued to the file. Returns bytes written.
+   Rotation happens between ring spans, so a file can run past the size
+   limit by up to one ring. */
+static unsigned long sr_logring_drain(struct sr_logring *log)
+{
+  unsigned int i, n = __atomic_load_n(&(log->nrings), __ATOMIC_ACQUIRE);
+  unsigned long total = 0;
+
+  for(i = 0; i < n; i++)
+  {
+    struct sr_logring_ring *ring = log->rings[i];
+    unsigned long tail = ring->tail;
+    unsigned long head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    unsigned long count = head - tail;
+    unsigned long off = tail & (log->ring_size - 1);
+    struct iovec iov[2];
+    int niov = 1;
+
+    if(count == 0)
+    { continue; }
+    if(log->fd >= 0 && log->bytes > log->hdr_len &&
+       ((log->max_bytes && log->bytes + count > log->max_bytes) ||
+        (log->max_secs && time(NULL) - log->started >= (time_t)log->max_secs)))
+    { sr_logring_rotate(log); }
+
+    iov[0].iov_base = ring->data + off;
+    iov[0].iov_len = count;
+    if(off + count > log->ring_size)
+    {
+      iov[0].iov_len = log->ring_size - off;
+      iov[1].iov_base = ring->data;
+      iov[1].iov_len = count - iov[0].iov_len;
+      niov = 2;
+    }
+    if(log->fd >= 0 && sr_logring_writev_all(log->fd, iov, niov) == 0)
+    { log->bytes += count; }
+    __atomic_store_n(&(ring->tail), head, __ATOMIC_RELEASE);
+    total += count;
+  }
+  return total;
+}
+
+static void *sr_logring_writer(void *arg)
+{
+  struct sr_logring *log = arg;
+
+  while(__atomic_load_n(&(log->running), __ATOMIC_ACQUIRE))
+  {
+    if(sr_logring_drain(log) == 0)
+    { usleep(log->idle_us); }
+  }
+  sr_logring_drain(log);
+  return NULL;
+}
+
+int sr_logring_open(struct sr_logring *log, const char *path, const void *hdr,
+  unsigned int hdr_len)
+{
+  if(strlen(path) >= sizeof(log->path) || hdr_len > SR_LOGRING_HDR_MAX ||
+     log->ring_size == 0 || (log->ring_size & (log->ring_size - 1)))
+  {
+    fprintf(stderr, "%s: bad path or settings\n", log->what);
+    return -1;
+  }
+  pthread_mutex_lock(&logring_reg_lock);
+  if(!log->id && logring_nlogs < SR_LOGRING_LOGS)
+  { log->id = ++logring_nlogs; }
+  pthread_mutex_unlock(&logring_reg_lock);
+  if(!log->id)
+  {
+    fprintf(stderr, "%s: more than %d logs\n", log->what, SR_LOGRING_LOGS);
+    return -1;
+  }
+
+  strcpy(log->path, path);
+  memcpy(log->hdr, hdr, hdr_len);
+  log->hdr_len = hdr_len;
+  if(sr_logring_start_file(log) != 0)
+  { return -1; }
+
+  __atomic_store_n(&(log->running), 1, __ATOMIC_RELEASE);
+  if(pthread_create(&(log->thread), NULL, sr_logring_writer, log) != 0)
+  {
+    log->running = 0;
+    close(log->fd);
+    log->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+void sr_logring_close(struct sr_logring *log)
+{
+  if(!__atomic_exchange_n(&(log->running), 0, __ATOMIC_ACQ_REL))
+  { return; }
+  pthread_join(log->thread, NULL);
+  close(log->fd);
+  log->fd = -1;
+}
@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_logring.h
+ *
+ * Description:
+ *
+ * Lock-free logging to a rotating file, shared by the NAT flow log and the
+ * packet log. Each thread that logs gets a single-producer byte ring of its
+ * own on first use, so putting a record is a copy and a store: no lock, no
+ * system call. A writer thread moves whole ring spans to the file with
+ * writev. A record that does not fit in a full ring is dropped and counted.
+ *
+ * The file starts with a header given at open. Once it passes a size or an
+ * age it is renamed to path.1, the older ones shifting up to path.keep,
+ * and a fresh one is started with the same header. Records from different
+ * threads reach the file a span at a time, so their order may interleave.
+ *
+ * A log is a struct sr_logring, normally static, whose first fields the
+ * owner fills in before sr_logring_open; the rest is zero to begin with.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOGRING_H
+#define SR_LOGRING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define SR_LOGRING_PRODUCERS 8   /* threads that may log to one log */
+#define SR_LOGRING_LOGS      4   /* logs in the process */
+#define SR_LOGRING_HDR_MAX   64  /* bytes of file header */
+
+struct sr_logring_ring;
+
+struct sr_logring {
+  /* set by the owner */
+  const char *what;          /* in messages */
+  unsigned long ring_size;   /* bytes per producer ring, power of two */
+  unsigned int keep;         /* rotated files kept as path.1..path.keep */
+  unsigned int idle_us;      /* writer sleep when the rings are empty */
+  unsigned long max_bytes;   /* rotate when a file would pass this, 0: never */
+  unsigned int max_secs;     /* rotate when a file is this old, 0: never */
+
+  /* private */
+  int id;                    /* slot of the thread's ring pointer, 1 based */
+  struct sr_logring_ring *rings[SR_LOGRING_PRODUCERS];
+  unsigned int nrings;
+  unsigned long unringed;    /* drops from threads without a ring */
+  int running;
+  int fd;
+  char path[1024];
+  uint8_t hdr[SR_LOGRING_HDR_MAX];
+  unsigned int hdr_len;
+  unsigned long bytes;       /* in the current file */
+  time_t started;            /* of the current file */
+  pthread_t thread;
+};
+
+/* Start a fresh file at path beginning with hdr and the writer thread.
+   0 on success. */
+int sr_logring_open(struct sr_logring *log, const char *path, const void *hdr,
+  unsigned int hdr_len);
+
+/* Drain the rings, stop the writer and close the file. */
+void sr_logring_close(struct sr_logring *log);
+
+/* Whether the log is open, for producers to skip building a record. */
+int sr_logring_running(struct sr_logring *log);
+
+/* Queue the n parts as one record. 0 if queued, -1 if the log is closed
+   or the record was dropped. */
+int sr_logring_put(struct sr_logring *log, const struct iovec *parts, int n);
+
+/* Records dropped because a ring was full or could not be had. */
+unsigned long sr_logring_dropped(struct sr_logring *log);
+
+#endif /* -- SR_LOGRING_H -- */
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <sys/types.h>
+#include <arpa/inet.h>
 
 #ifdef _LINUX_
 #include <getopt.h>
@@ -33,6 +34,12 @@
 #include "sr_router.h"
 #include "sr_rt.h"
 #include "sr_nat.h"
+#include "sr_snapshot.h"
+#include "sr_flowlog.h"
+#include "sr_pcaplog.h"
+#include "sr_flightrec.h"
+#include "sr_if.h"
+#include "sr_backend.h"
 extern char* optarg;
 
 /*-----------------------------------------------------------------------------
@@ -50,6 +57,8 @@ static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_set_nat_pool(struct sr_nat* nat, char* list, char* mode);
+static void sr_set_mss(struct sr_instance* sr, char* list);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -66,12 +75,32 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *flightrec = 0;
+    char *snapshot = 0;
+    unsigned int nat_per_host = 0;
+    unsigned int nat_cap = 0;
+    unsigned int nat_rate = 0;
+    unsigned int nat_embryonic = 0;
+    unsigned int nat_block = 0;
+    char *nat_pool = 0;
+    char *nat_pool_mode = "paired";
+    char *nat_int_if = "eth1";
+    char *nat_ext_if = "eth2";
+    char *flowlog = 0;
+    char *mss = 0;
+    char *backend = "vns";
+    char *ifconfig = 0;
+    char vns_spec[128];
+    char *replay = 0;
+    char *replay_out = 0;
+    char replay_spec[512];
+    const struct sr_backend *be;
     struct sr_instance sr;
     struct sr_nat nat;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:n")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:nS:Q:C:L:E:B:P:a:i:e:F:M:b:I:R:W:D:")) != EOF)
     {
         switch (c)
         {
@@ -106,14 +135,91 @@ int main(int argc, char **argv)
 	    case 'n':
 		is_nat_enable = 1;
 		break;
+            case 'S':
+                snapshot = optarg;
+                break;
+            case 'Q':
+                nat_per_host = atoi((char *) optarg);
+                break;
+            case 'C':
+                nat_cap = atoi((char *) optarg);
+                break;
+            case 'L':
+                nat_rate = atoi((char *) optarg);
+                break;
+            case 'E':
+                nat_embryonic = atoi((char *) optarg);
+                break;
+            case 'B':
+                nat_block = atoi((char *) optarg);
+                break;
+            case 'P':
+                nat_pool = optarg;
+                break;
+            case 'a':
+                nat_pool_mode = optarg;
+                break;
+            case 'i':
+                nat_int_if = optarg;
+                break;
+            case 'e':
+                nat_ext_if = optarg;
+                break;
+            case 'F':
+                flowlog = optarg;
+                break;
+            case 'M':
+                mss = optarg;
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 'I':
+                ifconfig = optarg;
+                break;
+            case 'D':
+                flightrec = optarg;
+                break;
+            case 'R':
+                replay = optarg;
+                break;
+            case 'W':
+                replay_out = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
+    /* -- -R/-W are the pcap backend with its output file -- */
+    if(replay_out && !replay)
+    {
+        fprintf(stderr, "-W needs a capture to replay (-R)\n");
+        exit(1);
+    }
+    if(replay)
+    {
+        snprintf(replay_spec, sizeof(replay_spec), "pcap:%s%s%s", replay,
+                 replay_out ? ",out=" : "", replay_out ? replay_out : "");
+        backend = replay_spec;
+    }
+
+    if((be = sr_backend_find(backend)) == NULL)
+    {
+        fprintf(stderr, "Unknown backend %s\n", backend);
+        usage(argv[0]);
+        exit(1);
+    }
+    if(be->need_if_config && !ifconfig)
+    {
+        fprintf(stderr, "The %s backend needs an interface file (-I)\n", be->name);
+        exit(1);
+    }
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    memset(&nat, 0, sizeof(nat));
 
     /* -- set up routing table from file -- */
-    if(template == NULL) {
+    if(template == NULL || be->need_if_config) {
         sr.template[0] = '\0';
         sr_load_rt_wrap(&sr, rtable);
     }
@@ -128,45 +234,120 @@ int main(int argc, char **argv)
     else
     { strncpy(sr.user, user, 32); }
 
-    /* -- set up file pointer for logging of raw packets -- */
+    /* -- signals must be blocked before any thread is spawned: the packet
+          log writer and some backends start theirs when they open -- */
+    if(snapshot)
+    { sr_snapshot_block_signals(); }
+
+    /* -- raw packet log, written by its own thread, flushed on any exit -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        if(sr_pcaplog_open(logfile) != 0)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
             exit(1);
         }
+        atexit(sr_pcaplog_close);
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,&nat,port,server) == -1)
+    /* -- flight recorder, the last frames kept in a mapped file -- */
+    if(flightrec)
     {
-        return 1;
+        if(sr_flightrec_open(flightrec) != 0)
+        { exit(1); }
+        atexit(sr_flightrec_close);
     }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+    if(!be->need_if_config)
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(strchr(backend, ':'))
+        { strncpy(vns_spec, backend, sizeof(vns_spec) - 1); }
+        else
+        { snprintf(vns_spec, sizeof(vns_spec), "%s:%s:%u", be->name, server, port); }
+        vns_spec[sizeof(vns_spec) - 1] = '\0';
+        if(sr_backend_open(&sr, be, vns_spec) == -1)
+        {
+            return 1;
+        }
+
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr, "Routing table not consistent with hardware\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        /* -- no server to describe the interfaces, they come from a file -- */
+        if(sr_load_if(&sr, ifconfig) != 0)
+        { exit(1); }
+        Debug("Router interfaces:\n");
+        sr_print_if_list(&sr);
+        if(sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr, "Routing table not consistent with hardware\n");
+            exit(1);
+        }
+        if(sr_backend_open(&sr, be, backend) == -1)
+        { exit(1); }
     }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+
+    /* -- per interface TCP MSS ceilings, interfaces are known by now -- */
+    if(mss)
+    { sr_set_mss(&sr, mss); }
+
+    /* -- NAT flow records, flushed on any exit -- */
+    if(flowlog)
+    {
+        if(sr_flowlog_open(flowlog) != 0)
+        { exit(1); }
+        atexit(sr_flowlog_close);
     }
 
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
     sr_nat_init(&nat);
+    if(is_nat_enable && sr_nat_set_interfaces(&nat, &sr, nat_int_if, nat_ext_if) != 0)
+    { exit(1); }
+    nat.limits.max_per_host = nat_per_host;
+    nat.limits.max_mappings = nat_cap;
+    nat.limits.new_per_sec = nat_rate;
+    nat.limits.embryonic_per_sec = nat_embryonic;
+    if(nat_pool)
+    { sr_set_nat_pool(&nat, nat_pool, nat_pool_mode); }
+    if(nat_block && sr_nat_set_block_mode(&nat, nat_block) != 0)
+    { exit(1); }
+
+    /* -- warm restart: pick up NAT/ARP state left by the previous run -- */
+    if(snapshot)
+    {
+        sr_snapshot_load(&sr, &nat, snapshot);
+        sr_snapshot_start(&sr, &nat, snapshot);
+    }
 
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr,&nat) == 1);
+    while( sr_backend_poll(&sr,&nat) >= 0);
+
+    sr_backend_close(&sr);
+
+    if(snapshot)
+    { sr_snapshot_save(&sr, &nat, snapshot); }
 
     sr_destroy_instance(&sr);
 
@@ -184,7 +365,22 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file[,snap=bytes][,size=MB][,secs=N]] \n");
+    printf("           [-D flight recorder file[,size=MB][,snap=bytes]] \n");
+    printf("           [-n] [-S snapshot file] \n");
+    printf("           [-Q max mappings per host] [-C max mappings] \n");
+    printf("           [-L max new mappings per second] \n");
+    printf("           [-E max unanswered TCP mappings per host per second] \n");
+    printf("           [-B ports per host, port-block NAT] \n");
+    printf("           [-P external addr,addr,...] [-a paired|rr] \n");
+    printf("           [-i NAT internal iface] [-e NAT external iface] \n");
+    printf("           [-F NAT flow record file] \n");
+    printf("           [-M iface:mss,iface:mss,...] \n");
+    printf("           [-b vns[:server:port]|vns-uring[:server:port]] \n");
+    printf("           [-b pcap:file[,iface][,timed][,out=file]|tap[:prefix]|afpacket[:iface=dev,...]] \n");
+    printf("           [-b shm:socket path] \n");
+    printf("           [-R replay file[,iface][,timed] [-W replay output file]] \n");
+    printf("           [-I interface file, for backends other than vns] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -226,11 +422,6 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
-    {
-        sr_dump_close(sr->logfile);
-    }
-
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -249,12 +440,16 @@ static void sr_init_instance(struct sr_instance* sr)
     assert(sr);
 
     sr->sockfd = -1;
+    sr->rx_buf = 0;
+    sr->rx_head = sr->rx_tail = 0;
+    sr->backend = 0;
+    sr->backend_state = 0;
+    sr->txq = 0;
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -321,3 +516,78 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_set_nat_pool(..)
+ * Scope: local
+ *
+ * Parse a comma separated list of external addresses for the NAT pool.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_set_nat_pool(struct sr_nat* nat, char* list, char* mode)
+{
+    uint32_t pool[SR_NAT_POOL_MAX];
+    unsigned int n = 0;
+    char* addr;
+    sr_nat_pool_mode pool_mode = sr_nat_pool_paired;
+
+    if(strcmp(mode, "rr") == 0)
+    { pool_mode = sr_nat_pool_round_robin; }
+    else if(strcmp(mode, "paired") != 0)
+    {
+        fprintf(stderr,"Unknown NAT pool mode %s\n", mode);
+        exit(1);
+    }
+
+    for(addr = strtok(list, ","); addr; addr = strtok(NULL, ","))
+    {
+        struct in_addr in;
+        if(n == SR_NAT_POOL_MAX || inet_pton(AF_INET, addr, &in) != 1)
+        {
+            fprintf(stderr,"Bad or too many NAT pool addresses at %s\n", addr);
+            exit(1);
+        }
+        pool[n++] = in.s_addr;
+    }
+
+    if(sr_nat_set_pool(nat, pool, n, pool_mode) != 0)
+    { exit(1); }
+} /* -- sr_set_nat_pool -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_set_mss(..)
+ * Scope: local
+ *
+ * Parse a comma separated list of iface:mss pairs. TCP SYNs routed out of
+ * such an interface get their MSS option lowered to the given value.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_set_mss(struct sr_instance* sr, char* list)
+{
+    char* item;
+
+    for(item = strtok(list, ","); item; item = strtok(NULL, ","))
+    {
+        char* colon = strchr(item, ':');
+        struct sr_if* iface;
+        int mss;
+
+        if(!colon)
+        {
+            fprintf(stderr,"Bad MSS setting %s, expected iface:mss\n", item);
+            exit(1);
+        }
+        *colon = '\0';
+        mss = atoi(colon + 1);
+        iface = sr_get_interface(sr, item);
+        if(!iface || mss < 64 || mss > 65535)
+        {
+            fprintf(stderr,"Bad MSS setting %s:%s\n", item, colon + 1);
+            exit(1);
+        }
+        iface->mss = (uint16_t)mss;
+        printf("Clamping TCP MSS to %d on %s\n", mss, item);
+    }
+} /* -- sr_set_mss -- */
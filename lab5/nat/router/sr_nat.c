@@ -1,9 +1,621 @@
 #include <signal.h>
 #include <assert.h>
 #include "sr_nat.h"
+#include "sr_flowlog.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* Hash of the internal key. The low bits pick the shard, the rest the bucket.
+   Address and port are spread separately before they are combined, so that
+   the low address byte and the port bytes cannot cancel each other out. */
+static uint32_t sr_nat_hash_int(uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type)
+{
+  uint32_t h = (ip_int * 0x9e3779b1) ^ ((((uint32_t)aux_int << 1) | (uint32_t)type) * 0x85ebca6b);
+  h ^= h >> 16;
+  h *= 0x7feb352d;
+  h ^= h >> 15;
+  h *= 0x846ca68b;
+  h ^= h >> 16;
+  return h;
+}
+
+static uint64_t sr_nat_now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#ifdef SR_NAT_LOCKSTAT
+static uint64_t sr_nat_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static struct sr_nat_shard *sr_nat_shard_of_ext(struct sr_nat *nat, uint16_t aux_ext)
+{
+  return &(nat->shards[ntohs(aux_ext) & (SR_NAT_SHARDS - 1)]);
+}
+
+static struct sr_nat_mapping **sr_nat_int_bucket(struct sr_nat_shard *shard, uint32_t h)
+{
+  return &(shard->int_buckets[(h / SR_NAT_SHARDS) & (shard->nbuckets - 1)]);
+}
+
+static struct sr_nat_mapping **sr_nat_ext_bucket(struct sr_nat_shard *shard,
+  uint32_t ip_ext, uint16_t aux_ext)
+{
+  uint32_t h = (ntohs(aux_ext) / SR_NAT_SHARDS) ^ ((ntohl(ip_ext) * 0x9e3779b1) >> 20);
+  return &(shard->ext_buckets[h & (shard->nbuckets - 1)]);
+}
+
+/* Index of an address in the external pool, or -1. With no pool configured
+   only the external interface's address is slot 0. */
+static int sr_nat_pool_index(struct sr_nat *nat, uint32_t ip_ext)
+{
+  unsigned int i;
+  if(nat->pool_size == 0)
+  { return (nat->ext_if && ip_ext == nat->ext_if->ip) ? 0 : -1; }
+  for(i = 0; i < nat->pool_size; i++)
+  {
+    if(nat->pool[i] == ip_ext)
+    { return i; }
+  }
+  return -1;
+}
+
+/* Pool slot for a host seen for the first time. */
+static int sr_nat_pool_assign(struct sr_nat *nat, uint32_t ip_int)
+{
+  if(nat->pool_size <= 1)
+  { return 0; }
+  if(nat->pool_mode == sr_nat_pool_round_robin)
+  { return __sync_fetch_and_add(&(nat->pool_next), 1) % nat->pool_size; }
+  return sr_nat_hash_int(ip_int, 0, 0) % nat->pool_size;
+}
+
+/*---------------------------------------------------------------------
+ * Shard locking. Built with -DSR_NAT_LOCKSTAT every hold is timed, which
+ * costs two clock reads per lock and is meant for sr_nat_bench only.
+ *---------------------------------------------------------------------*/
+
+static void sr_nat_shard_lock(struct sr_nat_shard *shard)
+{
+  pthread_mutex_lock(&(shard->lock));
+#ifdef SR_NAT_LOCKSTAT
+  if(shard->lock_depth++ == 0)
+  { shard->lock_start = sr_nat_now_ns(); }
+#endif
+}
+
+static void sr_nat_shard_unlock(struct sr_nat_shard *shard)
+{
+#ifdef SR_NAT_LOCKSTAT
+  if(--shard->lock_depth == 0)
+  {
+    uint64_t held = sr_nat_now_ns() - shard->lock_start;
+    shard->lock_ns += held;
+    shard->lock_holds++;
+    if(held > shard->lock_max_ns)
+    { shard->lock_max_ns = held; }
+  }
+#endif
+  pthread_mutex_unlock(&(shard->lock));
+}
+
+/*---------------------------------------------------------------------
+ * Port blocks (sr_nat_alloc_block). Block b covers the block_size ports
+ * starting at SR_NAT_PORT_MIN + b * block_size. Since block_size is a
+ * multiple of SR_NAT_SHARDS every block has the same number of ports in
+ * each shard's residue class. Each pool address has its own nblocks
+ * blocks: block_owner[pool_idx * nblocks + b] is the internal IP holding
+ * block b of that address, or 0. It is written under block_lock and read
+ * without it.
+ *---------------------------------------------------------------------*/
+
+static void sr_nat_block_log(struct sr_nat *nat, const char *what, int pool_idx,
+  uint16_t base, uint32_t ip_int)
+{
+  char buf[INET_ADDRSTRLEN];
+  struct in_addr addr;
+  addr.s_addr = ip_int;
+  inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+  printf("NAT block %s: %s ports %u-%u", what, buf, base, base + nat->block_size - 1);
+  if(nat->pool_size)
+  {
+    addr.s_addr = nat->pool[pool_idx];
+    inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+    printf(" on %s", buf);
+  }
+  printf("\n");
+}
+
+/* Flow record for a per-mapping event. In block mode only blocks are logged,
+   each mapping is implied by its block. */
+static void sr_nat_flow_record(struct sr_nat *nat, uint8_t event, const struct sr_nat_mapping *mapping)
+{
+  if(nat->alloc_mode == sr_nat_alloc_block)
+  { return; }
+  sr_flowlog_emit(event, (uint8_t)mapping->type, mapping->ip_int, mapping->aux_int,
+                  mapping->ip_ext, mapping->aux_ext);
+}
+
+static void sr_nat_block_record(struct sr_nat *nat, uint8_t event, int pool_idx,
+  uint16_t base, uint32_t ip_int)
+{
+  uint32_t ip_ext = nat->pool_size ? nat->pool[pool_idx] : (nat->ext_if ? nat->ext_if->ip : 0);
+  sr_flowlog_emit(event, 0, ip_int, htons(base), ip_ext, htons(base + nat->block_size - 1));
+}
+
+/* (Re)size the owner table for the current pool. */
+static int sr_nat_blocks_alloc(struct sr_nat *nat)
+{
+  unsigned int naddrs = nat->pool_size ? nat->pool_size : 1;
+  free(nat->block_owner);
+  nat->block_owner = calloc(nat->nblocks * naddrs, sizeof(uint32_t));
+  nat->next_block = 0;
+  return nat->block_owner ? 0 : -1;
+}
+
+/* Claim a free block of pool address pool_idx for ip_int, or the block
+   starting at want if non-zero. Returns the first port of the block, or 0 if
+   none could be claimed. */
+static uint16_t sr_nat_block_claim(struct sr_nat *nat, uint32_t ip_int, int pool_idx, uint16_t want)
+{
+  uint32_t *owner = nat->block_owner + pool_idx * nat->nblocks;
+  unsigned int i, b = 0;
+  uint16_t base = 0;
+
+  pthread_mutex_lock(&(nat->block_lock));
+  if(want)
+  {
+    b = (want - SR_NAT_PORT_MIN) / nat->block_size;
+    if(b < nat->nblocks && owner[b] == 0)
+    { base = want; }
+  }
+  else
+  {
+    for(i = 0; i < nat->nblocks; i++)
+    {
+      b = (nat->next_block + i) % nat->nblocks;
+      if(owner[b] == 0)
+      {
+        base = SR_NAT_PORT_MIN + b * nat->block_size;
+        nat->next_block = (b + 1) % nat->nblocks;
+        break;
+      }
+    }
+  }
+  if(base)
+  { __atomic_store_n(&(owner[b]), ip_int, __ATOMIC_RELEASE); }
+  pthread_mutex_unlock(&(nat->block_lock));
+
+  if(base)
+  {
+    sr_nat_block_log(nat, "assigned", pool_idx, base, ip_int);
+    sr_nat_block_record(nat, sr_flowlog_block_assign, pool_idx, base, ip_int);
+  }
+  return base;
+}
+
+static void sr_nat_block_release(struct sr_nat *nat, int pool_idx, uint16_t base, uint32_t ip_int)
+{
+  uint32_t *owner = nat->block_owner + pool_idx * nat->nblocks;
+  pthread_mutex_lock(&(nat->block_lock));
+  __atomic_store_n(&(owner[(base - SR_NAT_PORT_MIN) / nat->block_size]), 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&(nat->block_lock));
+  sr_nat_block_log(nat, "released", pool_idx, base, ip_int);
+  sr_nat_block_record(nat, sr_flowlog_block_release, pool_idx, base, ip_int);
+}
+
+/* Whether an external address and port (host byte order) lie in a block
+   that is in use. */
+static int sr_nat_block_owned(struct sr_nat *nat, uint32_t ip_ext, uint16_t port)
+{
+  int pool_idx = sr_nat_pool_index(nat, ip_ext);
+  unsigned int b;
+  if(pool_idx < 0 || port < SR_NAT_PORT_MIN)
+  { return 0; }
+  b = (port - SR_NAT_PORT_MIN) / nat->block_size;
+  return b < nat->nblocks &&
+    __atomic_load_n(&(nat->block_owner[pool_idx * nat->nblocks + b]), __ATOMIC_ACQUIRE) != 0;
+}
+
+/* Take cost from a bucket refilled at rate tokens per second and holding at
+   most a second's worth. Tokens are counted in millionths so the refill is
+   exact integer math: each microsecond adds rate units. A cost of 1e6 is one
+   token; a shard pays SR_NAT_SHARDS * 1e6 to get its share of a table-wide
+   rate. */
+static int sr_nat_bucket_take(uint64_t *tokens, uint64_t *stamp, unsigned int rate, uint64_t cost)
+{
+  uint64_t burst = (uint64_t)rate * 1000000;
+  uint64_t now;
+
+  if(rate == 0)
+  { return 0; }
+  if(burst < cost)
+  { burst = cost; }
+
+  now = sr_nat_now_us();
+  if(*stamp == 0)
+  { *tokens = burst; }
+  else
+  { *tokens += (now - *stamp) * rate; }
+  *stamp = now;
+  if(*tokens > burst)
+  { *tokens = burst; }
+
+  if(*tokens < cost)
+  { return -1; }
+  *tokens -= cost;
+  return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Per internal host accounting. Host stripes have their own locks, which
+ * are only ever taken while holding a shard lock (never the other way).
+ *---------------------------------------------------------------------*/
+
+static struct sr_nat_host_stripe *sr_nat_host_stripe_of(struct sr_nat *nat, uint32_t ip_int,
+  struct sr_nat_host ***bucket)
+{
+  uint32_t h = sr_nat_hash_int(ip_int, 0, 0);
+  struct sr_nat_host_stripe *stripe = &(nat->hosts[h & (SR_NAT_SHARDS - 1)]);
+  *bucket = &(stripe->buckets[(h / SR_NAT_SHARDS) & (SR_NAT_HOST_BUCKETS - 1)]);
+  return stripe;
+}
+
+/* Charge one mapping to ip_int. Returns -1 if enforce is set and the host is
+   already at its quota. The host's external pool slot is returned in
+   *pool_idx and, in block mode, its port block in *block, both assigned on
+   first use. If *pool_idx is not -1 or *block is non-zero on entry the host
+   must have (or be able to get) exactly those. Returns -2 if not. For an
+   embryonic mapping the host must also have an embryonic token left, -3 if
+   not. */
+static int sr_nat_host_acquire(struct sr_nat *nat, uint32_t ip_int, int enforce,
+  int embryonic, int *pool_idx, uint16_t *block)
+{
+  struct sr_nat_host **bucket;
+  struct sr_nat_host_stripe *stripe = sr_nat_host_stripe_of(nat, ip_int, &bucket);
+  struct sr_nat_host *host;
+  int ret = 0;
+
+  pthread_mutex_lock(&(stripe->lock));
+  for(host = *bucket; host; host = host->next)
+  {
+    if(host->ip_int == ip_int)
+    { break; }
+  }
+  if(!host)
+  {
+    host = calloc(1, sizeof(struct sr_nat_host));
+    host->ip_int = ip_int;
+    host->pool_idx = (*pool_idx >= 0) ? *pool_idx : sr_nat_pool_assign(nat, ip_int);
+    host->next = *bucket;
+    *bucket = host;
+  }
+  if(enforce && nat->limits.max_per_host && host->mappings >= nat->limits.max_per_host)
+  { ret = -1; }
+  else if(embryonic && sr_nat_bucket_take(&(host->emb_tokens), &(host->emb_stamp),
+                                          nat->limits.embryonic_per_sec, 1000000) != 0)
+  { ret = -3; }
+  else if(*pool_idx >= 0 && *pool_idx != host->pool_idx)
+  { ret = -2; }
+  else if(nat->alloc_mode == sr_nat_alloc_block)
+  {
+    if(host->block == 0)
+    { host->block = sr_nat_block_claim(nat, ip_int, host->pool_idx, *block); }
+    if(host->block == 0 || (*block && *block != host->block))
+    { ret = -2; }
+    else
+    { *block = host->block; }
+  }
+  if(ret == 0)
+  {
+    host->mappings++;
+    *pool_idx = host->pool_idx;
+  }
+  else if(host->mappings == 0)
+  {
+    /* nothing charged yet, do not keep an empty host around */
+    if(host->block)
+    { sr_nat_block_release(nat, host->pool_idx, host->block, ip_int); }
+    *bucket = host->next;
+    free(host);
+  }
+  pthread_mutex_unlock(&(stripe->lock));
+  return ret;
+}
+
+/* Give back one mapping charged to ip_int, forgetting the host at zero. */
+static void sr_nat_host_release(struct sr_nat *nat, uint32_t ip_int)
+{
+  struct sr_nat_host **bucket;
+  struct sr_nat_host_stripe *stripe = sr_nat_host_stripe_of(nat, ip_int, &bucket);
+  struct sr_nat_host **link;
+
+  pthread_mutex_lock(&(stripe->lock));
+  for(link = bucket; *link; link = &((*link)->next))
+  {
+    struct sr_nat_host *host = *link;
+    if(host->ip_int != ip_int)
+    { continue; }
+    if(host->mappings > 0)
+    { host->mappings--; }
+    if(host->mappings == 0)
+    {
+      if(host->block)
+      { sr_nat_block_release(nat, host->pool_idx, host->block, ip_int); }
+      *link = host->next;
+      free(host);
+    }
+    break;
+  }
+  pthread_mutex_unlock(&(stripe->lock));
+}
+
+/*---------------------------------------------------------------------
+ * Shard internals. The shard lock must be held for all of these.
+ *---------------------------------------------------------------------*/
+
+/* Find a mapping by external key. */
+static struct sr_nat_mapping *sr_nat_find_ext(struct sr_nat_shard *shard,
+  uint32_t ip_ext, uint16_t aux_ext, sr_nat_mapping_type type)
+{
+  struct sr_nat_mapping *entry = *sr_nat_ext_bucket(shard, ip_ext, aux_ext);
+  while(entry)
+  {
+    if( (entry->aux_ext == aux_ext) && (entry->type == type) && (entry->ip_ext == ip_ext) )
+    {
+      break;
+    }
+    entry = entry->ext_next;
+  }
+  return entry;
+}
+
+/* Find a mapping by internal key, h being its sr_nat_hash_int. */
+static struct sr_nat_mapping *sr_nat_find_int(struct sr_nat_shard *shard, uint32_t h,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type)
+{
+  struct sr_nat_mapping *entry = *sr_nat_int_bucket(shard, h);
+  while(entry)
+  {
+    if( (entry->aux_int == aux_int) && (entry->type == type) && (entry->ip_int == ip_int) )
+    {
+      break;
+    }
+    entry = entry->next;
+  }
+  return entry;
+}
+
+/* Embryonic mappings are kept on their own list, see sr_nat_mapping_state. */
+static void sr_nat_lru_unlink(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping)
+{
+  int emb = (mapping->state == nat_mapping_embryonic);
+  if(mapping->lru_prev)
+  { mapping->lru_prev->lru_next = mapping->lru_next; }
+  else if(emb)
+  { shard->emb_head = mapping->lru_next; }
+  else
+  { shard->lru_head = mapping->lru_next; }
+  if(mapping->lru_next)
+  { mapping->lru_next->lru_prev = mapping->lru_prev; }
+  else if(emb)
+  { shard->emb_tail = mapping->lru_prev; }
+  else
+  { shard->lru_tail = mapping->lru_prev; }
+  mapping->lru_prev = mapping->lru_next = NULL;
+}
+
+static void sr_nat_lru_push(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping)
+{
+  struct sr_nat_mapping **head = &(shard->lru_head), **tail = &(shard->lru_tail);
+  if(mapping->state == nat_mapping_embryonic)
+  {
+    head = &(shard->emb_head);
+    tail = &(shard->emb_tail);
+  }
+  mapping->lru_prev = NULL;
+  mapping->lru_next = *head;
+  if(*head)
+  { (*head)->lru_prev = mapping; }
+  else
+  { *tail = mapping; }
+  *head = mapping;
+}
+
+/* Mark a mapping as just used. Embryonic mappings keep their creation time
+   so that retransmitted SYNs do not extend them and their list stays in
+   creation order. */
+static void sr_nat_touch(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping)
+{
+  if(mapping->state == nat_mapping_embryonic)
+  { return; }
+  mapping->last_updated = time(NULL);
+  if(shard->lru_head != mapping)
+  {
+    sr_nat_lru_unlink(shard, mapping);
+    sr_nat_lru_push(shard, mapping);
+  }
+}
+
+/* Return traffic arrived for an embryonic mapping: move it to the LRU list. */
+static void sr_nat_promote(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping)
+{
+  sr_nat_lru_unlink(shard, mapping);
+  mapping->state = nat_mapping_established;
+  mapping->last_updated = time(NULL);
+  sr_nat_lru_push(shard, mapping);
+  shard->emb_count--;
+  shard->stats.promoted++;
+}
+
+/* Double the shard's buckets and rehash its mappings into them. Keeps the
+   old ones if there is no memory for new ones. */
+static void sr_nat_grow(struct sr_nat_shard *shard)
+{
+  struct sr_nat_mapping **old_int = shard->int_buckets, **old_ext = shard->ext_buckets;
+  struct sr_nat_mapping *mapping, *next, **bucket;
+  unsigned int i, old_n = shard->nbuckets;
+
+  shard->int_buckets = calloc(old_n * 2, sizeof(struct sr_nat_mapping *));
+  shard->ext_buckets = calloc(old_n * 2, sizeof(struct sr_nat_mapping *));
+  if(!shard->int_buckets || !shard->ext_buckets)
+  {
+    free(shard->int_buckets);
+    free(shard->ext_buckets);
+    shard->int_buckets = old_int;
+    shard->ext_buckets = old_ext;
+    return;
+  }
+  shard->nbuckets = old_n * 2;
+  for(i = 0; i < old_n; i++)
+  {
+    for(mapping = old_int[i]; mapping; mapping = next)
+    {
+      next = mapping->next;
+      bucket = sr_nat_int_bucket(shard, sr_nat_hash_int(mapping->ip_int, mapping->aux_int,
+                                                        mapping->type));
+      mapping->next = *bucket;
+      *bucket = mapping;
+    }
+    for(mapping = old_ext[i]; mapping; mapping = next)
+    {
+      next = mapping->ext_next;
+      bucket = sr_nat_ext_bucket(shard, mapping->ip_ext, mapping->aux_ext);
+      mapping->ext_next = *bucket;
+      *bucket = mapping;
+    }
+  }
+  free(old_int);
+  free(old_ext);
+}
+
+/* Hook a filled-in mapping into the shard's buckets and LRU list. */
+static void sr_nat_link(struct sr_nat_shard *shard, struct sr_nat_mapping *mapping, uint32_t h)
+{
+  struct sr_nat_mapping **bucket;
+
+  if(shard->count >= shard->nbuckets)
+  { sr_nat_grow(shard); }
+  bucket = sr_nat_int_bucket(shard, h);
+  mapping->next = *bucket;
+  *bucket = mapping;
+  bucket = sr_nat_ext_bucket(shard, mapping->ip_ext, mapping->aux_ext);
+  mapping->ext_next = *bucket;
+  *bucket = mapping;
+  sr_nat_lru_push(shard, mapping);
+  shard->count++;
+  if(mapping->state == nat_mapping_embryonic)
+  { shard->emb_count++; }
+}
+
+/* Unhook a mapping from the shard, release its host charge and free it. */
+static void sr_nat_remove(struct sr_nat *nat, struct sr_nat_shard *shard, struct sr_nat_mapping *mapping)
+{
+  uint32_t h = sr_nat_hash_int(mapping->ip_int, mapping->aux_int, mapping->type);
+  struct sr_nat_mapping **link = sr_nat_int_bucket(shard, h);
+
+  while(*link && *link != mapping)
+  { link = &((*link)->next); }
+  if(*link)
+  { *link = mapping->next; }
+
+  link = sr_nat_ext_bucket(shard, mapping->ip_ext, mapping->aux_ext);
+  while(*link && *link != mapping)
+  { link = &((*link)->ext_next); }
+  if(*link)
+  { *link = mapping->ext_next; }
+
+  sr_nat_lru_unlink(shard, mapping);
+  shard->count--;
+  if(mapping->state == nat_mapping_embryonic)
+  { shard->emb_count--; }
+  sr_nat_host_release(nat, mapping->ip_int);
+  free(mapping);
+}
+
+
+/* Make room for one more mapping under the table-wide cap. The oldest
+   embryonic mapping goes first; failing that the least recently used mapping
+   if it has been idle long enough, unless the newcomer is itself embryonic. */
+static int sr_nat_make_room(struct sr_nat *nat, struct sr_nat_shard *shard, int embryonic)
+{
+  unsigned int cap;
+  struct sr_nat_mapping *victim = shard->emb_tail;
+
+  if(nat->limits.max_mappings == 0)
+  { return 0; }
+  cap = (nat->limits.max_mappings + SR_NAT_SHARDS - 1) / SR_NAT_SHARDS;
+  if(shard->count < cap)
+  { return 0; }
+
+  if(!victim && !embryonic)
+  {
+    victim = shard->lru_tail;
+    if(victim && difftime(time(NULL), victim->last_updated) < SR_NAT_EVICT_IDLE)
+    { victim = NULL; }
+  }
+  if(victim)
+  {
+    sr_nat_flow_record(nat, sr_flowlog_evict, victim);
+    sr_nat_remove(nat, shard, victim);
+    shard->stats.evicted++;
+    return 0;
+  }
+  return -1;
+}
+
+/* Pick a free port on ip_ext in the shard's residue class, or 0 if none left. */
+static uint16_t sr_nat_alloc_port(struct sr_nat_shard *shard, uint32_t ip_ext, sr_nat_mapping_type type)
+{
+  unsigned int tries;
+  unsigned int nports = (SR_NAT_PORT_MAX + 1 - SR_NAT_PORT_MIN) / SR_NAT_SHARDS;
+
+  for(tries = 0; tries < nports; tries++)
+  {
+    uint16_t port = shard->next_port;
+    if(shard->next_port > SR_NAT_PORT_MAX - SR_NAT_SHARDS)
+    {
+      shard->next_port = SR_NAT_PORT_MIN + (port & (SR_NAT_SHARDS - 1));
+    }
+    else
+    {
+      shard->next_port += SR_NAT_SHARDS;
+    }
+    if(!sr_nat_find_ext(shard, ip_ext, htons(port), type))
+    {
+      return port;
+    }
+  }
+  return 0;
+}
+
+/* Pick a free external port for the shard inside a host's port block. */
+static uint16_t sr_nat_alloc_block_port(struct sr_nat *nat, struct sr_nat_shard *shard,
+  uint16_t block, uint32_t ip_ext, sr_nat_mapping_type type)
+{
+  unsigned int i;
+  uint16_t port = block + (uint16_t)(shard - nat->shards);
+
+  for(i = 0; i < nat->block_size / SR_NAT_SHARDS; i++, port += SR_NAT_SHARDS)
+  {
+    if(!sr_nat_find_ext(shard, ip_ext, htons(port), type))
+    {
+      return port;
+    }
+  }
+  return 0;
+}
+
 int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 
   assert(nat);
@@ -11,7 +623,34 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
   /* Acquire mutex lock */
   pthread_mutexattr_init(&(nat->attr));
   pthread_mutexattr_settype(&(nat->attr), PTHREAD_MUTEX_RECURSIVE);
-  int success = pthread_mutex_init(&(nat->lock), &(nat->attr));
+  int success = 0;
+  int i;
+
+  /* Initialize any variables here */
+  memset(&(nat->limits), 0, sizeof(nat->limits));
+  nat->alloc_mode = sr_nat_alloc_dynamic;
+  nat->block_size = 0;
+  nat->block_owner = NULL;
+  nat->nblocks = nat->next_block = 0;
+  nat->pool_size = 0;
+  nat->pool_mode = sr_nat_pool_paired;
+  nat->pool_next = 0;
+  nat->int_if = nat->ext_if = NULL;
+  success |= pthread_mutex_init(&(nat->block_lock), &(nat->attr));
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    struct sr_nat_host_stripe *stripe = &(nat->hosts[i]);
+    memset(shard, 0, sizeof(*shard));
+    shard->nbuckets = SR_NAT_BUCKETS;
+    shard->int_buckets = calloc(SR_NAT_BUCKETS, sizeof(struct sr_nat_mapping *));
+    shard->ext_buckets = calloc(SR_NAT_BUCKETS, sizeof(struct sr_nat_mapping *));
+    stripe->buckets = calloc(SR_NAT_HOST_BUCKETS, sizeof(struct sr_nat_host *));
+    assert(shard->int_buckets && shard->ext_buckets && stripe->buckets);
+    shard->next_port = SR_NAT_PORT_MIN + i;
+    success |= pthread_mutex_init(&(shard->lock), &(nat->attr));
+    success |= pthread_mutex_init(&(stripe->lock), &(nat->attr));
+  }
 
   /* Initialize timeout thread */
 
@@ -21,103 +660,217 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
   pthread_attr_setscope(&(nat->thread_attr), PTHREAD_SCOPE_SYSTEM);
   pthread_create(&(nat->thread), &(nat->thread_attr), sr_nat_timeout, nat);
 
-  /* CAREFUL MODIFYING CODE ABOVE THIS LINE! */
+  return success;
+}
 
-  nat->mappings = NULL; /*initial, no mapping*/
-  /* Initialize any variables here */
+int sr_nat_set_interfaces(struct sr_nat *nat, struct sr_instance *sr,
+  const char *int_name, const char *ext_name)
+{
+  nat->int_if = sr_get_interface(sr, int_name);
+  nat->ext_if = sr_get_interface(sr, ext_name);
+  if(!nat->int_if || !nat->ext_if || nat->int_if == nat->ext_if)
+  {
+    fprintf(stderr, "NAT needs two distinct interfaces, got internal %s and external %s\n",
+            int_name, ext_name);
+    nat->int_if = nat->ext_if = NULL;
+    return -1;
+  }
+  printf("NAT internal interface %s, external interface %s\n", int_name, ext_name);
+  return 0;
+}
 
-  return success;
+/* Switch to port-block allocation, block_size ports per internal host.
+   Must be called before the first mapping is created. */
+int sr_nat_set_block_mode(struct sr_nat *nat, unsigned int block_size)
+{
+  unsigned int nports = SR_NAT_PORT_MAX + 1 - SR_NAT_PORT_MIN;
+
+  if(block_size < SR_NAT_SHARDS || block_size % SR_NAT_SHARDS != 0 || block_size > nports)
+  {
+    fprintf(stderr, "NAT block size must be a multiple of %d between %d and %u\n",
+            SR_NAT_SHARDS, SR_NAT_SHARDS, nports);
+    return -1;
+  }
+  nat->block_size = block_size;
+  nat->nblocks = nports / block_size;
+  if(sr_nat_blocks_alloc(nat) != 0)
+  { return -1; }
+  nat->alloc_mode = sr_nat_alloc_block;
+  printf("NAT port-block mode: %u blocks of %u ports\n", nat->nblocks, block_size);
+  return 0;
+}
+
+/* Translate to the n addresses in pool (network byte order) instead of the
+   external interface address. Must be called before the first mapping is
+   created. */
+int sr_nat_set_pool(struct sr_nat *nat, const uint32_t *pool, unsigned int n, sr_nat_pool_mode mode)
+{
+  if(n == 0 || n > SR_NAT_POOL_MAX)
+  {
+    fprintf(stderr, "NAT pool must have between 1 and %d addresses\n", SR_NAT_POOL_MAX);
+    return -1;
+  }
+  memcpy(nat->pool, pool, n * sizeof(uint32_t));
+  nat->pool_size = n;
+  nat->pool_mode = mode;
+  if(nat->alloc_mode == sr_nat_alloc_block)
+  { return sr_nat_blocks_alloc(nat); }
+  return 0;
+}
+
+/* Whether ip (network byte order) is one of the pool addresses. */
+int sr_nat_is_pool_addr(struct sr_nat *nat, uint32_t ip)
+{
+  return nat->pool_size && sr_nat_pool_index(nat, ip) >= 0;
 }
 
 
 int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
 
-  pthread_mutex_lock(&(nat->lock));
+  int i, ret = 0;
+
+  pthread_cancel(nat->thread);
+  pthread_join(nat->thread, NULL);
 
   /* free nat memory here */
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    sr_nat_shard_lock(shard);
+    while(shard->lru_head)
+    {
+      sr_nat_remove(nat, shard, shard->lru_head);
+    }
+    while(shard->emb_head)
+    {
+      sr_nat_remove(nat, shard, shard->emb_head);
+    }
+    free(shard->int_buckets);
+    free(shard->ext_buckets);
+    sr_nat_shard_unlock(shard);
+    ret |= pthread_mutex_destroy(&(shard->lock));
+  }
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    free(nat->hosts[i].buckets);
+    ret |= pthread_mutex_destroy(&(nat->hosts[i].lock));
+  }
+  free(nat->block_owner);
+  ret |= pthread_mutex_destroy(&(nat->block_lock));
+  return ret || pthread_mutexattr_destroy(&(nat->attr));
+}
 
-  pthread_kill(nat->thread, SIGKILL);
-  return pthread_mutex_destroy(&(nat->lock)) &&
-    pthread_mutexattr_destroy(&(nat->attr));
+/* Remove mappings that have timed out as of curtime, one shard at a time.
+   Returns the number removed. */
+unsigned int sr_nat_sweep(struct sr_nat *nat, time_t curtime)
+{
+  unsigned int expired = 0;
+  int i;
 
+  /*Check for unused entry and delete all of them, one shard at a time*/
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    struct sr_nat_mapping *entry, *prev;
+    sr_nat_shard_lock(shard);
+    /* embryonic list is in creation order, stop at the first live one */
+    while((entry = shard->emb_tail) &&
+          difftime(curtime, entry->last_updated) > SR_NAT_EMBRYONIC_TO)
+    {
+      Debug("Embryonic TCP mapping timeout\n");
+      sr_nat_flow_record(nat, sr_flowlog_expire, entry);
+      sr_nat_remove(nat, shard, entry);
+      shard->stats.expired++;
+      expired++;
+    }
+    /* the LRU list is in touch order too: once one mapping is young enough
+       so is every one after it */
+    for(entry = shard->lru_tail; entry; entry = prev)
+    {
+      prev = entry->lru_prev;
+      if(difftime(curtime, entry->last_updated) <= SR_NAT_ICMP_TO)
+      { break; }
+      /*For ICMP*/
+      if(entry->type == nat_mapping_icmp)
+      {
+        Debug("ICMP query timeout\n");
+        /*Delete node in mapping table */
+        sr_nat_flow_record(nat, sr_flowlog_expire, entry);
+        sr_nat_remove(nat, shard, entry);
+        shard->stats.expired++;
+        expired++;
+      }
+    }
+    sr_nat_shard_unlock(shard);
+  }
+  return expired;
 }
 
 void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timout handling */
   struct sr_nat *nat = (struct sr_nat *)nat_ptr;
+  struct sr_nat_stats last;
+  time_t last_report = time(NULL);
+
+  memset(&last, 0, sizeof(last));
   while (1) {
     sleep(1.0);
-    pthread_mutex_lock(&(nat->lock));
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
     time_t curtime = time(NULL);
 
     /* handle periodic tasks here */
-    /*Check for unused entry and delete all of them if happen*/
-    struct sr_nat_mapping *entry = nat->mappings;
-    struct sr_nat_mapping *next = NULL, *prev = NULL;
-    prev = entry;
-    while(entry)
-    {
-      /*For ICMP*/
+    sr_nat_sweep(nat, curtime);
 
-      if( difftime(curtime,entry->last_updated) > 60.0 && entry->type == (sr_nat_mapping_type)nat_mapping_icmp)
-      {
-        printf("ICMP/TCP query timeout");
-        /*Delete node in mapping table */
-        if(entry == nat->mappings)
-        {
-          nat->mappings = entry->next;
-          struct sr_nat_mapping *temp = entry;
-          entry = entry->next;
-          free(temp);
-        }
-        else
-        {
-          prev->next = entry->next;
-          struct sr_nat_mapping *temp = entry;
-          entry = entry->next;
-          free(temp);         
-        }
-      }
-      else
+    /* report refusals/evictions when they change */
+    if(difftime(curtime, last_report) >= SR_NAT_STATS_INTERVAL)
+    {
+      struct sr_nat_stats now;
+      sr_nat_get_stats(nat, &now);
+      if(now.refused_quota != last.refused_quota || now.refused_rate != last.refused_rate ||
+         now.refused_cap != last.refused_cap || now.refused_ports != last.refused_ports ||
+         now.refused_embryonic != last.refused_embryonic || now.evicted != last.evicted)
       {
-        prev = entry;
-        entry = entry->next;
+        sr_nat_print_stats(nat);
       }
+      last = now;
+      last_report = curtime;
     }
 
-
-    pthread_mutex_unlock(&(nat->lock));
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
   }
   return NULL;
 }
 
-/* Get the mapping associated with given external port.
+/* Get the mapping associated with given external address and port.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
-    uint16_t aux_ext, sr_nat_mapping_type type ) {
+    uint32_t ip_ext, uint16_t aux_ext, sr_nat_mapping_type type ) {
+
+  struct sr_nat_shard *shard = sr_nat_shard_of_ext(nat, aux_ext);
 
-  pthread_mutex_lock(&(nat->lock));
+  /* in block mode ports outside any assigned block are rejected without
+     touching the shard */
+  if(nat->alloc_mode == sr_nat_alloc_block && !sr_nat_block_owned(nat, ip_ext, ntohs(aux_ext)))
+  {
+    return NULL;
+  }
+  sr_nat_shard_lock(shard);
 
   /* handle lookup here, malloc and assign to copy */
   struct sr_nat_mapping *copy = NULL;
-  struct sr_nat_mapping *entry = nat->mappings;
   /*Find matching entry in the mapping table*/
-  while(entry)
-  {
-    if( (entry->aux_ext) == aux_ext && (entry->type == type) )
-    {
-      break;
-    }
-    entry = entry->next;
-  }
+  struct sr_nat_mapping *entry = sr_nat_find_ext(shard, ip_ext, aux_ext, type);
   /*Copy and return matching entry*/
   if(entry)
   {
-    copy = (struct sr_nat_mapping *)calloc(sizeof(struct sr_nat_mapping),1);
+    if(entry->state == nat_mapping_embryonic)
+    { sr_nat_promote(shard, entry); }
+    sr_nat_touch(shard, entry);
+    copy = (struct sr_nat_mapping *)malloc(sizeof(struct sr_nat_mapping));
     memcpy(copy,entry,sizeof(struct sr_nat_mapping));
   }
 
-  pthread_mutex_unlock(&(nat->lock));
+  sr_nat_shard_unlock(shard);
   return copy;
 }
 
@@ -126,69 +879,241 @@ struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
 
-  pthread_mutex_lock(&(nat->lock));
+  uint32_t h = sr_nat_hash_int(ip_int, aux_int, type);
+  struct sr_nat_shard *shard = &(nat->shards[h & (SR_NAT_SHARDS - 1)]);
+  sr_nat_shard_lock(shard);
 
   /* handle lookup here, malloc and assign to copy. */
   struct sr_nat_mapping *copy = NULL;
-  struct sr_nat_mapping *entry = nat->mappings;
   /*Find matching entry in the mapping table*/
-  while(entry)
-  {
-    if( (entry->aux_int == aux_int) && (entry->type == type) && (entry->ip_int == ip_int) )
-    {
-      break;
-    }
-    entry = entry->next;
-  }
+  struct sr_nat_mapping *entry = sr_nat_find_int(shard, h, ip_int, aux_int, type);
   if(entry)
   {
-    copy = (struct sr_nat_mapping *)calloc(sizeof(struct sr_nat_mapping),1);
+    sr_nat_touch(shard, entry);
+    copy = (struct sr_nat_mapping *)malloc(sizeof(struct sr_nat_mapping));
     memcpy(copy,entry,sizeof(struct sr_nat_mapping));
   }
 
-  pthread_mutex_unlock(&(nat->lock));
+  sr_nat_shard_unlock(shard);
   return copy;
 }
 
-/* Insert a new mapping into the nat's mapping table.
-   Actually returns a copy to the new mapping, for thread safety.
+/* Insert a new mapping into the nat's mapping table, or use the one the
+   internal key already has: the check is made under the shard lock, so two
+   threads missing on the same flow do not both create one.
+   Actually returns a copy to the mapping, for thread safety.
  */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_instance* sr,struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
-  static int assigned_port = 1024;
-  pthread_mutex_lock(&(nat->lock));
+
+  uint32_t h = sr_nat_hash_int(ip_int, aux_int, type);
+  struct sr_nat_shard *shard = &(nat->shards[h & (SR_NAT_SHARDS - 1)]);
+  sr_nat_shard_lock(shard);
 
   /* handle insert here, create a mapping, and then return a copy of it */
   struct sr_nat_mapping *mapping = NULL;
   struct sr_nat_mapping *new_mapping = NULL;
-  struct sr_nat_mapping *check_map = NULL;
-/*  
-  for(check_map = nat->mappings;check_map != NULL;check_map = check_map->next)
+  uint16_t port = 0;
+  uint16_t block = 0;
+  int pool_idx = -1;
+  uint32_t ip_ext;
+  int embryonic = (nat->limits.embryonic_per_sec && type == nat_mapping_tcp);
+  int ret;
+
+  if((new_mapping = sr_nat_find_int(shard, h, ip_int, aux_int, type)) != NULL)
   {
-    if((check_map->ip_int == ip_int) && (check_map->aux_int == ip_int) && (check_map->type == type))
-    {
-      printf("This mapping already in mapping table\n");
-      return check_map;
-    }
+    sr_nat_touch(shard, new_mapping);
+    mapping = (struct sr_nat_mapping *)malloc(sizeof(struct sr_nat_mapping));
+    memcpy(mapping,new_mapping,sizeof(struct sr_nat_mapping));
+    sr_nat_shard_unlock(shard);
+    return mapping;
   }
-*/
-  printf("1\n");
+
+  /* admission: creation rate, per-host quota and embryonic rate, table-wide
+     cap, free port */
+  if(sr_nat_bucket_take(&(shard->rate_tokens), &(shard->rate_stamp), nat->limits.new_per_sec,
+                        (uint64_t)SR_NAT_SHARDS * 1000000) != 0)
+  {
+    shard->stats.refused_rate++;
+    sr_nat_shard_unlock(shard);
+    return NULL;
+  }
+  ret = sr_nat_host_acquire(nat, ip_int, 1, embryonic, &pool_idx, &block);
+  if(ret != 0)
+  {
+    if(ret == -1)
+    { shard->stats.refused_quota++; }
+    else if(ret == -3)
+    { shard->stats.refused_embryonic++; }
+    else
+    { shard->stats.refused_ports++; }
+    sr_nat_shard_unlock(shard);
+    return NULL;
+  }
+  if(sr_nat_make_room(nat, shard, embryonic) != 0)
+  {
+    sr_nat_host_release(nat, ip_int);
+    shard->stats.refused_cap++;
+    sr_nat_shard_unlock(shard);
+    return NULL;
+  }
+  ip_ext = nat->pool_size ? nat->pool[pool_idx] : nat->ext_if->ip;
+  if(nat->alloc_mode == sr_nat_alloc_block)
+  { port = sr_nat_alloc_block_port(nat, shard, block, ip_ext, type); }
+  else
+  { port = sr_nat_alloc_port(shard, ip_ext, type); }
+  if(port == 0)
+  {
+    sr_nat_host_release(nat, ip_int);
+    shard->stats.refused_ports++;
+    sr_nat_shard_unlock(shard);
+    return NULL;
+  }
+
   new_mapping = calloc(sizeof(struct sr_nat_mapping),1);
   new_mapping->aux_int = aux_int; /*Port of sending packet /internal port*/
   new_mapping->ip_int = ip_int; /*Internal IP to map in mapping table / IP of sending packet*/
   new_mapping->type = type;
-  new_mapping->aux_ext = assigned_port++ ; /*Assigned mapping port for external IP*/
-  new_mapping->ip_ext = sr_get_interface(sr,"eth2")->ip; /*Set ip of external IP*/
+  new_mapping->state = embryonic ? nat_mapping_embryonic : nat_mapping_established;
+  new_mapping->aux_ext = htons(port); /*Assigned mapping port for external IP*/
+  new_mapping->ip_ext = ip_ext; /*Set ip of external IP*/
   new_mapping->last_updated = time(NULL); /*Moi lan handle packet, update last_update*/
-  printf("2\n");
-  new_mapping->next = nat->mappings; /*Add this mapping entry into the head of the linked list*/
-  nat->mappings = new_mapping;
-  printf("3\n");
+  sr_nat_link(shard, new_mapping, h);
+  shard->stats.created++;
+  sr_nat_flow_record(nat, sr_flowlog_create, new_mapping);
 
-  mapping = (struct sr_nat_mapping *)calloc(sizeof(struct sr_nat_mapping),1);
+  mapping = (struct sr_nat_mapping *)malloc(sizeof(struct sr_nat_mapping));
   memcpy(mapping,new_mapping,sizeof(struct sr_nat_mapping)); /*Coppy and return new mapping entry*/
-  printf("4\n");
-  pthread_mutex_unlock(&(nat->lock));
+  sr_nat_shard_unlock(shard);
   return mapping;
 }
 
+/* Call fn on every established mapping, holding one shard lock at a time.
+   Mappings are visited least recently used first. Embryonic mappings are too
+   short-lived to be worth saving and are skipped. fn must not insert or
+   remove mappings. */
+void sr_nat_walk(struct sr_nat *nat, void (*fn)(struct sr_nat_mapping *, void *), void *arg)
+{
+  int i;
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    struct sr_nat_mapping *entry;
+    sr_nat_shard_lock(shard);
+    for(entry = shard->lru_tail; entry; entry = entry->lru_prev)
+    {
+      fn(entry, arg);
+    }
+    sr_nat_shard_unlock(shard);
+  }
+}
+
+/* Re-insert a mapping with its original external port, e.g. from a snapshot.
+   Returns 0 on success, -1 if the port does not belong to the flow's shard or
+   is already taken. Quotas and rate limits do not apply. The address must
+   still be the external interface's, or with a pool be in it and be the one
+   the host already uses, and in block mode the port's block must be free or
+   owned by the same host. */
+int sr_nat_restore_mapping(struct sr_nat *nat, const struct sr_nat_mapping *saved)
+{
+  uint32_t h = sr_nat_hash_int(saved->ip_int, saved->aux_int, saved->type);
+  struct sr_nat_shard *shard = &(nat->shards[h & (SR_NAT_SHARDS - 1)]);
+  struct sr_nat_mapping *new_mapping = NULL;
+  uint16_t block = 0;
+  int pool_idx = sr_nat_pool_index(nat, saved->ip_ext);
+
+  if(shard != sr_nat_shard_of_ext(nat, saved->aux_ext) || pool_idx < 0)
+  {
+    return -1;
+  }
+
+  sr_nat_shard_lock(shard);
+  if(sr_nat_find_ext(shard, saved->ip_ext, saved->aux_ext, saved->type))
+  {
+    sr_nat_shard_unlock(shard);
+    return -1;
+  }
+
+  if(nat->alloc_mode == sr_nat_alloc_block)
+  {
+    uint16_t port = ntohs(saved->aux_ext);
+    if(port < SR_NAT_PORT_MIN)
+    {
+      sr_nat_shard_unlock(shard);
+      return -1;
+    }
+    block = SR_NAT_PORT_MIN + (port - SR_NAT_PORT_MIN) / nat->block_size * nat->block_size;
+  }
+  if(sr_nat_host_acquire(nat, saved->ip_int, 0, 0, &pool_idx, &block) != 0)
+  {
+    sr_nat_shard_unlock(shard);
+    return -1;
+  }
+
+  new_mapping = calloc(sizeof(struct sr_nat_mapping),1);
+  new_mapping->type = saved->type;
+  new_mapping->ip_int = saved->ip_int;
+  new_mapping->ip_ext = saved->ip_ext;
+  new_mapping->aux_int = saved->aux_int;
+  new_mapping->aux_ext = saved->aux_ext;
+  new_mapping->last_updated = saved->last_updated;
+  sr_nat_link(shard, new_mapping, h);
+
+  sr_nat_shard_unlock(shard);
+  return 0;
+}
+
+/* Sum the per-shard counters. */
+void sr_nat_get_stats(struct sr_nat *nat, struct sr_nat_stats *stats)
+{
+  int i;
+  memset(stats, 0, sizeof(*stats));
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    sr_nat_shard_lock(shard);
+    stats->mappings += shard->count;
+    stats->created += shard->stats.created;
+    stats->expired += shard->stats.expired;
+    stats->evicted += shard->stats.evicted;
+    stats->refused_quota += shard->stats.refused_quota;
+    stats->refused_rate += shard->stats.refused_rate;
+    stats->refused_cap += shard->stats.refused_cap;
+    stats->refused_ports += shard->stats.refused_ports;
+    stats->embryonic += shard->emb_count;
+    stats->promoted += shard->stats.promoted;
+    stats->refused_embryonic += shard->stats.refused_embryonic;
+    sr_nat_shard_unlock(shard);
+  }
+}
+
+void sr_nat_print_stats(struct sr_nat *nat)
+{
+  struct sr_nat_stats stats;
+  sr_nat_get_stats(nat, &stats);
+  printf("NAT: %lu mappings (%lu embryonic), %lu created, %lu promoted, %lu expired, "
+         "%lu evicted; refused: %lu quota, %lu rate, %lu embryonic, %lu cap, %lu ports\n",
+         stats.mappings, stats.embryonic, stats.created, stats.promoted, stats.expired,
+         stats.evicted, stats.refused_quota, stats.refused_rate, stats.refused_embryonic,
+         stats.refused_cap, stats.refused_ports);
+}
+
+#ifdef SR_NAT_LOCKSTAT
+/* Shard lock hold times summed over the shards, see sr_nat_shard_lock. */
+void sr_nat_get_lockstat(struct sr_nat *nat, unsigned long *holds, uint64_t *total_ns, uint64_t *max_ns)
+{
+  int i;
+  *holds = 0;
+  *total_ns = *max_ns = 0;
+  for(i = 0; i < SR_NAT_SHARDS; i++)
+  {
+    struct sr_nat_shard *shard = &(nat->shards[i]);
+    pthread_mutex_lock(&(shard->lock));
+    *holds += shard->lock_holds;
+    *total_ns += shard->lock_ns;
+    if(shard->lock_max_ns > *max_ns)
+    { *max_ns = shard->lock_max_ns; }
+    pthread_mutex_unlock(&(shard->lock));
+  }
+}
+#endif
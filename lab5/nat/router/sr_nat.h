@@ -10,12 +10,50 @@
 #include "sr_utils.h"
 #include "sr_arpcache.h"
 #include "sr_rt.h"
+
+/* The mapping table is split into SR_NAT_SHARDS independently locked shards.
+   A mapping lives in the shard picked by the hash of its internal
+   (ip, port, type) key, and its external port is always allocated so that
+   (port % SR_NAT_SHARDS) names that same shard. Lookups from either side can
+   therefore go straight to one shard without any global lock. */
+#define SR_NAT_SHARDS        16    /* must be a power of two */
+#define SR_NAT_BUCKETS       256   /* initial hash buckets per shard, power of two;
+                                      doubled whenever the shard outgrows them */
+#define SR_NAT_PORT_MIN      1024  /* first external port/id handed out */
+#define SR_NAT_PORT_MAX      65535
+#define SR_NAT_ICMP_TO       60.0
+#define SR_NAT_EMBRYONIC_TO  6.0   /* life of a TCP mapping nothing has answered */
+#define SR_NAT_HOST_BUCKETS  1024  /* per-host accounting buckets per stripe */
+#define SR_NAT_EVICT_IDLE    10.0  /* min idle seconds before LRU eviction */
+#define SR_NAT_STATS_INTERVAL 30.0 /* report refusals at most this often */
+#define SR_NAT_POOL_MAX      64    /* external addresses in the pool */
+
 typedef enum {
   nat_mapping_icmp,
   nat_mapping_tcp
   /* nat_mapping_udp, */
 } sr_nat_mapping_type;
 
+typedef enum {
+  sr_nat_alloc_dynamic, /* any free port in the flow's shard */
+  sr_nat_alloc_block    /* ports from a block owned by the internal host */
+} sr_nat_alloc_mode;
+
+typedef enum {
+  sr_nat_pool_paired,     /* host always gets the address its IP hashes to */
+  sr_nat_pool_round_robin /* hosts get addresses in turn as they show up */
+} sr_nat_pool_mode;
+
+/* With limits.embryonic_per_sec set, a new TCP mapping starts out embryonic:
+   it sits on a separate FIFO list, is not refreshed by outbound packets and
+   expires after SR_NAT_EMBRYONIC_TO. The first inbound packet that matches it
+   makes it established. Embryonic mappings are evicted first under the table
+   cap and never push out an established one. */
+typedef enum {
+  nat_mapping_established,
+  nat_mapping_embryonic
+} sr_nat_mapping_state;
+
 struct sr_nat_connection {
   /* add TCP connection state data members here */
 
@@ -24,21 +62,109 @@ struct sr_nat_connection {
 
 struct sr_nat_mapping {
   sr_nat_mapping_type type;
+  sr_nat_mapping_state state;
   uint32_t ip_int; /* internal ip addr */
   uint32_t ip_ext; /* external ip addr */
   uint16_t aux_int; /* internal port or icmp id */
-  uint16_t aux_ext; /* external port or icmp id */
+  uint16_t aux_ext; /* external port or icmp id, network byte order */
   time_t last_updated; /* use to timeout mappings */
   struct sr_nat_connection *conns; /* list of connections. null for ICMP */
-  struct sr_nat_mapping *next;
+  struct sr_nat_mapping *next; /* chain in the internal-key bucket */
+  struct sr_nat_mapping *ext_next; /* chain in the external-key bucket */
+  struct sr_nat_mapping *lru_prev; /* shard LRU (or embryonic) list, head = most recent */
+  struct sr_nat_mapping *lru_next;
+};
+
+/* Admission limits, all 0 (unlimited) after sr_nat_init. The table-wide cap
+   and the creation rate are split evenly across shards. */
+struct sr_nat_limits {
+  unsigned int max_per_host; /* live mappings per internal IP */
+  unsigned int max_mappings; /* live mappings in the whole table */
+  unsigned int new_per_sec;  /* mappings created per second */
+  unsigned int embryonic_per_sec; /* embryonic mappings per second per internal IP,
+                                     non-zero turns embryonic mode on */
+};
+
+struct sr_nat_stats {
+  unsigned long mappings;      /* currently live */
+  unsigned long created;
+  unsigned long expired;       /* removed by the timeout thread */
+  unsigned long evicted;       /* embryonic or idle LRU mappings dropped to make room */
+  unsigned long refused_quota; /* host already at max_per_host */
+  unsigned long refused_rate;  /* over new_per_sec */
+  unsigned long refused_cap;   /* table full and nothing idle to evict */
+  unsigned long refused_ports; /* no free external port in the shard */
+  unsigned long embryonic;     /* currently live and not yet answered */
+  unsigned long promoted;      /* embryonic mappings that saw return traffic */
+  unsigned long refused_embryonic; /* host over embryonic_per_sec */
+};
+
+/* Mappings charged to one internal host. */
+struct sr_nat_host {
+  uint32_t ip_int;
+  unsigned int mappings;
+  int pool_idx;   /* external address used by the host, index in nat->pool */
+  uint16_t block; /* first port of the host's block, 0 if none */
+  uint64_t emb_tokens; /* embryonic token bucket, see sr_nat_bucket_take */
+  uint64_t emb_stamp;
+  struct sr_nat_host *next;
+};
+
+struct sr_nat_host_stripe {
+  struct sr_nat_host **buckets;
+  pthread_mutex_t lock; /* taken after, never before, a shard lock */
+};
+
+struct sr_nat_shard {
+  struct sr_nat_mapping **int_buckets; /* keyed by (ip_int, aux_int, type) */
+  struct sr_nat_mapping **ext_buckets; /* keyed by (ip_ext, aux_ext, type) */
+  unsigned int nbuckets; /* in each of the two, power of two */
+  struct sr_nat_mapping *lru_head;
+  struct sr_nat_mapping *lru_tail;
+  struct sr_nat_mapping *emb_head; /* embryonic mappings, oldest at the tail */
+  struct sr_nat_mapping *emb_tail;
+  unsigned int count; /* mappings held by this shard */
+  unsigned int emb_count; /* of which embryonic */
+  uint16_t next_port; /* allocation cursor, always in this shard's port class */
+  uint64_t rate_tokens; /* new-mapping token bucket, see sr_nat_bucket_take */
+  uint64_t rate_stamp;
+  struct sr_nat_stats stats; /* mappings and embryonic unused, see the counts */
+  pthread_mutex_t lock;
+#ifdef SR_NAT_LOCKSTAT
+  unsigned int lock_depth;
+  uint64_t lock_start;
+  uint64_t lock_ns;
+  uint64_t lock_max_ns;
+  unsigned long lock_holds;
+#endif
 };
 
 struct sr_nat {
   /* add any fields here */
-  struct sr_nat_mapping *mappings;
+  struct sr_nat_shard shards[SR_NAT_SHARDS];
+  struct sr_nat_host_stripe hosts[SR_NAT_SHARDS];
+  struct sr_nat_limits limits;
+
+  /* port-block allocation, see sr_nat_set_block_mode */
+  sr_nat_alloc_mode alloc_mode;
+  unsigned int block_size;
+  unsigned int nblocks;
+  unsigned int next_block;
+  uint32_t *block_owner; /* internal IP owning each block, 0 if free */
+  pthread_mutex_t block_lock; /* taken after a host stripe lock */
+
+  /* external address pool, see sr_nat_set_pool. Empty means the address of
+     the external interface is used. */
+  uint32_t pool[SR_NAT_POOL_MAX];
+  unsigned int pool_size;
+  sr_nat_pool_mode pool_mode;
+  unsigned int pool_next;
+
+  /* interface roles, see sr_nat_set_interfaces */
+  struct sr_if *int_if;
+  struct sr_if *ext_if;
 
   /* threading */
-  pthread_mutex_t lock;
   pthread_mutexattr_t attr;
   pthread_attr_t thread_attr;
   pthread_t thread;
@@ -48,21 +174,59 @@ struct sr_nat {
 int   sr_nat_init(struct sr_nat *nat);     /* Initializes the nat */
 int   sr_nat_destroy(struct sr_nat *nat);  /* Destroys the nat (free memory) */
 void *sr_nat_timeout(void *nat_ptr);  /* Periodic Timout */
+unsigned int sr_nat_sweep(struct sr_nat *nat, time_t curtime); /* one timeout pass */
+
+/* Designate the internal and external interfaces by name. Packets are
+   classified by the interface they arrive on. Call once the interface list
+   is known. 0 on success. */
+int   sr_nat_set_interfaces(struct sr_nat *nat, struct sr_instance *sr,
+  const char *int_name, const char *ext_name);
 
-/* Get the mapping associated with given external port.
+/* Give each internal host a block of block_size external ports on first use
+   instead of allocating ports per flow. block_size must be a multiple of
+   SR_NAT_SHARDS. Call right after sr_nat_init. */
+int   sr_nat_set_block_mode(struct sr_nat *nat, unsigned int block_size);
+
+/* Translate to a pool of n external addresses (network byte order), each
+   internal host sticking to one of them. Call right after sr_nat_init. */
+int   sr_nat_set_pool(struct sr_nat *nat, const uint32_t *pool, unsigned int n,
+  sr_nat_pool_mode mode);
+int   sr_nat_is_pool_addr(struct sr_nat *nat, uint32_t ip);
+
+/* Get the mapping associated with given external (ip, port) pair. An
+   embryonic mapping found here becomes established.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
-    uint16_t aux_ext, sr_nat_mapping_type type );
+    uint32_t ip_ext, uint16_t aux_ext, sr_nat_mapping_type type );
 
 /* Get the mapping associated with given internal (ip, port) pair.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
-/* Insert a new mapping into the nat's mapping table.
-   You must free the returned structure if it is not NULL. */
+/* Get the mapping of the given internal (ip, port) pair, inserting a new
+   one into the nat's mapping table if it has none.
+   You must free the returned structure if it is not NULL. Returns NULL if
+   a new mapping is refused by the limits or no external port is left. */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_instance* sr,struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
+/* Call fn on every established mapping in the table, one shard lock held at
+   a time. */
+void sr_nat_walk(struct sr_nat *nat,
+  void (*fn)(struct sr_nat_mapping *, void *), void *arg);
+
+/* Re-insert a saved mapping keeping its external port. 0 on success. */
+int sr_nat_restore_mapping(struct sr_nat *nat, const struct sr_nat_mapping *saved);
+
+/* Table-wide counters, summed over the shards. */
+void sr_nat_get_stats(struct sr_nat *nat, struct sr_nat_stats *stats);
+void sr_nat_print_stats(struct sr_nat *nat);
+
+#ifdef SR_NAT_LOCKSTAT
+void sr_nat_get_lockstat(struct sr_nat *nat, unsigned long *holds, uint64_t *total_ns,
+  uint64_t *max_ns);
+#endif
+
 
 #endif
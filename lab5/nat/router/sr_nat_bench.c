@@ -0,0 +1,332 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nat_bench.c
+ *
+ * Description:
+ *
+ * NAT benchmark. Drives the sr_nat API and the NAT section of
+ * sr_handlepacket (with sr_send_packet stubbed out) with synthetic flows and
+ * reports, for each table size:
+ *
+ *   - insert, internal lookup and external lookup cost in ns/op
+ *   - outbound and inbound sr_handlepacket cost in ns/packet
+ *   - mixed lookup/insert cost at several new-flow rates
+ *   - cost of a timeout sweep that expires every ICMP mapping
+ *   - heap bytes per mapping
+ *   - shard lock hold times, when built with -DSR_NAT_LOCKSTAT
+ *
+ *   make sr_nat_bench [BENCH_DEFS=-DSR_NAT_LOCKSTAT]
+ *   ./sr_nat_bench [-n size,size,...] [-i icmp percent] [-k ops]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <malloc.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_rt.h"
+#include "sr_nat.h"
+
+#define BENCH_DEFAULT_SIZES "1000,10000,100000,1000000"
+#define BENCH_PER_ADDR      30000  /* mappings per pool address, below 64k */
+#define BENCH_PKT_LEN       (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_tcp_hdr_t))
+
+int is_nat_enable = 1;
+static unsigned long bench_sent;
+
+/* sr_handlepacket ends here instead of on the wire */
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+  bench_sent++;
+  return 0;
+}
+
+static struct sr_instance sr;
+static struct sr_nat nat;
+static int icmp_pct = 50;
+static unsigned int nops = 200000;
+
+/* external side of every inserted flow, for inbound lookups */
+static uint32_t *ext_ip;
+static uint16_t *ext_port;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+static uint32_t rnd_state = 12345;
+static uint32_t rnd(void)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return rnd_state >> 8;
+}
+
+/* Flow i: up to 1024 ports on each of 4M internal hosts in 10.128/9. */
+static void flow(unsigned int i, uint32_t *ip, uint16_t *aux, sr_nat_mapping_type *type)
+{
+  *ip = htonl(0x0a800000 | (i >> 10));
+  *aux = htons(1024 + (i & 1023));
+  *type = ((i * 2654435761u) % 100 < (unsigned int)icmp_pct) ? nat_mapping_icmp : nat_mapping_tcp;
+}
+
+static void setup_router(void)
+{
+  struct in_addr dest, gw, mask;
+  unsigned char mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x99 };
+  unsigned char if_mac[ETHER_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+
+  sr_add_interface(&sr, "eth1");
+  sr_set_ether_addr(&sr, if_mac);
+  sr_set_ether_ip(&sr, inet_addr("10.0.1.1"));
+  if_mac[5] = 0x02;
+  sr_add_interface(&sr, "eth2");
+  sr_set_ether_addr(&sr, if_mac);
+  sr_set_ether_ip(&sr, inet_addr("172.64.3.1"));
+
+  dest.s_addr = 0; gw.s_addr = inet_addr("172.64.3.2"); mask.s_addr = 0;
+  sr_add_rt_entry(&sr, dest, gw, mask, "eth2");
+  dest.s_addr = inet_addr("10.0.0.0"); gw.s_addr = inet_addr("10.0.1.2"); mask.s_addr = inet_addr("255.0.0.0");
+  sr_add_rt_entry(&sr, dest, gw, mask, "eth1");
+
+  sr_init(&sr);
+  sr_arpcache_insert(&(sr.cache), mac, inet_addr("172.64.3.2"));
+  sr_arpcache_insert(&(sr.cache), mac, inet_addr("10.0.1.2"));
+}
+
+/* Build a TCP segment or ICMP echo for the given addresses. */
+static void build_packet(uint8_t *pkt, sr_nat_mapping_type type, uint32_t src, uint16_t sport,
+  uint32_t dst, uint16_t dport)
+{
+  sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)pkt;
+  sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(pkt + sizeof(sr_ethernet_hdr_t));
+  uint8_t *l4 = pkt + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+
+  memset(pkt, 0, BENCH_PKT_LEN);
+  eth->ether_type = htons(ethertype_ip);
+  ip->ip_v = 4;
+  ip->ip_hl = 5;
+  ip->ip_len = htons(BENCH_PKT_LEN - sizeof(sr_ethernet_hdr_t));
+  ip->ip_ttl = 64;
+  ip->ip_src = src;
+  ip->ip_dst = dst;
+  if(type == nat_mapping_icmp)
+  {
+    sr_icmp_hdr_t *icmp = (sr_icmp_hdr_t *)l4;
+    uint16_t *id = (uint16_t *)(l4 + sizeof(sr_icmp_hdr_t));
+    ip->ip_p = ip_protocol_icmp;
+    icmp->icmp_type = (dport == 0) ? 8 : 0;
+    id[0] = sport ? sport : dport;
+    icmp->icmp_sum = cksum(icmp, BENCH_PKT_LEN - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
+  }
+  else
+  {
+    sr_tcp_hdr_t *tcp = (sr_tcp_hdr_t *)l4;
+    ip->ip_p = ip_protocol_tcp;
+    tcp->tcp_sport = sport;
+    tcp->tcp_dport = dport;
+    tcp->tcp_off = 5 << 4;
+    tcp->tcp_flags = TCP_FLAG_ACK;
+    tcp->tcp_win = htons(65535);
+  }
+  ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+}
+
+static void report(const char *what, uint64_t ns, unsigned long ops)
+{
+  printf("  %-28s %10.1f ns/op  (%lu ops)\n", what, ops ? (double)ns / ops : 0.0, ops);
+}
+
+static void bench_size(unsigned int n)
+{
+  uint32_t pool[SR_NAT_POOL_MAX];
+  unsigned int i, npool = n / BENCH_PER_ADDR + 1, failed = 0, next_flow = n;
+  unsigned int rates[] = { 0, 1, 10, 50 };
+  uint8_t pkt[BENCH_PKT_LEN];
+  size_t heap0;
+  uint64_t t;
+  unsigned int r;
+
+  if(npool > SR_NAT_POOL_MAX)
+  { npool = SR_NAT_POOL_MAX; }
+  for(i = 0; i < npool; i++)
+  { pool[i] = htonl(0xac400364 + i); } /* 172.64.3.100 and up */
+
+  memset(&nat, 0, sizeof(nat));
+  sr_nat_init(&nat);
+  sr_nat_set_interfaces(&nat, &sr, "eth1", "eth2");
+  sr_nat_set_pool(&nat, pool, npool, sr_nat_pool_paired);
+  ext_ip = realloc(ext_ip, n * sizeof(uint32_t));
+  ext_port = realloc(ext_port, n * sizeof(uint16_t));
+  heap0 = heap_used(); /* fixed tables excluded */
+
+  printf("%u mappings, %d%% ICMP, %u external addresses\n", n, icmp_pct, npool);
+
+  /* -- insert -- */
+  t = now_ns();
+  for(i = 0; i < n; i++)
+  {
+    uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+    struct sr_nat_mapping *m;
+    flow(i, &ip, &aux, &type);
+    m = sr_nat_insert_mapping(&sr, &nat, ip, aux, type);
+    if(m)
+    {
+      ext_ip[i] = m->ip_ext;
+      ext_port[i] = m->aux_ext;
+      free(m);
+    }
+    else
+    {
+      ext_ip[i] = 0;
+      failed++;
+    }
+  }
+  report("insert", now_ns() - t, n);
+  if(failed)
+  { printf("  (%u inserts refused)\n", failed); }
+  if(heap0)
+  { printf("  %-28s %10.1f bytes\n", "heap per mapping", (double)(heap_used() - heap0) / n); }
+
+  /* -- lookups -- */
+  t = now_ns();
+  for(i = 0; i < nops; i++)
+  {
+    uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+    flow(rnd() % n, &ip, &aux, &type);
+    free(sr_nat_lookup_internal(&nat, ip, aux, type));
+  }
+  report("lookup internal", now_ns() - t, nops);
+
+  t = now_ns();
+  for(i = 0; i < nops; i++)
+  {
+    uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+    unsigned int f = rnd() % n;
+    flow(f, &ip, &aux, &type);
+    free(sr_nat_lookup_external(&nat, ext_ip[f], ext_port[f], type));
+  }
+  report("lookup external", now_ns() - t, nops);
+
+  /* -- full packet path, translation plus forwarding -- */
+  bench_sent = 0;
+  t = now_ns();
+  for(i = 0; i < nops; i++)
+  {
+    uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+    flow(rnd() % n, &ip, &aux, &type);
+    build_packet(pkt, type, ip, aux, inet_addr("184.72.104.217"), type == nat_mapping_icmp ? 0 : htons(80));
+    sr_handlepacket(&sr, &nat, pkt, BENCH_PKT_LEN, nat.int_if);
+  }
+  report("handlepacket outbound", now_ns() - t, nops);
+
+  t = now_ns();
+  for(i = 0; i < nops; i++)
+  {
+    uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+    unsigned int f = rnd() % n;
+    flow(f, &ip, &aux, &type);
+    build_packet(pkt, type, inet_addr("184.72.104.217"), type == nat_mapping_icmp ? 0 : htons(80),
+                 ext_ip[f], ext_port[f]);
+    sr_handlepacket(&sr, &nat, pkt, BENCH_PKT_LEN, nat.ext_if);
+  }
+  report("handlepacket inbound", now_ns() - t, nops);
+  if(bench_sent != 2 * nops)
+  { printf("  (%lu of %u packets forwarded)\n", bench_sent, 2 * nops); }
+
+  /* -- churn: r% of operations are new flows, the rest lookups -- */
+  for(r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+  {
+    char what[64];
+    t = now_ns();
+    for(i = 0; i < nops; i++)
+    {
+      uint32_t ip; uint16_t aux; sr_nat_mapping_type type;
+      if(rnd() % 100 < rates[r])
+      {
+        flow(next_flow++, &ip, &aux, &type);
+        free(sr_nat_insert_mapping(&sr, &nat, ip, aux, type));
+      }
+      else
+      {
+        flow(rnd() % n, &ip, &aux, &type);
+        free(sr_nat_lookup_internal(&nat, ip, aux, type));
+      }
+    }
+    snprintf(what, sizeof(what), "churn, %u%% new flows", rates[r]);
+    report(what, now_ns() - t, nops);
+  }
+
+  /* -- expiry: one sweep as if every mapping had gone idle -- */
+  {
+    unsigned int expired;
+    t = now_ns();
+    expired = sr_nat_sweep(&nat, time(NULL) + (time_t)SR_NAT_ICMP_TO + 1);
+    t = now_ns() - t;
+    printf("  %-28s %10.1f ms total, %u expired, %.1f ns/expired\n", "timeout sweep",
+           t / 1e6, expired, expired ? (double)t / expired : 0.0);
+  }
+
+#ifdef SR_NAT_LOCKSTAT
+  {
+    unsigned long holds;
+    uint64_t total_ns, max_ns;
+    sr_nat_get_lockstat(&nat, &holds, &total_ns, &max_ns);
+    printf("  %-28s %10.1f ns mean, %.1f us max (%lu holds)\n", "shard lock hold",
+           holds ? (double)total_ns / holds : 0.0, max_ns / 1e3, holds);
+  }
+#endif
+
+  sr_nat_destroy(&nat);
+}
+
+int main(int argc, char **argv)
+{
+  char sizes[256] = BENCH_DEFAULT_SIZES;
+  char *size;
+  int c;
+
+  while((c = getopt(argc, argv, "n:i:k:h")) != EOF)
+  {
+    switch(c)
+    {
+      case 'n':
+        strncpy(sizes, optarg, sizeof(sizes) - 1);
+        break;
+      case 'i':
+        icmp_pct = atoi(optarg);
+        break;
+      case 'k':
+        nops = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n size,size,...] [-i icmp percent] [-k ops]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  setup_router();
+  for(size = strtok(sizes, ","); size; size = strtok(NULL, ","))
+  {
+    if(atoi(size) > 0)
+    { bench_size(atoi(size)); }
+  }
+  return 0;
+}
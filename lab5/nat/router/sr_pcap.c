@@ -0,0 +1,538 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcap.c
+ *
+ * Description:
+ *
+ * pcap file replay backend, for reproducing a capture deterministically:
+ *
+ *   -b pcap:file[,iface][,timed][,out=file]    (sr -R file[,...] -W file)
+ *
+ * feeds the Ethernet frames in file, pcap or pcapng, to the router. Each
+ * frame is received on, in order of preference:
+ *
+ *   - iface, if one is named
+ *   - the router interface with the name of its pcapng interface
+ *   - the router interface whose MAC address it is sent to
+ *   - the first configured interface
+ *
+ * so a pcapng capture with named interfaces (such as one written by out=)
+ * replays exactly, and a plain pcap one does for all but broadcasts.
+ * Frames are handed over as fast as the router takes them, or with timed
+ * at the pace they were captured at. Input ends at the end of the file.
+ *
+ * Frames the router sends are counted, and with out= written to a pcapng
+ * file that names their interface. They are stamped with the capture time
+ * of the last frame received, not the clock, so that replaying the same
+ * input gives the same output.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_bufpool.h"
+#include "sr_backend.h"
+
+#define SR_PCAP_MAGIC_SWAPPED      0xd4c3b2a1
+#define SR_PCAP_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+#define SR_PCAP_IFACES  64          /* pcapng interfaces per section */
+#define SR_PCAP_BLOCK   (64 * 1024) /* largest pcapng block read */
+
+struct sr_pcap_ngif {
+  struct sr_if *iface;  /* router interface of the same name, if any */
+  uint64_t res;         /* timestamp units per second */
+  int ether;
+};
+
+struct sr_pcap {
+  FILE *fp;
+  int ng;               /* pcapng rather than pcap */
+  int swapped;          /* file (section) written with the other byte order */
+  uint64_t res;         /* pcap: timestamp fraction units per second */
+  struct sr_pcap_ngif ngif[SR_PCAP_IFACES];
+  int nngif;
+  uint8_t *block;       /* pcapng block being read */
+
+  struct sr_if *iface;  /* fixed ingress interface, or NULL */
+  int timed;
+  uint64_t first_cap;   /* capture and clock time of the first frame, ns */
+  uint64_t first_clock;
+  uint64_t ts;          /* capture time of the last frame handed over */
+
+  uint8_t *pending;     /* read, but not due yet */
+  unsigned int pending_len;
+  struct sr_if *pending_if;
+  uint64_t pending_ts;
+
+  FILE *out;
+
+  uint8_t *last[SR_BACKEND_BATCH]; /* handed out by the last recv_batch */
+  int nlast;
+  unsigned long rx, tx, skipped;
+};
+
+static uint32_t sr_pcap_u32(const struct sr_pcap *p, uint32_t v)
+{
+  if(!p->swapped)
+  { return v; }
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static uint16_t sr_pcap_u16(const struct sr_pcap *p, uint16_t v)
+{
+  return p->swapped ? (uint16_t)((v >> 8) | (v << 8)) : v;
+}
+
+/* field at off in a pcapng block body */
+static uint32_t sr_pcap_get32(const struct sr_pcap *p, const uint8_t *b, size_t off)
+{
+  uint32_t v;
+  memcpy(&v, b + off, sizeof(v));
+  return sr_pcap_u32(p, v);
+}
+
+static uint64_t sr_pcap_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t sr_pcap_to_ns(uint64_t t, uint64_t res)
+{
+  return (t / res) * 1000000000 + (t % res) * 1000000000 / res;
+}
+
+static void sr_pcap_free(struct sr_pcap *p)
+{
+  if(p->fp)
+  { fclose(p->fp); }
+  if(p->out)
+  { sr_dump_close(p->out); }
+  free(p->block);
+  free(p);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_ng_idb(..)
+ * Scope:  Local
+ *
+ * An interface description: its link type, name and timestamp units.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_pcap_ng_idb(struct sr_instance *sr, struct sr_pcap *p, const uint8_t *b,
+  uint32_t len)
+{
+  struct sr_pcap_ngif *ni;
+  uint32_t off = 8;
+
+  if(p->nngif == SR_PCAP_IFACES || len < 8)
+  { return; }
+  ni = &(p->ngif[p->nngif++]);
+  ni->iface = NULL;
+  ni->res = 1000000;
+  ni->ether = (sr_pcap_u16(p, *(const uint16_t *)b) == LINKTYPE_ETHERNET);
+
+  while(off + 4 <= len)
+  {
+    uint16_t code = sr_pcap_u16(p, *(const uint16_t *)(b + off));
+    uint16_t olen = sr_pcap_u16(p, *(const uint16_t *)(b + off + 2));
+    const uint8_t *val = b + off + 4;
+
+    if(code == PCAPNG_OPT_END || off + 4 + olen > len)
+    { break; }
+    if(code == PCAPNG_OPT_IF_NAME && olen < sr_IFACE_NAMELEN)
+    {
+      char name[sr_IFACE_NAMELEN];
+      memcpy(name, val, olen);
+      name[olen] = '\0';
+      ni->iface = sr_get_interface(sr, name);
+    }
+    else if(code == PCAPNG_OPT_IF_TSRESOL && olen >= 1)
+    {
+      /* 10^-n seconds, or 2^-n with the top bit set */
+      unsigned int n = val[0] & 0x7f;
+      if(val[0] & 0x80)
+      { ni->res = (n < 64) ? (uint64_t)1 << n : 1; }
+      else
+      {
+        ni->res = 1;
+        while(n-- > 0 && ni->res < 1000000000000000000ULL)
+        { ni->res *= 10; }
+      }
+    }
+    off += 4 + ((olen + 3) & ~3);
+  }
+} /* -- sr_pcap_ng_idb -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_read_ng(..)
+ * Scope:  Local
+ *
+ * Read pcapng blocks up to the next packet and copy it to buf. Returns 1
+ * for a frame, 0 for one that was skipped, or -1 at the end of the file.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pcap_read_ng(struct sr_instance *sr, struct sr_pcap *p, uint8_t *buf,
+  unsigned int *len, struct sr_if **iface, uint64_t *ts)
+{
+  uint32_t type, blen, body, ifid, caplen;
+  const uint8_t *data;
+
+  for(;;)
+  {
+    if(fread(&type, sizeof(type), 1, p->fp) != 1 || fread(&blen, sizeof(blen), 1, p->fp) != 1)
+    { return -1; }
+    if(type == PCAPNG_SHB)
+    {
+      /* a new section: its own byte order and interfaces */
+      uint32_t magic;
+      if(fread(&magic, sizeof(magic), 1, p->fp) != 1)
+      { return -1; }
+      p->swapped = (magic != PCAPNG_BYTE_ORDER_MAGIC);
+      p->nngif = 0;
+      blen = sr_pcap_u32(p, blen);
+      if(blen < 16 || fseek(p->fp, blen - 12, SEEK_CUR) != 0)
+      { return -1; }
+      continue;
+    }
+    type = sr_pcap_u32(p, type);
+    blen = sr_pcap_u32(p, blen);
+    if(blen < 12)
+    { return -1; }
+    body = blen - 12;
+    if(body > SR_PCAP_BLOCK ||
+       (type != PCAPNG_IDB && type != PCAPNG_EPB && type != PCAPNG_SPB))
+    {
+      if(fseek(p->fp, body + 4, SEEK_CUR) != 0)
+      { return -1; }
+      if(type == PCAPNG_EPB || type == PCAPNG_SPB)
+      { return 0; }
+      continue;
+    }
+    if(fread(p->block, 1, body + 4, p->fp) != body + 4)
+    { return -1; }
+
+    if(type == PCAPNG_IDB)
+    {
+      sr_pcap_ng_idb(sr, p, p->block, body);
+      continue;
+    }
+    if(type == PCAPNG_EPB)
+    {
+      if(body < 20)
+      { return 0; }
+      ifid = sr_pcap_get32(p, p->block, 0);
+      caplen = sr_pcap_get32(p, p->block, 12);
+      data = p->block + 20;
+      if(ifid >= (uint32_t)p->nngif || caplen > body - 20)
+      { return 0; }
+      *ts = sr_pcap_to_ns(((uint64_t)sr_pcap_get32(p, p->block, 4) << 32) |
+                          sr_pcap_get32(p, p->block, 8), p->ngif[ifid].res);
+    }
+    else
+    {
+      /* simple packet block: interface 0, no timestamp */
+      if(body < 4)
+      { return 0; }
+      ifid = 0;
+      caplen = sr_pcap_get32(p, p->block, 0);
+      if(caplen > body - 4)
+      { caplen = body - 4; }
+      data = p->block + 4;
+      *ts = p->ts;
+      if(p->nngif == 0)
+      { return 0; }
+    }
+    if(!p->ngif[ifid].ether || caplen > SR_BUFPOOL_SLOT)
+    { return 0; }
+    memcpy(buf, data, caplen);
+    *len = caplen;
+    *iface = p->ngif[ifid].iface;
+    return 1;
+  }
+} /* -- sr_pcap_read_ng -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pcap_read(..)
+ * Scope:  Local
+ *
+ * The next frame and its interface, with the same returns as
+ * sr_pcap_read_ng.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_pcap_read(struct sr_instance *sr, struct sr_pcap *p, uint8_t *buf,
+  unsigned int *len, struct sr_if **iface, uint64_t *ts)
+{
+  struct pcap_sf_pkthdr h;
+  struct sr_ethernet_hdr *e_hdr;
+  struct sr_if *ifp;
+  uint32_t caplen;
+  int ret;
+
+  if(p->ng)
+  { ret = sr_pcap_read_ng(sr, p, buf, len, iface, ts); }
+  else
+  {
+    if(fread(&h, sizeof(h), 1, p->fp) != 1)
+    { return -1; }
+    caplen = sr_pcap_u32(p, h.caplen);
+    if(caplen > SR_BUFPOOL_SLOT)
+    {
+      /* a capture from a link with a larger MTU, not something VNS sends */
+      return (fseek(p->fp, caplen, SEEK_CUR) == 0) ? 0 : -1;
+    }
+    if(fread(buf, 1, caplen, p->fp) != caplen)
+    { return -1; }
+    *len = caplen;
+    *iface = NULL;
+    *ts = (uint64_t)sr_pcap_u32(p, h.ts.tv_sec) * 1000000000 +
+          sr_pcap_to_ns(sr_pcap_u32(p, h.ts.tv_usec), p->res);
+    ret = 1;
+  }
+  if(ret != 1)
+  { return ret; }
+
+  if(p->iface)
+  { *iface = p->iface; }
+  if(!*iface && *len >= sizeof(struct sr_ethernet_hdr))
+  {
+    e_hdr = (struct sr_ethernet_hdr *)buf;
+    for(ifp = sr->if_list; ifp; ifp = ifp->next)
+    {
+      if(memcmp(e_hdr->ether_dhost, ifp->addr, ETHER_ADDR_LEN) == 0)
+      {
+        *iface = ifp;
+        break;
+      }
+    }
+  }
+  if(!*iface)
+  { *iface = sr->if_list; }
+  return 1;
+} /* -- sr_pcap_read -- */
+
+static int sr_pcap_open(struct sr_instance *sr, const char *arg)
+{
+  struct pcap_file_header hdr;
+  struct sr_pcap *p;
+  struct sr_if *ifp;
+  const char *names[SR_PCAP_IFACES];
+  char file[256], opt[256];
+  const char *comma = strchr(arg, ',');
+  size_t n = comma ? (size_t)(comma - arg) : strlen(arg);
+  int nif = 0;
+
+  if(n == 0 || n >= sizeof(file))
+  {
+    fprintf(stderr, "pcap backend: expected -b pcap:file[,iface][,timed][,out=file]\n");
+    return -1;
+  }
+  memcpy(file, arg, n);
+  file[n] = '\0';
+
+  if((p = calloc(1, sizeof(struct sr_pcap))) == NULL)
+  { return -1; }
+  while(comma)
+  {
+    const char *next = strchr(comma + 1, ',');
+    n = next ? (size_t)(next - comma - 1) : strlen(comma + 1);
+    if(n >= sizeof(opt))
+    { n = sizeof(opt) - 1; }
+    memcpy(opt, comma + 1, n);
+    opt[n] = '\0';
+    comma = next;
+
+    if(strcmp(opt, "timed") == 0)
+    { p->timed = 1; }
+    else if(strncmp(opt, "out=", 4) == 0)
+    {
+      for(ifp = sr->if_list; ifp && nif < SR_PCAP_IFACES; ifp = ifp->next)
+      { names[nif++] = ifp->name; }
+      if(p->out)
+      { sr_dump_close(p->out); }
+      if((p->out = sr_dump_ng_open(opt + 4, names, nif, SR_BUFPOOL_SLOT)) == NULL)
+      {
+        sr_pcap_free(p);
+        return -1;
+      }
+    }
+    else if((p->iface = sr_get_interface(sr, opt)) == NULL)
+    {
+      fprintf(stderr, "pcap backend: no interface %s\n", opt);
+      sr_pcap_free(p);
+      return -1;
+    }
+  }
+  if(!sr->if_list)
+  {
+    fprintf(stderr, "pcap backend: no interface configured\n");
+    sr_pcap_free(p);
+    return -1;
+  }
+  if((p->fp = fopen(file, "rb")) == NULL)
+  {
+    perror(file);
+    sr_pcap_free(p);
+    return -1;
+  }
+  if(fread(&hdr.magic, sizeof(hdr.magic), 1, p->fp) == 1 && hdr.magic == PCAPNG_SHB)
+  {
+    /* the section header is read again with the blocks */
+    p->ng = 1;
+    rewind(p->fp);
+    if((p->block = malloc(SR_PCAP_BLOCK + 4)) == NULL)
+    {
+      sr_pcap_free(p);
+      return -1;
+    }
+  }
+  else if(fread((uint8_t *)&hdr + sizeof(hdr.magic), sizeof(hdr) - sizeof(hdr.magic), 1,
+                p->fp) != 1 ||
+          (hdr.magic != TCPDUMP_MAGIC && hdr.magic != SR_PCAP_MAGIC_SWAPPED &&
+           hdr.magic != TCPDUMP_MAGIC_NSEC && hdr.magic != SR_PCAP_MAGIC_NSEC_SWAPPED))
+  {
+    fprintf(stderr, "pcap backend: %s is not a pcap file\n", file);
+    sr_pcap_free(p);
+    return -1;
+  }
+  else
+  {
+    p->swapped = (hdr.magic == SR_PCAP_MAGIC_SWAPPED || hdr.magic == SR_PCAP_MAGIC_NSEC_SWAPPED);
+    p->res = (hdr.magic == TCPDUMP_MAGIC || hdr.magic == SR_PCAP_MAGIC_SWAPPED) ?
+             1000000 : 1000000000;
+    if(sr_pcap_u32(p, hdr.linktype) != LINKTYPE_ETHERNET)
+    {
+      fprintf(stderr, "pcap backend: %s is not an Ethernet capture\n", file);
+      sr_pcap_free(p);
+      return -1;
+    }
+  }
+  sr->backend_state = p;
+  return 0;
+}
+
+/* Hold off until a frame captured at ts is due, or say it is not. */
+static int sr_pcap_due(struct sr_pcap *p, uint64_t ts, int wait)
+{
+  uint64_t due, now;
+  struct timespec t;
+
+  if(!p->timed)
+  { return 1; }
+  now = sr_pcap_clock();
+  if(p->rx == 0)
+  {
+    p->first_cap = ts;
+    p->first_clock = now;
+  }
+  due = p->first_clock + ((ts > p->first_cap) ? ts - p->first_cap : 0);
+  if(due <= now)
+  { return 1; }
+  if(!wait)
+  { return 0; }
+  t.tv_sec = due / 1000000000;
+  t.tv_nsec = due % 1000000000;
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+  ;
+  return 1;
+}
+
+static int sr_pcap_recv_batch(struct sr_instance *sr, struct sr_frame *frames, int max)
+{
+  struct sr_pcap *p = sr->backend_state;
+  int i, n = 0;
+
+  /* the previous batch has been handled */
+  for(i = 0; i < p->nlast; i++)
+  { sr_buf_free(p->last[i]); }
+  p->nlast = 0;
+
+  if(max > SR_BACKEND_BATCH)
+  { max = SR_BACKEND_BATCH; }
+  while(n < max)
+  {
+    uint8_t *buf = p->pending;
+    unsigned int len = p->pending_len;
+    struct sr_if *iface = p->pending_if;
+    uint64_t ts = p->pending_ts;
+    int ret;
+
+    if(!buf)
+    {
+      if((buf = sr_buf_alloc()) == NULL && (buf = malloc(SR_BUFPOOL_SLOT)) == NULL)
+      { break; }
+      while((ret = sr_pcap_read(sr, p, buf, &len, &iface, &ts)) == 0)
+      { p->skipped++; }
+      if(ret < 0)
+      {
+        sr_buf_free(buf);
+        break;
+      }
+    }
+    p->pending = NULL;
+
+    /* a batch only holds frames that are due, the first one waits */
+    if(!sr_pcap_due(p, ts, n == 0))
+    {
+      p->pending = buf;
+      p->pending_len = len;
+      p->pending_if = iface;
+      p->pending_ts = ts;
+      break;
+    }
+    frames[n].buf = buf;
+    frames[n].len = len;
+    frames[n].iface = iface;
+    p->last[n++] = buf;
+    p->ts = ts;
+    p->rx++;
+  }
+  p->nlast = n;
+  return (n > 0) ? n : -1;
+}
+
+static int sr_pcap_send_batch(struct sr_instance *sr, const struct sr_frame *frames, int n)
+{
+  struct sr_pcap *p = sr->backend_state;
+  int i;
+
+  /* called with the transmit queue locked, so one at a time */
+  if(p->out)
+  {
+    for(i = 0; i < n; i++)
+    {
+      sr_dump_ng(p->out, frames[i].iface->index, p->ts, frames[i].buf, frames[i].len,
+                 frames[i].len);
+    }
+  }
+  p->tx += n;
+  return 0;
+}
+
+static void sr_pcap_close(struct sr_instance *sr)
+{
+  struct sr_pcap *p = sr->backend_state;
+  int i;
+
+  for(i = 0; i < p->nlast; i++)
+  { sr_buf_free(p->last[i]); }
+  if(p->pending)
+  { sr_buf_free(p->pending); }
+  fprintf(stderr, "pcap backend: %lu frames replayed, %lu skipped, %lu sent\n",
+          p->rx, p->skipped, p->tx);
+  sr_pcap_free(p);
+  sr->backend_state = NULL;
+}
+
+const struct sr_backend sr_pcap_backend = {
+  "pcap", 1, sr_pcap_open, sr_pcap_recv_batch, sr_pcap_send_batch, sr_pcap_close
+};
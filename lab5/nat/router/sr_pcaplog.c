@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcaplog.c
+ *
+ * Description:
+ *
+ * Asynchronous pcap packet log, see sr_pcaplog.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "sr_dumper.h"
+#include "sr_logring.h"
+#include "sr_pcaplog.h"
+
+static struct sr_logring pcaplog = {
+  "packet log", SR_PCAPLOG_RING, SR_PCAPLOG_KEEP, SR_PCAPLOG_IDLE_US, 0, 0
+};
+static unsigned int pcaplog_snaplen = SR_PCAPLOG_SNAPLEN;
+
+void sr_pcaplog_packet(const uint8_t *buf, unsigned int len)
+{
+  struct pcap_sf_pkthdr h;
+  struct timeval now;
+  struct iovec iov[2];
+
+  if(!sr_logring_running(&pcaplog))
+  { return; }
+  gettimeofday(&now, NULL);
+  h.ts.tv_sec = now.tv_sec;
+  h.ts.tv_usec = now.tv_usec;
+  h.caplen = (len < pcaplog_snaplen) ? len : pcaplog_snaplen;
+  h.len = len;
+  iov[0].iov_base = &h;
+  iov[0].iov_len = sizeof(h);
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len = h.caplen;
+  sr_logring_put(&pcaplog, iov, 2);
+}
+
+unsigned long sr_pcaplog_dropped(void)
+{ return sr_logring_dropped(&pcaplog); }
+
+int sr_pcaplog_open(const char *spec)
+{
+  struct pcap_file_header hdr;
+  char path[1024];
+  const char *comma = strchr(spec, ',');
+  size_t n = comma ? (size_t)(comma - spec) : strlen(spec);
+
+  if(n == 0 || n >= sizeof(path))
+  {
+    fprintf(stderr, "packet log: expected file[,snap=bytes][,size=MB][,secs=N]\n");
+    return -1;
+  }
+  memcpy(path, spec, n);
+  path[n] = '\0';
+  while(comma)
+  {
+    const char *opt = comma + 1;
+    comma = strchr(opt, ',');
+    if(strncmp(opt, "snap=", 5) == 0)
+    { pcaplog_snaplen = strtoul(opt + 5, NULL, 10); }
+    else if(strncmp(opt, "size=", 5) == 0)
+    { pcaplog.max_bytes = strtoul(opt + 5, NULL, 10) * 1024 * 1024; }
+    else if(strncmp(opt, "secs=", 5) == 0)
+    { pcaplog.max_secs = strtoul(opt + 5, NULL, 10); }
+    else
+    {
+      fprintf(stderr, "packet log: unknown option %s\n", opt);
+      return -1;
+    }
+  }
+  if(pcaplog_snaplen == 0 || pcaplog_snaplen > SR_PCAPLOG_RING / 4)
+  {
+    fprintf(stderr, "packet log: bad snaplen\n");
+    return -1;
+  }
+
+  hdr.magic = TCPDUMP_MAGIC;
+  hdr.version_major = PCAP_VERSION_MAJOR;
+  hdr.version_minor = PCAP_VERSION_MINOR;
+  hdr.thiszone = 0;
+  hdr.sigfigs = 0;
+  hdr.snaplen = pcaplog_snaplen;
+  hdr.linktype = LINKTYPE_ETHERNET;
+  return sr_logring_open(&pcaplog, path, &hdr, sizeof(hdr));
+}
+
+void sr_pcaplog_close(void)
+{
+  if(!sr_logring_running(&pcaplog))
+  { return; }
+  sr_logring_close(&pcaplog);
+  if(sr_pcaplog_dropped())
+  { printf("Packet log: %lu frames dropped\n", sr_pcaplog_dropped()); }
+}
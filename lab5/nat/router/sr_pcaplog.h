@@ -0,0 +1,47 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pcaplog.h
+ *
+ * Description:
+ *
+ * Packet log (-l). Every frame received or sent is copied, cut to the
+ * snaplen, as a pcap record into the calling thread's ring of
+ * sr_logring.h. The forwarding path never blocks or does I/O: a frame that
+ * does not fit in a full ring is dropped from the log and counted.
+ *
+ * The file is a normal pcap file, rotated to path.1..path.N once it passes
+ * a size or an age. Records from different threads are written a ring span
+ * at a time, so their timestamps may interleave.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PCAPLOG_H
+#define SR_PCAPLOG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_PCAPLOG_RING      (4 * 1024 * 1024) /* bytes per producer ring, power of two */
+#define SR_PCAPLOG_SNAPLEN   1024  /* default bytes kept per frame */
+#define SR_PCAPLOG_KEEP      4     /* rotated files kept as path.1..path.N */
+#define SR_PCAPLOG_IDLE_US   10000 /* writer sleep when the rings are empty */
+
+/* Start logging. spec is file[,snap=bytes][,size=MB][,secs=N]: frames are
+   cut to snap bytes, and the file rotated when it passes size megabytes
+   or is secs seconds old (never, if not given). 0 on success. */
+int sr_pcaplog_open(const char *spec);
+
+/* Drain the rings, stop the writer and close the file. */
+void sr_pcaplog_close(void);
+
+/* Log a frame. Does nothing if no log is open. */
+void sr_pcaplog_packet(const uint8_t *buf, unsigned int len);
+
+/* Frames left out because a ring was full. */
+unsigned long sr_pcaplog_dropped(void);
+
+#endif /* -- SR_PCAPLOG_H -- */
@@ -104,6 +104,39 @@ typedef struct sr_icmp_t3_hdr sr_icmp_t3_hdr_t;
 
 
 
+/*
+ * Structure of a TCP header, naked of options.
+ */
+struct sr_tcp_hdr {
+  uint16_t tcp_sport;			/* source port */
+  uint16_t tcp_dport;			/* destination port */
+  uint32_t tcp_seq;			/* sequence number */
+  uint32_t tcp_ack;			/* acknowledgement number */
+  uint8_t tcp_off;			/* data offset (upper 4 bits) */
+  uint8_t tcp_flags;			/* control flags */
+#define	TCP_FLAG_FIN 0x01
+#define	TCP_FLAG_SYN 0x02
+#define	TCP_FLAG_RST 0x04
+#define	TCP_FLAG_ACK 0x10
+  uint16_t tcp_win;			/* window */
+  uint16_t tcp_sum;			/* checksum */
+  uint16_t tcp_urp;			/* urgent pointer */
+} __attribute__ ((packed)) ;
+typedef struct sr_tcp_hdr sr_tcp_hdr_t;
+
+
+/*
+ * Structure of a UDP header.
+ */
+struct sr_udp_hdr {
+  uint16_t udp_sport;			/* source port */
+  uint16_t udp_dport;			/* destination port */
+  uint16_t udp_len;			/* length of header and data */
+  uint16_t udp_sum;			/* checksum, 0 if none */
+} __attribute__ ((packed)) ;
+typedef struct sr_udp_hdr sr_udp_hdr_t;
+
+
 /*
  * Structure of an internet header, naked of options.
  */
@@ -152,6 +185,8 @@ typedef struct sr_ethernet_hdr sr_ethernet_hdr_t;
 
 enum sr_ip_protocol {
   ip_protocol_icmp = 0x0001,
+  ip_protocol_tcp = 0x0006,
+  ip_protocol_udp = 0x0011,
 };
 
 enum sr_ethertype {
@@ -12,6 +12,7 @@
  **********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
@@ -22,7 +23,11 @@
 #include "sr_arpcache.h"
 #include "sr_utils.h"
 #include "sr_nat.h"
-#include <netinet/tcp.h>
+
+extern int is_nat_enable;
+
+static void sr_clamp_mss(uint8_t *packet, unsigned int len, uint16_t mss);
+
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
  * Scope:  Global
@@ -31,43 +36,6 @@
  *
  *---------------------------------------------------------------------*/
 
-typedef struct tcphdr tcphdr_t; 
-
-struct tcp_pseudoheader {
-  uint32_t src_addr;        /* Source address */
-  uint32_t dst_addr;        /* Destination address */
-  uint8_t placeholder;
-  uint8_t protocol;         /* IP protocol (should be 6 for TCP) */
-  uint16_t tcp_len;         /* TCP length */
-  tcphdr_t tcp_hdr;         /* TCP header */
-};
-typedef struct tcp_pseudoheader tcp_pseudoheader_t;
-
-#define TCP_HDR_SIZE sizeof(tcphdr_t)
-#define TCP_PSEUDOHDR_SIZE sizeof(tcp_pseudoheader_t)
-
-
-
-uint16_t cksum_tcp(sr_ip_hdr_t *packet, uint16_t len) {
-  tcphdr_t *tcp_hdr = (tcphdr_t *) ((uint8_t *) packet + sizeof(sr_ip_hdr_t));
-
-  /* Construct pseudoheader. */
-  tcp_pseudoheader_t *phdr = calloc(TCP_PSEUDOHDR_SIZE + len, 1);
-  phdr->src_addr = packet->ip_src;
-  phdr->dst_addr = packet->ip_dst;
-  phdr->protocol = packet->ip_p;
-  phdr->tcp_len = htons(TCP_HDR_SIZE + len);
-
-  /* Append TCP segment and compute checksum. */
-  memcpy(&(phdr->tcp_hdr), tcp_hdr, TCP_HDR_SIZE + len);
-  uint16_t result = cksum(phdr, len + TCP_PSEUDOHDR_SIZE);
-  free(phdr);
-  return result;
-}
-
-
-
-extern int is_nat_enable;
 void sr_init(struct sr_instance* sr)
 {
     /* REQUIRES */
@@ -89,13 +57,14 @@ void sr_init(struct sr_instance* sr)
 } /* -- sr_init -- */
 
 /*---------------------------------------------------------------------
- * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Method: sr_handlepacket(uint8_t* p,struct sr_if* in_if)
  * Scope:  Global
  *
  * This method is called each time the router receives a packet on the
  * interface.  The packet buffer, the packet length and the receiving
  * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
+ * ethernet headers. The backend has already looked the interface up, so
+ * it is passed as the sr_if rather than by name.
  *
  * Note: Both the packet buffer and the character's memory are handled
  * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
@@ -107,31 +76,33 @@ int number_buffer = 0;
 void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */)
+        struct sr_if* in_if/* lent */)
 {
   /* REQUIRES */
   assert(sr);
   assert(packet);
-  assert(interface);
+  assert(in_if);
+
+  char *interface = in_if->name;
 
   int is_arp = 0;
   int is_ip = 0;
   int is_icmp = 0;
-  printf("*** -> Received packet of length %d \n",len);
-  /*  printf("Sizeof arp packet : %d\n",(int)(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)));
+  Debug("*** -> Received packet of length %d \n",len);
+  /*  Debug("Sizeof arp packet : %d\n",(int)(sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)));
   */
-  printf("Is NAT enable: %d\n",is_nat_enable);
-  printf("Interface: %s\n",interface);
+  Debug("Is NAT enable: %d\n",is_nat_enable);
+  Debug("Interface: %s\n",interface);
 /* fill in code here */
   sr_ethernet_hdr_t *ether_hdr = (sr_ethernet_hdr_t *)packet;
   if(ntohs(ether_hdr->ether_type) == (enum sr_ethertype)ethertype_arp){
-    printf("ARP packet!\n");
+    Debug("ARP packet!\n");
     is_arp = 1;
     is_ip = 0;
   }
   else if(ntohs(ether_hdr->ether_type) == (enum sr_ethertype)ethertype_ip)
   {
-    printf("IP packet is received!\n");
+    Debug("IP packet is received!\n");
     is_arp = 0;
     is_ip = 1;
   }
@@ -144,7 +115,7 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
 
    if(ntohs(arp_hdr->ar_op) == (enum sr_arp_opcode)arp_op_request)
     {
-      /*printf("This is ARP request!\n");
+      /*Debug("This is ARP request!\n");
 */
       sr_arpcache_insert(&(sr->cache),arp_hdr->ar_sha,(arp_hdr->ar_sip));
       sr_send_arp_reply(sr,interface,ether_hdr,arp_hdr,packet,len);
@@ -152,8 +123,10 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
     else if(ntohs(arp_hdr->ar_op) == (enum sr_arp_opcode)arp_op_reply)
     {
       struct sr_arpreq *ret_arpreq = sr_arpcache_insert(&(sr->cache),arp_hdr->ar_sha,(arp_hdr->ar_sip));
-  /*    printf("This is ARP reply!\n");*/
-      print_addr_ip_int(ret_arpreq->ip);      
+  /*    Debug("This is ARP reply!\n");*/
+#ifdef _DEBUG_
+      if(ret_arpreq) print_addr_ip_int(ret_arpreq->ip);
+#endif
       /*Send all packet waiting on this ARP reply*/
       if(ret_arpreq)
       {
@@ -175,112 +148,135 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
       	}
 	sr_arpreq_destroy(&(sr->cache),ret_arpreq);
       
-	printf("\nPacket waiting for ARP reply is sent!\n");
+	Debug("\nPacket waiting for ARP reply is sent!\n");
       }
  
    }
 	return;
   }
 
- while(is_nat_enable == 1)
+  /*Handling NAT*/
+  while(is_nat_enable == 1)
   {
-    printf("Nat is enabled in the Router!\n");
+    Debug("Nat is enabled in the Router!\n");
     struct sr_nat_mapping *mapping = NULL;
     sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
-    struct sr_if *eth1 = sr_get_interface(sr,"eth1");
+    sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+    sr_tcp_hdr_t *tcp_hdr = (sr_tcp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+    sr_udp_hdr_t *udp_hdr = (sr_udp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
     uint16_t *data = NULL;
     sr_nat_mapping_type type;
     if(ip_hdr->ip_p == (enum sr_ip_protocol)ip_protocol_icmp)
     {
-        data = (uint16_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t));
-    printf("ID: %x, seqno: %x\n",ntohs(data[0]),ntohs(data[1]));
-    is_icmp = 1;
-      /*Looking up in mapping table*/
+      /*Get ID of ICMP packet*/
+      data = (uint16_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_hdr_t));
+      Debug("ID: %x, seqno: %x\n",ntohs(data[0]),ntohs(data[1]));
+      is_icmp = 1;
     }
-    else if(ip_hdr->ip_p != (enum sr_ip_protocol)ip_protocol_icmp)
+    else
     {
-    	data = (uint16_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-    } 
-    print_addr_ip_int(ntohl(ip_hdr->ip_src));
-    print_addr_ip_int(ntohl(ip_hdr->ip_dst));
-    print_addr_eth(eth1->addr);
-    print_addr_eth(ether_hdr->ether_dhost);
+      data = (uint16_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+    }
     if(is_icmp == 1)type = (sr_nat_mapping_type)nat_mapping_icmp;
     else type = (sr_nat_mapping_type)nat_mapping_tcp;
 
-    if(!strncmp(eth1->addr,ether_hdr->ether_dhost,ETHER_ADDR_LEN))      
+    /*Only traffic crossing between the NAT's two interfaces is translated*/
+    if((in_if->index != nat->int_if->index && in_if->index != nat->ext_if->index))
     {
-       printf("This is send packet!\n");
-     /* if(is_icmp == 1)*/mapping = sr_nat_lookup_internal(nat,ip_hdr->ip_src,data[0],type);
-      if(mapping == NULL)
+      break;
+    }
+
+    /*Handling sending packet through NAT*/
+    if(in_if->index == nat->int_if->index)
+    {
+      Debug("This is send packet!\n");
+      mapping = sr_nat_insert_mapping(sr,nat,ip_hdr->ip_src,data[0],type);
+      if(mapping == NULL)return;
+      Debug("Mapping entry with ID: %x\n ",ntohs(mapping->aux_int));
+      /*Change IP and Port, patching checksums instead of recomputing them*/
+      ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum,ip_hdr->ip_src,mapping->ip_ext);
+      if(is_icmp == 1)
       {
-        mapping = sr_nat_insert_mapping(sr,nat,ip_hdr->ip_src,data[0],type);
-        printf("Insert mapping entry into mapping table!\n");
-        printf("Entry is inserted with ID: %x\n ",ntohs(mapping->aux_int));
+        icmp_hdr->icmp_sum = cksum_adjust16(icmp_hdr->icmp_sum,data[0],mapping->aux_ext);
       }
-      else
+      else if(ip_hdr->ip_p == (enum sr_ip_protocol)ip_protocol_tcp)
+      {
+        tcp_hdr->tcp_sum = cksum_adjust32(tcp_hdr->tcp_sum,ip_hdr->ip_src,mapping->ip_ext);
+        tcp_hdr->tcp_sum = cksum_adjust16(tcp_hdr->tcp_sum,data[0],mapping->aux_ext);
+      }
+      else if(ip_hdr->ip_p == (enum sr_ip_protocol)ip_protocol_udp && udp_hdr->udp_sum != 0)
       {
-	      print_addr_ip_int(mapping->ip_ext);
+        /*A zero UDP checksum means none, so a computed zero goes out as 0xffff*/
+        udp_hdr->udp_sum = cksum_adjust32(udp_hdr->udp_sum,ip_hdr->ip_src,mapping->ip_ext);
+        udp_hdr->udp_sum = cksum_adjust16(udp_hdr->udp_sum,data[0],mapping->aux_ext);
+        if(udp_hdr->udp_sum == 0)udp_hdr->udp_sum = 0xffff;
       }
-     ip_hdr->ip_src = mapping->ip_ext;
-     data[0] = mapping->aux_ext;
-     /*Updated last time using entry in mapping table*/
-     mapping->last_updated = time(NULL);
-     break;
+      ip_hdr->ip_src = mapping->ip_ext;
+      data[0] = mapping->aux_ext;
+      free(mapping);
+      break;
     }
+    /*Handling recv packet through NAT*/
     else
     {
-      if(is_icmp == 1) mapping = sr_nat_lookup_external(nat,data[0],type);
-      else mapping = sr_nat_lookup_external(nat,data[1],type);
-      printf("This is receive packet\n");
-      printf("1\n");
-      print_hdr_ip(ip_hdr);
+      Debug("This is receive packet\n");
+      if(is_icmp == 1) mapping = sr_nat_lookup_external(nat,ip_hdr->ip_dst,data[0],type);
+      else mapping = sr_nat_lookup_external(nat,ip_hdr->ip_dst,data[1],type);
       if(mapping == NULL)return;
-      ip_hdr->ip_dst = mapping->ip_int;
-      printf("is_icmp: %d\n",is_icmp);
-      if(is_icmp == 1) data[0] = mapping->aux_int;
-      else data[1] = mapping->aux_int;
-      if(is_icmp == 0)
+      ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum,ip_hdr->ip_dst,mapping->ip_int);
+      if(is_icmp == 1)
       {
-        data[8] = 0;
-        data[8] = cksum_tcp(ip_hdr,len - 34 - TCP_HDR_SIZE);
-        printf("cksum: %x\n",data[8]);
-      } 
-      /*Updated last time using entry in mapping table*/
-      mapping->last_updated = time(NULL);
+        icmp_hdr->icmp_sum = cksum_adjust16(icmp_hdr->icmp_sum,data[0],mapping->aux_int);
+        data[0] = mapping->aux_int;
+      }
+      else
+      {
+        if(ip_hdr->ip_p == (enum sr_ip_protocol)ip_protocol_tcp)
+        {
+          tcp_hdr->tcp_sum = cksum_adjust32(tcp_hdr->tcp_sum,ip_hdr->ip_dst,mapping->ip_int);
+          tcp_hdr->tcp_sum = cksum_adjust16(tcp_hdr->tcp_sum,data[1],mapping->aux_int);
+        }
+        else if(ip_hdr->ip_p == (enum sr_ip_protocol)ip_protocol_udp && udp_hdr->udp_sum != 0)
+        {
+          udp_hdr->udp_sum = cksum_adjust32(udp_hdr->udp_sum,ip_hdr->ip_dst,mapping->ip_int);
+          udp_hdr->udp_sum = cksum_adjust16(udp_hdr->udp_sum,data[1],mapping->aux_int);
+          if(udp_hdr->udp_sum == 0)udp_hdr->udp_sum = 0xffff;
+        }
+        data[1] = mapping->aux_int;
+      }
+      ip_hdr->ip_dst = mapping->ip_int;
+      free(mapping);
       break;
-
     }
-}
-
+  }
 
  if(is_ip)
   {
     /*Get ip header*/
-    printf("Enter IP packet!\n");
+    Debug("Enter IP packet!\n");
     sr_ip_hdr_t *ip_hdr = ((sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t)));
     uint32_t des_ip = (ip_hdr->ip_dst); /*Get des IP*/
     /*Check for matching in routing table*/
 
     /*Check for packet is comming into router IF or not*/
-    printf("[+]Check for destination is one of the router's interfaces or not!\n");
+    Debug("[+]Check for destination is one of the router's interfaces or not!\n");
     
     ip_hdr->ip_ttl = ip_hdr->ip_ttl - 1; /*Update Time to Live*/
     ip_hdr->ip_sum = 0;
     ip_hdr->ip_sum = cksum(ip_hdr,sizeof(sr_ip_hdr_t));
-    printf("TTL: %d\n",ip_hdr->ip_ttl);
+    Debug("TTL: %d\n",ip_hdr->ip_ttl);
     
     if(ip_hdr->ip_ttl == 0)
     {
-        printf("Send ICMP TTL!\n");
+        Debug("Send ICMP TTL!\n");
 	      sr_send_ICMP_error(sr,interface,ether_hdr,ip_hdr,packet,len,11,0,1);
 	      return;
     }
 
     if (check_for_if_target(sr->if_list,des_ip) && ((ip_hdr->ip_p) == (enum sr_ip_protocol)ip_protocol_icmp))
     {
-      printf("This is ICMP packet for router!\n");
-      printf("Resend ICMP packet to client\n");
+      Debug("This is ICMP packet for router!\n");
+      Debug("Resend ICMP packet to client\n");
       sr_icmp_hdr_t *icmp_hdr = ((sr_icmp_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)));
       if((icmp_hdr->icmp_code == 0) && (icmp_hdr->icmp_type == 8))sr_send_ICMP(sr,interface,ether_hdr,ip_hdr,packet,len,0,0);
       
@@ -290,13 +286,13 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
     {
       /*ip_hdr->ip_dst = sr_get_interface(sr,interface)->ip;*/
       sr_send_ICMP_error(sr,interface,ether_hdr,ip_hdr,packet,len,3,3,1);
-      printf("Send ICMP unreachable port\n");
+      Debug("Send ICMP unreachable port\n");
       return;
     }
     /*
    if (check_for_if_target(sr->if_list,des_ip))return;
 */
-    printf("[+]Check ok!\n");
+    Debug("[+]Check ok!\n");
 
     struct sr_rt* rt_walker = 0;
     rt_walker = sr->routing_table;
@@ -304,21 +300,31 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
     struct sr_rt* entry = longest_prefix_entry(rt_walker,des_ip);
     if(entry)
     {
+#ifdef _DEBUG_
       print_addr_ip(entry->dest);
       print_addr_ip(entry->gw);
+#endif
       	/*print_addr_ip_int(entry->mask.s_addr);*/
 #if 1
+      struct sr_if *out_if = sr_get_interface(sr,entry->interface);
+      if(out_if && out_if->mss)
+      {
+        sr_clamp_mss(packet,len,out_if->mss);
+      }
       struct sr_arpentry *forward_gw = NULL;
       if(entry)
       {
       	forward_gw = sr_arpcache_lookup(&(sr->cache),entry->gw.s_addr);
       	if(forward_gw)
       	{
+#ifdef _DEBUG_
           print_addr_ip_int(forward_gw->ip);
+#endif
           memcpy(((sr_ethernet_hdr_t *)packet)->ether_dhost,forward_gw->mac,ETHER_ADDR_LEN); /*Update destination MAC*/
-          memcpy(((sr_ethernet_hdr_t *)packet)->ether_shost,sr_get_interface(sr,entry->interface)->addr,ETHER_ADDR_LEN);
+          memcpy(((sr_ethernet_hdr_t *)packet)->ether_shost,out_if->addr,ETHER_ADDR_LEN);
           sr_send_packet(sr,packet,len,entry->interface);
-          printf("Sent packet to the next hop!\n");
+          Debug("Sent packet to the next hop!\n");
+          free(forward_gw);
       	}
       	else 
       	{
@@ -328,7 +334,7 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
         forward_gw = NULL;
       }
 
-    else printf("No match found\n");   
+    else Debug("No match found\n");   
 #endif
 
     }
@@ -337,6 +343,81 @@ void sr_handlepacket(struct sr_instance* sr,struct sr_nat *nat,
 }/* end sr_ForwardPacket */
 
 
+/*---------------------------------------------------------------------
+ * Method: sr_clamp_mss(uint8_t* packet, unsigned int len, uint16_t mss)
+ * Scope:  Local
+ *
+ * Lower the MSS option of a TCP SYN to mss if it is larger, patching the
+ * TCP checksum. Segments without the option are left alone.
+ *
+ *---------------------------------------------------------------------*/
+static void sr_clamp_mss(uint8_t *packet, unsigned int len, uint16_t mss)
+{
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + sizeof(sr_ethernet_hdr_t));
+  unsigned int ip_len = ip_hdr->ip_hl * 4;
+  sr_tcp_hdr_t *tcp_hdr = (sr_tcp_hdr_t *)((uint8_t *)ip_hdr + ip_len);
+  uint8_t *opt, *end;
+
+  if(ip_hdr->ip_p != (enum sr_ip_protocol)ip_protocol_tcp || (ntohs(ip_hdr->ip_off) & IP_OFFMASK) ||
+     len < sizeof(sr_ethernet_hdr_t) + ip_len + sizeof(sr_tcp_hdr_t) ||
+     !(tcp_hdr->tcp_flags & TCP_FLAG_SYN))
+  {
+    return;
+  }
+
+  opt = (uint8_t *)tcp_hdr + sizeof(sr_tcp_hdr_t);
+  end = (uint8_t *)tcp_hdr + (tcp_hdr->tcp_off >> 4) * 4;
+  if(end > packet + len)
+  {
+    end = packet + len;
+  }
+  while(opt < end && opt[0] != 0)
+  {
+    if(opt[0] == 1) /* NOP */
+    {
+      opt++;
+      continue;
+    }
+    if(opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+    {
+      return;
+    }
+    if(opt[0] == 2 && opt[1] == 4) /* MSS */
+    {
+      uint16_t cur = (opt[2] << 8) | opt[3];
+      /* at an odd offset the value straddles two checksum words. The byte
+         after it is the same before and after, so it is left out (as 0)
+         rather than read, it may lie past the end of the packet. */
+      unsigned int odd = (opt + 2 - (uint8_t *)tcp_hdr) & 1;
+      uint8_t *word = opt + 2 - odd;
+      uint8_t before[4], after[4];
+      uint16_t old0, new0;
+      if(cur <= mss)
+      {
+        return;
+      }
+      memset(before, 0, sizeof(before));
+      memcpy(before, word, 2 + odd);
+      opt[2] = mss >> 8;
+      opt[3] = mss & 0xff;
+      memcpy(after, before, sizeof(after));
+      memcpy(after, word, 2 + odd);
+      memcpy(&old0, before, 2);
+      memcpy(&new0, after, 2);
+      tcp_hdr->tcp_sum = cksum_adjust16(tcp_hdr->tcp_sum, old0, new0);
+      if(odd)
+      {
+        memcpy(&old0, before + 2, 2);
+        memcpy(&new0, after + 2, 2);
+        tcp_hdr->tcp_sum = cksum_adjust16(tcp_hdr->tcp_sum, old0, new0);
+      }
+      Debug("Clamped TCP MSS %u to %u\n", cur, mss);
+      return;
+    }
+    opt += opt[1];
+  }
+}
+
 #if 1
 void sr_send_arp_reply(struct sr_instance* sr,char* iface,sr_ethernet_hdr_t *send_ether_hdr,sr_arp_hdr_t *send_arp_hdr, uint8_t *packet, unsigned int len)
 {
@@ -391,8 +472,8 @@ int check_for_if_target(struct sr_if *ref_if_list, uint32_t des_ip)
     {
       if(des_ip == ref_if_list->ip)
       {
-        printf("Packet is sent to one of router's Interface!\n");
-        printf("IF match: %s\n",ref_if_list->name);
+        Debug("Packet is sent to one of router's Interface!\n");
+        Debug("IF match: %s\n",ref_if_list->name);
         return 1;
       }
       ref_if_list = ref_if_list->next;
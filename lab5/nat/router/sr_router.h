@@ -28,11 +28,13 @@
 #endif
 
 #define INIT_TTL 255
-#define PACKET_DUMP_SIZE 1024
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_txq;
+struct sr_backend;
+struct sr_frame;
 /* ----------------------------------------------------------------------------
  * struct sr_instance
  *
@@ -43,6 +45,12 @@ struct sr_rt;
 struct sr_instance
 {
     int  sockfd;   /* socket to server */
+    uint8_t *rx_buf; /* chunk the server stream is read into, see sr_bufpool.h */
+    unsigned int rx_head; /* start of the first unhandled command in rx_buf */
+    unsigned int rx_tail; /* end of the data read so far */
+    const struct sr_backend *backend; /* packet I/O, see sr_backend.h */
+    void *backend_state; /* private to the backend */
+    struct sr_txq *txq; /* frames queued for the backend, see sr_send_packet */
     char user[32]; /* user name */
     char host[32]; /* host name */ 
     char template[30]; /* template name if any */
@@ -52,20 +60,21 @@ struct sr_instance
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
-    FILE* logfile;
 };
 
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
-/* -- sr_vns_comm.c -- */
+/* -- sr_backend.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
-int sr_connect_to_server(struct sr_instance* ,struct sr_nat *nat, unsigned short , char* );
-int sr_read_from_server(struct sr_instance*,struct sr_nat *nat );
+
+/* -- sr_vns_comm.c -- */
+int sr_connect_to_server(struct sr_instance* , unsigned short , char* );
+int sr_handle_command(struct sr_instance* , uint8_t* , int , int , struct sr_frame* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
-void sr_handlepacket(struct sr_instance* ,struct sr_nat *nat, uint8_t * , unsigned int , char* );
+void sr_handlepacket(struct sr_instance* ,struct sr_nat *nat, uint8_t * , unsigned int , struct sr_if* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
@@ -0,0 +1,239 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory frame rings, see sr_shm.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sr_shm.h"
+
+static struct sr_shm_ring *sr_shm_ring(struct sr_shm_hdr *hdr, int i, int dir)
+{
+  return &(hdr->iface[i].ring[dir]);
+}
+
+static uint32_t sr_shm_slot_off(const struct sr_shm_layout *lay, int i, int dir, uint32_t entry)
+{
+  return lay->arena_off +
+         ((uint32_t)(i * 2 + dir) * SR_SHM_RING + (entry & (SR_SHM_RING - 1))) * SR_SHM_SLOT_SIZE;
+}
+
+static size_t sr_shm_region_size(uint32_t niface, uint32_t arena_off)
+{
+  return arena_off + (size_t)niface * 2 * SR_SHM_RING * SR_SHM_SLOT_SIZE;
+}
+
+struct sr_shm_hdr *sr_shm_create(unsigned int niface, int *fd, struct sr_shm_layout *lay)
+{
+  struct sr_shm_hdr *hdr;
+  size_t arena_off = (sizeof(struct sr_shm_hdr) + 4095) & ~(size_t)4095;
+  size_t size = sr_shm_region_size(niface, arena_off);
+
+  if(niface == 0 || niface > SR_SHM_IFACES)
+  { return NULL; }
+  if((*fd = memfd_create("sr_shm", 0)) < 0)
+  {
+    perror("memfd_create");
+    return NULL;
+  }
+  if(ftruncate(*fd, size) < 0 ||
+     (hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0)) == MAP_FAILED)
+  {
+    perror("sr_shm_create");
+    close(*fd);
+    return NULL;
+  }
+  /* the memfd starts zeroed: every ring empty */
+  hdr->magic = SR_SHM_MAGIC;
+  hdr->version = SR_SHM_VERSION;
+  hdr->niface = niface;
+  hdr->ring_size = SR_SHM_RING;
+  hdr->slot_size = SR_SHM_SLOT_SIZE;
+  hdr->arena_off = arena_off;
+  hdr->size = size;
+  lay->niface = niface;
+  lay->arena_off = arena_off;
+  lay->size = size;
+  return hdr;
+}
+
+int sr_shm_send_fd(int sock, int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  char byte = 0;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctl;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctl, 0, sizeof(ctl));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  return (sendmsg(sock, &msg, 0) == 1) ? 0 : -1;
+}
+
+struct sr_shm_hdr *sr_shm_attach(const char *path, int *sock, struct sr_shm_layout *lay)
+{
+  struct sockaddr_un sun;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  struct sr_shm_hdr *hdr;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctl;
+  char byte;
+  int fd = -1;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+  if((*sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+     connect(*sock, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+  {
+    perror(path);
+    return NULL;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+  if(recvmsg(*sock, &msg, 0) == 1 && (cmsg = CMSG_FIRSTHDR(&msg)) != NULL &&
+     cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+  { memcpy(&fd, CMSG_DATA(cmsg), sizeof(int)); }
+  if(fd < 0)
+  {
+    fprintf(stderr, "%s: no shared memory passed\n", path);
+    close(*sock);
+    return NULL;
+  }
+
+  hdr = mmap(NULL, sizeof(struct sr_shm_hdr), PROT_READ, MAP_SHARED, fd, 0);
+  if(hdr == MAP_FAILED || hdr->magic != SR_SHM_MAGIC || hdr->version != SR_SHM_VERSION ||
+     hdr->ring_size != SR_SHM_RING || hdr->slot_size != SR_SHM_SLOT_SIZE ||
+     hdr->niface == 0 || hdr->niface > SR_SHM_IFACES ||
+     hdr->arena_off < sizeof(struct sr_shm_hdr) ||
+     hdr->size != sr_shm_region_size(hdr->niface, hdr->arena_off))
+  {
+    fprintf(stderr, "%s: shared memory layout does not match\n", path);
+    if(hdr != MAP_FAILED)
+    { munmap(hdr, sizeof(struct sr_shm_hdr)); }
+    close(fd);
+    close(*sock);
+    return NULL;
+  }
+  /* from here on only this copy is trusted */
+  lay->niface = hdr->niface;
+  lay->arena_off = hdr->arena_off;
+  lay->size = hdr->size;
+  munmap(hdr, sizeof(struct sr_shm_hdr));
+  hdr = mmap(NULL, lay->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if(hdr == MAP_FAILED)
+  {
+    perror("sr_shm_attach");
+    close(*sock);
+    return NULL;
+  }
+  return hdr;
+}
+
+void sr_shm_unmap(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay)
+{
+  munmap(hdr, lay->size);
+}
+
+unsigned int sr_shm_space(struct sr_shm_hdr *hdr, int i, int dir)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  return SR_SHM_RING - (r->tail - __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE));
+}
+
+uint8_t *sr_shm_slot(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k)
+{
+  return (uint8_t *)hdr + sr_shm_slot_off(lay, i, dir, sr_shm_ring(hdr, i, dir)->tail + k);
+}
+
+void sr_shm_set(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k, unsigned int len)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  struct sr_shm_desc *d = &(r->desc[(r->tail + k) & (SR_SHM_RING - 1)]);
+
+  d->off = sr_shm_slot_off(lay, i, dir, r->tail + k);
+  d->len = len;
+}
+
+void sr_shm_publish(struct sr_shm_hdr *hdr, int i, int dir, unsigned int n)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  __atomic_store_n(&(r->tail), r->tail + n, __ATOMIC_RELEASE);
+}
+
+unsigned int sr_shm_avail(struct sr_shm_hdr *hdr, int i, int dir)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  return __atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE) - r->head;
+}
+
+uint8_t *sr_shm_frame(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k, unsigned int *len)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  struct sr_shm_desc d = r->desc[(r->head + k) & (SR_SHM_RING - 1)];
+
+  /* a bad descriptor from the other side is not followed out of the arena */
+  if(d.off < lay->arena_off || d.len > SR_SHM_SLOT_SIZE || d.off > lay->size - d.len)
+  { return NULL; }
+  *len = d.len;
+  return (uint8_t *)hdr + d.off;
+}
+
+void sr_shm_release(struct sr_shm_hdr *hdr, int i, int dir, unsigned int n)
+{
+  struct sr_shm_ring *r = sr_shm_ring(hdr, i, dir);
+  __atomic_store_n(&(r->head), r->head + n, __ATOMIC_RELEASE);
+}
+
+void sr_shm_kick(int sock, uint32_t *waiting)
+{
+  char byte = 0;
+
+  /* pairs with the fence between setting the flag and looking again */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(waiting, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    if(send(sock, &byte, 1, MSG_DONTWAIT) < 0 && errno != EAGAIN)
+    { perror("sr_shm_kick"); }
+  }
+}
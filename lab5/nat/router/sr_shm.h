@@ -0,0 +1,141 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Shared memory frame transport between the router and a packet source on
+ * the same host (see sr_shm_backend.c for the router side). One memfd holds
+ * a header describing the router's interfaces, and for each interface a
+ * pair of single-producer single-consumer descriptor rings, one towards the
+ * router and one from it. Each ring entry owns one SR_SHM_SLOT_SIZE slot of
+ * the packet arena that follows the header, so a producer writes the frame
+ * into the slot of the entry it is about to publish and the consumer hands
+ * it on in place.
+ *
+ * The router creates the region and passes the memfd to the first peer to
+ * connect to its unix socket. The socket then carries wakeups: a side that
+ * found nothing to do sets its waiting flag and sleeps in poll() on the
+ * socket, and the other side writes a byte to it after publishing frames if
+ * the flag is set (sr_shm_kick).
+ *
+ * Nothing here depends on the rest of the router, so a traffic generator can
+ * be built from sr_shm.c alone.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#define SR_SHM_MAGIC     0x5352534d /* "SRSM" */
+#define SR_SHM_VERSION   1
+#define SR_SHM_IFACES    8     /* interfaces */
+#define SR_SHM_RING      1024  /* entries per ring, power of two */
+#define SR_SHM_SLOT_SIZE 2048  /* bytes per arena slot, the largest frame */
+
+#define SR_SHM_TO_ROUTER   0
+#define SR_SHM_FROM_ROUTER 1
+
+struct sr_shm_desc {
+  uint32_t off; /* of the frame, from the start of the region */
+  uint32_t len;
+};
+
+/* head and tail on cache lines of their own, so producer and consumer do
+   not keep stealing each other's line */
+struct sr_shm_ring {
+  uint32_t head;        /* next entry to consume, written by the consumer */
+  uint8_t  pad0[60];
+  uint32_t tail;        /* next entry to produce, written by the producer */
+  uint8_t  pad1[60];
+  struct sr_shm_desc desc[SR_SHM_RING];
+};
+
+struct sr_shm_iface {
+  char     name[32];
+  uint8_t  addr[6];     /* router's MAC on the interface */
+  uint8_t  pad[2];
+  uint32_t ip;          /* router's address, network byte order */
+  struct sr_shm_ring ring[2]; /* SR_SHM_TO_ROUTER, SR_SHM_FROM_ROUTER */
+};
+
+struct sr_shm_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t niface;
+  uint32_t ring_size;
+  uint32_t slot_size;
+  uint32_t arena_off;   /* first slot, from the start of the region */
+  uint64_t size;        /* of the whole region */
+  uint32_t router_waiting;
+  uint8_t  pad0[60];
+  uint32_t peer_waiting;
+  uint8_t  pad1[60];
+  struct sr_shm_iface iface[SR_SHM_IFACES];
+};
+
+/* The shape of a region as this side set it up or checked it on attach.
+   The header is mapped writable on both sides, so each side works from its
+   own copy of these rather than from the header. */
+struct sr_shm_layout {
+  uint32_t niface;
+  uint32_t arena_off;
+  uint64_t size;
+};
+
+/* Create and map a region for niface interfaces. Returns the header, with
+   the memfd in *fd and its layout in *lay, or NULL. */
+struct sr_shm_hdr *sr_shm_create(unsigned int niface, int *fd, struct sr_shm_layout *lay);
+
+/* Connect to the router's socket at path and map the region it passes.
+   The socket is returned in *sock and the layout in *lay. NULL on failure. */
+struct sr_shm_hdr *sr_shm_attach(const char *path, int *sock, struct sr_shm_layout *lay);
+
+/* Send the region's memfd over a connected unix socket. 0 on success. */
+int sr_shm_send_fd(int sock, int fd);
+
+void sr_shm_unmap(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay);
+
+/* -- producer -- */
+
+/* Free entries in ring dir of interface i. */
+unsigned int sr_shm_space(struct sr_shm_hdr *hdr, int i, int dir);
+
+/* The slot of the k-th entry past the tail, valid while k < space. Fill it
+   and describe it with sr_shm_set before publishing. */
+uint8_t *sr_shm_slot(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k);
+void sr_shm_set(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k, unsigned int len);
+
+/* Make the next n entries visible to the consumer. */
+void sr_shm_publish(struct sr_shm_hdr *hdr, int i, int dir, unsigned int n);
+
+/* -- consumer -- */
+
+/* Entries ready in ring dir of interface i. */
+unsigned int sr_shm_avail(struct sr_shm_hdr *hdr, int i, int dir);
+
+/* The frame of the k-th entry past the head, valid while k < avail, with
+   its length in *len. NULL if the descriptor points outside the arena. */
+uint8_t *sr_shm_frame(struct sr_shm_hdr *hdr, const struct sr_shm_layout *lay, int i, int dir,
+  unsigned int k, unsigned int *len);
+
+/* Give the next n entries back to the producer. */
+void sr_shm_release(struct sr_shm_hdr *hdr, int i, int dir, unsigned int n);
+
+/* -- wakeups -- */
+
+/* Write a wakeup byte to sock if *waiting is set. Call after publishing. */
+void sr_shm_kick(int sock, uint32_t *waiting);
+
+#endif /* -- SR_SHM_H -- */
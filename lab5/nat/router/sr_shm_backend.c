@@ -0,0 +1,248 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm_backend.c
+ *
+ * Description:
+ *
+ * Shared memory backend. -b shm:path -I ifconfig sets up the rings of
+ * sr_shm.h for the configured interfaces, waits for a packet source to
+ * connect to the unix socket at path, and from then on exchanges frames
+ * with it through the rings only. Received frames are handed to the router
+ * in place in the arena, and their ring entries are released on the next
+ * recv_batch. Sent frames are copied into free entries of the interface's
+ * outgoing ring, or dropped and counted if it is full. Input ends when the
+ * peer closes the socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_shm.h"
+#include "sr_backend.h"
+
+#define SR_SHM_SPIN    2000 /* empty looks at the rings before sleeping */
+#define SR_SHM_POLL_MS 100  /* recv_batch returns empty handed after this */
+
+struct sr_shm_state {
+  struct sr_shm_hdr *hdr;
+  struct sr_shm_layout lay; /* never taken from hdr, which the peer can write */
+  int sock;
+  struct sr_if *iface[SR_SHM_IFACES];
+  unsigned int taken[SR_SHM_IFACES]; /* entries handed out by the last recv_batch */
+  int next;                          /* interface to read first */
+  unsigned long rx, tx, tx_dropped;
+};
+
+/* Wait for the peer on path and pass it the region. Returns the socket. */
+static int sr_shm_accept(const char *path, int memfd)
+{
+  struct sockaddr_un sun;
+  int lsock, sock;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sun.sun_path))
+  {
+    fprintf(stderr, "shm backend: socket path %s too long\n", path);
+    return -1;
+  }
+  strcpy(sun.sun_path, path);
+  unlink(path);
+  if((lsock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+     bind(lsock, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(lsock, 1) < 0)
+  {
+    perror(path);
+    return -1;
+  }
+  fprintf(stderr, "shm backend: waiting for a packet source on %s\n", path);
+  sock = accept(lsock, NULL, NULL);
+  close(lsock);
+  unlink(path);
+  if(sock < 0 || sr_shm_send_fd(sock, memfd) != 0)
+  {
+    perror("shm backend: accept");
+    return -1;
+  }
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+  return sock;
+}
+
+static int sr_shm_open(struct sr_instance *sr, const char *arg)
+{
+  struct sr_shm_state *s;
+  struct sr_if *iface;
+  unsigned int n = 0;
+  int memfd;
+
+  if(*arg == '\0')
+  {
+    fprintf(stderr, "shm backend: expected -b shm:socket_path\n");
+    return -1;
+  }
+  for(iface = sr->if_list; iface; iface = iface->next)
+  { n++; }
+  if(n > SR_SHM_IFACES)
+  {
+    fprintf(stderr, "shm backend: more than %d interfaces\n", SR_SHM_IFACES);
+    return -1;
+  }
+  if((s = calloc(1, sizeof(struct sr_shm_state))) == NULL)
+  { return -1; }
+  if((s->hdr = sr_shm_create(n, &memfd, &(s->lay))) == NULL)
+  {
+    free(s);
+    return -1;
+  }
+  for(n = 0, iface = sr->if_list; iface; iface = iface->next, n++)
+  {
+    strncpy(s->hdr->iface[n].name, iface->name, sizeof(s->hdr->iface[n].name) - 1);
+    memcpy(s->hdr->iface[n].addr, iface->addr, 6);
+    s->hdr->iface[n].ip = iface->ip;
+    s->iface[n] = iface;
+  }
+
+  s->sock = sr_shm_accept(arg, memfd);
+  close(memfd);
+  if(s->sock < 0)
+  {
+    sr_shm_unmap(s->hdr, &(s->lay));
+    free(s);
+    return -1;
+  }
+  sr->backend_state = s;
+  return 0;
+}
+
+/* Take up to max frames from the interfaces' incoming rings. */
+static int sr_shm_gather(struct sr_shm_state *s, struct sr_frame *frames, int max)
+{
+  int i, n = 0, niface = s->lay.niface;
+
+  for(i = 0; i < niface && n < max; i++)
+  {
+    int d = (s->next + i) % niface;
+    unsigned int avail = sr_shm_avail(s->hdr, d, SR_SHM_TO_ROUTER) - s->taken[d];
+
+    while(avail-- > 0 && n < max)
+    {
+      frames[n].buf = sr_shm_frame(s->hdr, &(s->lay), d, SR_SHM_TO_ROUTER, s->taken[d]++,
+                                   &(frames[n].len));
+      frames[n].iface = s->iface[d];
+      if(frames[n].buf)
+      { n++; }
+    }
+  }
+  return n;
+}
+
+static int sr_shm_recv_batch(struct sr_instance *sr, struct sr_frame *frames, int max)
+{
+  struct sr_shm_state *s = sr->backend_state;
+  struct pollfd pfd;
+  unsigned int i;
+  int spin, n;
+  char buf[64];
+
+  /* the previous batch has been handled */
+  for(i = 0; i < s->lay.niface; i++)
+  {
+    if(s->taken[i])
+    { sr_shm_release(s->hdr, i, SR_SHM_TO_ROUTER, s->taken[i]); }
+    s->taken[i] = 0;
+  }
+  if(max > SR_BACKEND_BATCH)
+  { max = SR_BACKEND_BATCH; }
+
+  for(spin = 0; (n = sr_shm_gather(s, frames, max)) == 0 && spin < SR_SHM_SPIN; spin++);
+  if(n == 0)
+  {
+    /* going to sleep: the peer kicks us after publishing if it sees this */
+    __atomic_store_n(&(s->hdr->router_waiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if((n = sr_shm_gather(s, frames, max)) == 0)
+    {
+      pfd.fd = s->sock;
+      pfd.events = POLLIN;
+      if(poll(&pfd, 1, SR_SHM_POLL_MS) < 0 && errno != EINTR)
+      { return -1; }
+      if(pfd.revents & (POLLIN | POLLHUP))
+      {
+        ssize_t got = recv(s->sock, buf, sizeof(buf), 0);
+        if(got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+        {
+          fprintf(stderr, "shm backend: packet source went away\n");
+          return -1;
+        }
+      }
+      n = sr_shm_gather(s, frames, max);
+    }
+    __atomic_store_n(&(s->hdr->router_waiting), 0, __ATOMIC_RELAXED);
+  }
+  s->next = (s->next + 1) % s->lay.niface;
+  s->rx += n;
+  return n;
+}
+
+static int sr_shm_send_batch(struct sr_instance *sr, const struct sr_frame *frames, int n)
+{
+  struct sr_shm_state *s = sr->backend_state;
+  unsigned int queued[SR_SHM_IFACES], space[SR_SHM_IFACES];
+  unsigned int d, niface = s->lay.niface;
+  int i, ret = 0, kick = 0;
+
+  for(d = 0; d < niface; d++)
+  {
+    queued[d] = 0;
+    space[d] = sr_shm_space(s->hdr, d, SR_SHM_FROM_ROUTER);
+  }
+  for(i = 0; i < n; i++)
+  {
+    for(d = 0; d < niface && s->iface[d] != frames[i].iface; d++);
+    if(d == niface || queued[d] == space[d] || frames[i].len > SR_SHM_SLOT_SIZE)
+    {
+      s->tx_dropped++;
+      ret = -1;
+      continue;
+    }
+    memcpy(sr_shm_slot(s->hdr, &(s->lay), d, SR_SHM_FROM_ROUTER, queued[d]), frames[i].buf,
+           frames[i].len);
+    sr_shm_set(s->hdr, &(s->lay), d, SR_SHM_FROM_ROUTER, queued[d], frames[i].len);
+    queued[d]++;
+  }
+  for(d = 0; d < niface; d++)
+  {
+    if(queued[d] == 0)
+    { continue; }
+    sr_shm_publish(s->hdr, d, SR_SHM_FROM_ROUTER, queued[d]);
+    s->tx += queued[d];
+    kick = 1;
+  }
+  if(kick)
+  { sr_shm_kick(s->sock, &(s->hdr->peer_waiting)); }
+  return ret;
+}
+
+static void sr_shm_close(struct sr_instance *sr)
+{
+  struct sr_shm_state *s = sr->backend_state;
+
+  fprintf(stderr, "shm backend: %lu frames received, %lu sent, %lu dropped\n",
+          s->rx, s->tx, s->tx_dropped);
+  close(s->sock);
+  sr_shm_unmap(s->hdr, &(s->lay));
+  free(s);
+  sr->backend_state = NULL;
+}
+
+const struct sr_backend sr_shm_backend = {
+  "shm", 1, sr_shm_open, sr_shm_recv_batch, sr_shm_send_batch, sr_shm_close
+};
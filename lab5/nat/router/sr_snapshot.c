@@ -0,0 +1,279 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.c
+ *
+ * Description:
+ *
+ * Save/restore of NAT and ARP state across restarts, see sr_snapshot.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_snapshot.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_nat.h"
+
+/* growable buffer of mapping records, filled by sr_nat_walk */
+struct sr_snapshot_buf {
+  struct sr_snapshot_mapping *recs;
+  uint32_t n;
+  uint32_t cap;
+  time_t now;
+};
+
+static void sr_snapshot_add_mapping(struct sr_nat_mapping *mapping, void *arg)
+{
+  struct sr_snapshot_buf *buf = (struct sr_snapshot_buf *)arg;
+  struct sr_snapshot_mapping *rec;
+
+  if(buf->n == buf->cap)
+  {
+    struct sr_snapshot_mapping *grown;
+    uint32_t cap = buf->cap ? buf->cap * 2 : 1024;
+    grown = realloc(buf->recs, cap * sizeof(struct sr_snapshot_mapping));
+    if(!grown)
+    { return; } /* drop what does not fit rather than fail the save */
+    buf->recs = grown;
+    buf->cap = cap;
+  }
+
+  rec = &(buf->recs[buf->n++]);
+  memset(rec, 0, sizeof(*rec));
+  rec->ip_int = mapping->ip_int;
+  rec->ip_ext = mapping->ip_ext;
+  rec->aux_int = mapping->aux_int;
+  rec->aux_ext = mapping->aux_ext;
+  rec->type = (uint8_t)mapping->type;
+  rec->age = (buf->now > mapping->last_updated) ? (uint32_t)(buf->now - mapping->last_updated) : 0;
+}
+
+static int sr_snapshot_write_all(int fd, const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while(len > 0)
+  {
+    ssize_t ret = write(fd, p, len);
+    if(ret < 0)
+    {
+      if(errno == EINTR)
+      { continue; }
+      return -1;
+    }
+    p += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+int sr_snapshot_save(struct sr_instance *sr, struct sr_nat *nat, const char *path)
+{
+  struct sr_snapshot_hdr hdr;
+  struct sr_snapshot_buf maps;
+  struct sr_snapshot_arp arps[SR_ARPCACHE_SZ];
+  char tmp[4096];
+  int fd, i, ret = 0;
+
+  memset(&maps, 0, sizeof(maps));
+  maps.now = time(NULL);
+  if(nat)
+  { sr_nat_walk(nat, sr_snapshot_add_mapping, &maps); }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memset(arps, 0, sizeof(arps));
+  pthread_mutex_lock(&(sr->cache.lock));
+  for(i = 0; i < SR_ARPCACHE_SZ; i++)
+  {
+    struct sr_arpentry *entry = &(sr->cache.entries[i]);
+    if(!entry->valid)
+    { continue; }
+    memcpy(arps[hdr.n_arp].mac, entry->mac, 6);
+    arps[hdr.n_arp].ip = entry->ip;
+    arps[hdr.n_arp].age = (maps.now > entry->added) ? (uint32_t)(maps.now - entry->added) : 0;
+    hdr.n_arp++;
+  }
+  pthread_mutex_unlock(&(sr->cache.lock));
+
+  hdr.magic = SR_SNAPSHOT_MAGIC;
+  hdr.version = SR_SNAPSHOT_VERSION;
+  hdr.nat_shards = SR_NAT_SHARDS;
+  hdr.n_mappings = maps.n;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0)
+  {
+    perror("sr_snapshot_save: open");
+    free(maps.recs);
+    return -1;
+  }
+  if(sr_snapshot_write_all(fd, &hdr, sizeof(hdr)) != 0 ||
+     sr_snapshot_write_all(fd, maps.recs, maps.n * sizeof(struct sr_snapshot_mapping)) != 0 ||
+     sr_snapshot_write_all(fd, arps, hdr.n_arp * sizeof(struct sr_snapshot_arp)) != 0)
+  {
+    perror("sr_snapshot_save: write");
+    ret = -1;
+  }
+  close(fd);
+  free(maps.recs);
+
+  if(ret == 0 && rename(tmp, path) != 0)
+  {
+    perror("sr_snapshot_save: rename");
+    ret = -1;
+  }
+  if(ret != 0)
+  { unlink(tmp); }
+  else
+  { printf("Saved snapshot %s: %u NAT mappings, %u ARP entries\n", path, hdr.n_mappings, hdr.n_arp); }
+  return ret;
+}
+
+int sr_snapshot_load(struct sr_instance *sr, struct sr_nat *nat, const char *path)
+{
+  struct stat st;
+  const struct sr_snapshot_hdr *hdr;
+  const struct sr_snapshot_mapping *maps;
+  const struct sr_snapshot_arp *arps;
+  uint8_t *base;
+  time_t now = time(NULL);
+  uint32_t i;
+  int fd, restored = 0, skipped = 0;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+  { return (errno == ENOENT) ? 0 : -1; }
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct sr_snapshot_hdr))
+  {
+    fprintf(stderr, "sr_snapshot_load: %s is truncated\n", path);
+    close(fd);
+    return -1;
+  }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+  {
+    perror("sr_snapshot_load: mmap");
+    return -1;
+  }
+
+  hdr = (const struct sr_snapshot_hdr *)base;
+  if(hdr->magic != SR_SNAPSHOT_MAGIC || hdr->version != SR_SNAPSHOT_VERSION ||
+     st.st_size != (off_t)(sizeof(*hdr) + hdr->n_mappings * sizeof(struct sr_snapshot_mapping)
+                           + hdr->n_arp * sizeof(struct sr_snapshot_arp)))
+  {
+    fprintf(stderr, "sr_snapshot_load: %s is not a valid snapshot\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+  maps = (const struct sr_snapshot_mapping *)(base + sizeof(*hdr));
+  arps = (const struct sr_snapshot_arp *)(maps + hdr->n_mappings);
+
+  /* external ports are tied to the shard layout of the writer */
+  if(nat && hdr->nat_shards == SR_NAT_SHARDS)
+  {
+    for(i = 0; i < hdr->n_mappings; i++)
+    {
+      struct sr_nat_mapping mapping;
+      memset(&mapping, 0, sizeof(mapping));
+      mapping.type = (sr_nat_mapping_type)maps[i].type;
+      mapping.ip_int = maps[i].ip_int;
+      mapping.ip_ext = maps[i].ip_ext;
+      mapping.aux_int = maps[i].aux_int;
+      mapping.aux_ext = maps[i].aux_ext;
+      mapping.last_updated = now - maps[i].age;
+      if(sr_nat_restore_mapping(nat, &mapping) == 0)
+      { restored++; }
+      else
+      { skipped++; }
+    }
+  }
+  else if(nat && hdr->n_mappings > 0)
+  {
+    fprintf(stderr, "sr_snapshot_load: snapshot has %u NAT shards, expected %d; "
+            "NAT mappings not restored\n", hdr->nat_shards, SR_NAT_SHARDS);
+  }
+
+  pthread_mutex_lock(&(sr->cache.lock));
+  for(i = 0; i < hdr->n_arp; i++)
+  {
+    int slot;
+    if(arps[i].age > SR_ARPCACHE_TO)
+    { continue; }
+    for(slot = 0; slot < SR_ARPCACHE_SZ; slot++)
+    {
+      if(!sr->cache.entries[slot].valid)
+      { break; }
+    }
+    if(slot == SR_ARPCACHE_SZ)
+    { break; }
+    memcpy(sr->cache.entries[slot].mac, arps[i].mac, 6);
+    sr->cache.entries[slot].ip = arps[i].ip;
+    sr->cache.entries[slot].added = now - arps[i].age;
+    sr->cache.entries[slot].valid = 1;
+    restored++;
+  }
+  pthread_mutex_unlock(&(sr->cache.lock));
+
+  munmap(base, st.st_size);
+  printf("Loaded snapshot %s: %d records restored, %d skipped\n", path, restored, skipped);
+  return restored;
+}
+
+/*---------------------------------------------------------------------------
+ * Signal handling. Signals are blocked in every thread and consumed here with
+ * sigwait, so the save runs in normal thread context.
+ *---------------------------------------------------------------------------*/
+
+static struct sr_instance *snapshot_sr;
+static struct sr_nat *snapshot_nat;
+static const char *snapshot_path;
+static sigset_t snapshot_sigs;
+
+static void *sr_snapshot_thread(void *arg)
+{
+  int sig;
+  (void)arg;
+
+  while(1)
+  {
+    if(sigwait(&snapshot_sigs, &sig) != 0)
+    { continue; }
+    sr_snapshot_save(snapshot_sr, snapshot_nat, snapshot_path);
+    if(sig != SIGUSR1)
+    { exit(0); }
+  }
+  return NULL;
+}
+
+int sr_snapshot_block_signals(void)
+{
+  sigemptyset(&snapshot_sigs);
+  sigaddset(&snapshot_sigs, SIGUSR1);
+  sigaddset(&snapshot_sigs, SIGINT);
+  sigaddset(&snapshot_sigs, SIGTERM);
+  return pthread_sigmask(SIG_BLOCK, &snapshot_sigs, NULL);
+}
+
+int sr_snapshot_start(struct sr_instance *sr, struct sr_nat *nat, const char *path)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  snapshot_sr = sr;
+  snapshot_nat = nat;
+  snapshot_path = path;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  return pthread_create(&thread, &attr, sr_snapshot_thread, NULL);
+}
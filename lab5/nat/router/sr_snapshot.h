@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.h
+ *
+ * Description:
+ *
+ * Binary snapshot of the NAT mapping table and ARP cache so that sr can be
+ * restarted without dropping the sessions behind the NAT. The snapshot is
+ * written on SIGUSR1 and on shutdown (SIGINT/SIGTERM or session close), and
+ * mmap'd back at startup. Timestamps are stored as ages and rebased to the
+ * new process' clock on load, so downtime does not count as idle time.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SNAPSHOT_H
+#define SR_SNAPSHOT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_SNAPSHOT_MAGIC   0x5352534e /* "SRSN" */
+#define SR_SNAPSHOT_VERSION 2 /* 2: NAT shard hash changed */
+
+struct sr_instance;
+struct sr_nat;
+
+/* file header, followed by n_mappings mapping records then n_arp arp records */
+struct sr_snapshot_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t nat_shards;  /* SR_NAT_SHARDS of the writer, ports are shard bound */
+  uint32_t n_mappings;
+  uint32_t n_arp;
+} __attribute__ ((packed)) ;
+
+struct sr_snapshot_mapping {
+  uint32_t ip_int;
+  uint32_t ip_ext;
+  uint16_t aux_int;
+  uint16_t aux_ext;
+  uint8_t  type;
+  uint8_t  pad[3];
+  uint32_t age;         /* seconds since last_updated when saved */
+} __attribute__ ((packed)) ;
+
+struct sr_snapshot_arp {
+  uint8_t  mac[6];
+  uint16_t pad;
+  uint32_t ip;
+  uint32_t age;         /* seconds since the entry was added when saved */
+} __attribute__ ((packed)) ;
+
+/* Write a snapshot to path (via a temporary file and rename). 0 on success. */
+int sr_snapshot_save(struct sr_instance *sr, struct sr_nat *nat, const char *path);
+
+/* Load a snapshot from path if it exists. Returns the number of records
+   restored, or -1 if the file exists but is unusable. */
+int sr_snapshot_load(struct sr_instance *sr, struct sr_nat *nat, const char *path);
+
+/* Block SIGUSR1/SIGINT/SIGTERM in the calling thread. Call before any other
+   thread is created so that they all inherit the mask. */
+int sr_snapshot_block_signals(void);
+
+/* Start a thread that saves a snapshot to path on each of the signals above,
+   exiting the process after SIGINT/SIGTERM. sr and nat must be initialized. */
+int sr_snapshot_start(struct sr_instance *sr, struct sr_nat *nat, const char *path);
+
+#endif /* -- SR_SNAPSHOT_H -- */
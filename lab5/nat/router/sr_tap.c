@@ -0,0 +1,211 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tap.c
+ *
+ * Description:
+ *
+ * Linux TAP device backend. -b tap[:prefix] creates one TAP device per
+ * configured interface, named prefix followed by the interface name ("sr-"
+ * if no prefix is given, so eth1 becomes sr-eth1), and brings it up. The
+ * kernel side of each device can then be moved into a network namespace or
+ * bridged, and ordinary Linux hosts talk to the router through it.
+ *
+ * Each receive batch polls every device once and then reads each readable
+ * one until it runs dry or the batch is full, starting with a different
+ * device every time so a busy one cannot starve the others.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_bufpool.h"
+#include "sr_backend.h"
+
+#define SR_TAP_MAX     16   /* interfaces */
+#define SR_TAP_POLL_MS 100  /* recv_batch returns empty handed after this */
+
+struct sr_tap {
+  int n;
+  int fd[SR_TAP_MAX];
+  struct sr_if *iface[SR_TAP_MAX];
+  int next;                         /* device to read first */
+  uint8_t *last[SR_BACKEND_BATCH];  /* handed out by the last recv_batch */
+  int nlast;
+  unsigned long rx, tx, tx_dropped;
+};
+
+/* Create the TAP device called name and bring it up. Returns its fd. */
+static int sr_tap_create(const char *name)
+{
+  struct ifreq ifr;
+  int fd, sock;
+
+  if((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+  {
+    perror("tap backend: /dev/net/tun");
+    return -1;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  if(ioctl(fd, TUNSETIFF, &ifr) < 0)
+  {
+    fprintf(stderr, "tap backend: cannot create %s: %s\n", name, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  /* not fatal, the device can still be brought up by hand */
+  if((sock = socket(AF_INET, SOCK_DGRAM, 0)) >= 0)
+  {
+    if(ioctl(sock, SIOCGIFFLAGS, &ifr) == 0)
+    {
+      ifr.ifr_flags |= IFF_UP;
+      if(ioctl(sock, SIOCSIFFLAGS, &ifr) < 0)
+      { fprintf(stderr, "tap backend: cannot bring up %s: %s\n", name, strerror(errno)); }
+    }
+    close(sock);
+  }
+  return fd;
+}
+
+static int sr_tap_open(struct sr_instance *sr, const char *arg)
+{
+  struct sr_tap *tap;
+  struct sr_if *iface;
+  const char *prefix = (*arg != '\0') ? arg : "sr-";
+  char name[IFNAMSIZ];
+
+  if((tap = calloc(1, sizeof(struct sr_tap))) == NULL)
+  { return -1; }
+  sr->backend_state = tap;
+  for(iface = sr->if_list; iface; iface = iface->next)
+  {
+    if(tap->n == SR_TAP_MAX)
+    {
+      fprintf(stderr, "tap backend: more than %d interfaces\n", SR_TAP_MAX);
+      break;
+    }
+    if(strlen(prefix) + strlen(iface->name) >= IFNAMSIZ)
+    {
+      fprintf(stderr, "tap backend: device name %s%s too long\n", prefix, iface->name);
+      break;
+    }
+    snprintf(name, sizeof(name), "%s%s", prefix, iface->name);
+    if((tap->fd[tap->n] = sr_tap_create(name)) < 0)
+    { break; }
+    tap->iface[tap->n++] = iface;
+    Debug("tap backend: %s on %s\n", iface->name, name);
+  }
+  if(iface)
+  {
+    while(tap->n > 0)
+    { close(tap->fd[--tap->n]); }
+    free(tap);
+    sr->backend_state = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+static int sr_tap_recv_batch(struct sr_instance *sr, struct sr_frame *frames, int max)
+{
+  struct sr_tap *tap = sr->backend_state;
+  struct pollfd pfd[SR_TAP_MAX];
+  uint8_t *buf = NULL;
+  int i, n = 0;
+
+  /* the previous batch has been handled */
+  for(i = 0; i < tap->nlast; i++)
+  { sr_buf_free(tap->last[i]); }
+  tap->nlast = 0;
+
+  for(i = 0; i < tap->n; i++)
+  {
+    pfd[i].fd = tap->fd[i];
+    pfd[i].events = POLLIN;
+    pfd[i].revents = 0;
+  }
+  if(poll(pfd, tap->n, SR_TAP_POLL_MS) < 0)
+  { return (errno == EINTR) ? 0 : -1; }
+
+  if(max > SR_BACKEND_BATCH)
+  { max = SR_BACKEND_BATCH; }
+  for(i = 0; i < tap->n && n < max; i++)
+  {
+    int d = (tap->next + i) % tap->n;
+    ssize_t len;
+
+    if(!(pfd[d].revents & POLLIN))
+    { continue; }
+    while(n < max)
+    {
+      if(!buf && (buf = sr_buf_alloc()) == NULL && (buf = malloc(SR_BUFPOOL_SLOT)) == NULL)
+      { break; }
+      if((len = read(tap->fd[d], buf, SR_BUFPOOL_SLOT)) <= 0)
+      { break; }
+      frames[n].buf = buf;
+      frames[n].len = len;
+      frames[n].iface = tap->iface[d];
+      tap->last[n++] = buf;
+      buf = NULL;
+    }
+  }
+  if(buf)
+  { sr_buf_free(buf); }
+  if(tap->n > 0)
+  { tap->next = (tap->next + 1) % tap->n; }
+  tap->nlast = n;
+  tap->rx += n;
+  return n;
+}
+
+static int sr_tap_send_batch(struct sr_instance *sr, const struct sr_frame *frames, int n)
+{
+  struct sr_tap *tap = sr->backend_state;
+  int i, d, ret = 0;
+
+  for(i = 0; i < n; i++)
+  {
+    for(d = 0; d < tap->n && tap->iface[d] != frames[i].iface; d++);
+    /* a full device queue drops the frame, as a real link would */
+    if(d == tap->n || write(tap->fd[d], frames[i].buf, frames[i].len) != (ssize_t)frames[i].len)
+    {
+      tap->tx_dropped++;
+      ret = -1;
+      continue;
+    }
+    tap->tx++;
+  }
+  return ret;
+}
+
+static void sr_tap_close(struct sr_instance *sr)
+{
+  struct sr_tap *tap = sr->backend_state;
+  int i;
+
+  for(i = 0; i < tap->nlast; i++)
+  { sr_buf_free(tap->last[i]); }
+  for(i = 0; i < tap->n; i++)
+  { close(tap->fd[i]); }
+  fprintf(stderr, "tap backend: %lu frames received, %lu sent, %lu dropped\n",
+          tap->rx, tap->tx, tap->tx_dropped);
+  free(tap);
+  sr->backend_state = NULL;
+}
+
+const struct sr_backend sr_tap_backend = {
+  "tap", 1, sr_tap_open, sr_tap_recv_batch, sr_tap_send_batch, sr_tap_close
+};
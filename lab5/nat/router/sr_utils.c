@@ -19,6 +19,23 @@ uint16_t cksum (const void *_data, int len) {
   return sum ? sum : 0xffff;
 }
 
+/* HC' = ~(~HC + ~m + m'), RFC 1624 eqn. 3. One's complement addition does
+   not care about byte order, so the raw network-order words are used as-is. */
+uint16_t cksum_adjust16(uint16_t sum, uint16_t old_val, uint16_t new_val) {
+  uint32_t acc = (uint16_t)~sum;
+
+  acc += (uint16_t)~old_val;
+  acc += new_val;
+  acc = (acc >> 16) + (acc & 0xffff);
+  acc = (acc >> 16) + (acc & 0xffff);
+  return (uint16_t)~acc;
+}
+
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old_val, uint32_t new_val) {
+  sum = cksum_adjust16(sum, (uint16_t)(old_val >> 16), (uint16_t)(new_val >> 16));
+  return cksum_adjust16(sum, (uint16_t)(old_val & 0xffff), (uint16_t)(new_val & 0xffff));
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
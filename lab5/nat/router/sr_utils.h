@@ -30,6 +30,11 @@
 
 uint16_t cksum(const void *_data, int len);
 
+/* Incrementally patch a checksum after a field changes from old_val to
+   new_val (RFC 1624). Values are taken as they appear in the packet. */
+uint16_t cksum_adjust16(uint16_t sum, uint16_t old_val, uint16_t new_val);
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old_val, uint32_t new_val);
+
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
 
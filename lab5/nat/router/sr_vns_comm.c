@@ -32,6 +32,7 @@
 #include <errno.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
@@ -41,15 +42,14 @@
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_nat.h"
+#include "sr_bufpool.h"
+#include "sr_backend.h"
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
-int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borrowed */, int expected_cmd);
+#define SR_VNS_TX_IOV 64 /* frames per writev */
+
+int sr_read_from_server_expect(struct sr_instance* sr, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -73,7 +73,7 @@ static void sr_session_closed_help()
  *  something other than zero on error
  *
  *---------------------------------------------------------------------------*/
-int sr_connect_to_server(struct sr_instance* sr,struct sr_nat *nat,unsigned short port,
+int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
                          char* server)
 {
     struct hostent *hp;
@@ -122,8 +122,8 @@ int sr_connect_to_server(struct sr_instance* sr,struct sr_nat *nat,unsigned shor
     }
 
     /* wait for authentication to be completed (server sends the first message) */
-    if(sr_read_from_server_expect(sr,nat, VNS_AUTH_REQUEST)!= 1 ||
-       sr_read_from_server_expect(sr,nat, VNS_AUTH_STATUS) != 1)
+    if(sr_read_from_server_expect(sr, VNS_AUTH_REQUEST)!= 1 ||
+       sr_read_from_server_expect(sr, VNS_AUTH_STATUS) != 1)
         return -1; /* failed to receive expected message */
 
     if(strlen(sr->template) > 0) {
@@ -156,9 +156,15 @@ int sr_connect_to_server(struct sr_instance* sr,struct sr_nat *nat,unsigned shor
     }
 
     if(strlen(sr->template) > 0)
-        if(sr_read_from_server_expect(sr,nat, VNS_RTABLE) != 1)
+        if(sr_read_from_server_expect(sr, VNS_RTABLE) != 1)
             return -1; /* needed to get the rtable */
 
+    /* the interfaces, so the caller can set up everything that names them
+       before the first packet is handled */
+    while(sr->if_list == 0)
+        if(sr_read_from_server_expect(sr, 0) != 1)
+            return -1;
+
     return 0;
 } /* -- sr_connect_to_server -- */
 
@@ -319,92 +325,181 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
- * Scope: global
+ * Method: sr_rx_fill(..)
+ * Scope: Local
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Read as much as the socket has into the receive chunk. A command starting
+ * at rx_head must always fit in what is left of the chunk, so when less than
+ * one maximum length command of space remains the partial command is carried
+ * over to a fresh chunk. The old chunk lives on for as long as anything
+ * holds a frame in it.
+ *
+ * Returns the number of bytes read, or -1 on error or end of stream.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr,struct sr_nat *nat /* borrowed */)
+static int sr_rx_fill(struct sr_instance* sr)
 {
-    return sr_read_from_server_expect(sr,nat, 0);
-}
+    int ret;
 
-int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    if(!sr->rx_buf || SR_BUFPOOL_CHUNK - sr->rx_head < SR_BUFPOOL_SLOT)
+    {
+        uint8_t *chunk = sr_buf_alloc_chunk();
+        if(!chunk && (chunk = malloc(SR_BUFPOOL_CHUNK)) == 0)
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        if(sr->rx_buf)
+        {
+            memcpy(chunk, sr->rx_buf + sr->rx_head, sr->rx_tail - sr->rx_head);
+            sr_buf_free(sr->rx_buf);
+        }
+        sr->rx_buf = chunk;
+        sr->rx_tail -= sr->rx_head;
+        sr->rx_head = 0;
+    }
 
-    /* REQUIRES */
-    assert(sr);
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        errno = 0; /* -- hacky glibc workaround -- */
+        ret = recv(sr->sockfd, sr->rx_buf + sr->rx_tail,
+                   SR_BUFPOOL_CHUNK - sr->rx_tail, 0);
+    } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+    if(ret == -1)
+    {
+        perror("recv(..):sr_client.c::sr_read_from_server");
+        return -1;
+    }
+    if(ret == 0)
+    {
+        fprintf(stderr,"Error: connection to server closed\n");
+        return -1;
+    }
+    sr->rx_tail += ret;
+    return ret;
+} /* -- sr_rx_fill -- */
 
-    bytes_read = 0;
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_next(..)
+ * Scope: Local
+ *
+ * Frame the next command in the receive chunk. Returns 1 and sets *buf and
+ * *len if a complete command is buffered, 0 if more data is needed and -1 if
+ * the stream is corrupt.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
+static int sr_rx_next(struct sr_instance* sr, uint8_t **buf, int *len)
+{
+    uint32_t cmd_len;
 
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+    if(sr->rx_tail - sr->rx_head < 4)
+    { return 0; }
+    memcpy(&cmd_len, sr->rx_buf + sr->rx_head, 4);
+    cmd_len = ntohl(cmd_len);
 
+    if ( cmd_len > SR_BUFPOOL_SLOT || cmd_len < sizeof(c_base) )
+    {
+        fprintf(stderr,"Error: command length to large %u\n",cmd_len);
+        return -1;
     }
+    if(sr->rx_tail - sr->rx_head < cmd_len)
+    { return 0; }
+
+    *buf = sr->rx_buf + sr->rx_head;
+    *len = cmd_len;
+    sr->rx_head += cmd_len;
+    return 1;
+} /* -- sr_rx_next -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: Local
+ *
+ * Wait for the next command and handle it. Used during the handshake, when
+ * only expected_cmd (or VNSCLOSE) may arrive.
+ *
+ *---------------------------------------------------------------------------*/
 
-    len = ntohl(len);
+int sr_read_from_server_expect(struct sr_instance* sr, int expected_cmd)
+{
+    uint8_t *buf = 0;
+    int len = 0;
+    int ret;
 
-    if ( len > 10000 || len < 0 )
+    /* REQUIRES */
+    assert(sr);
+
+    while((ret = sr_rx_next(sr, &buf, &len)) == 0)
+    {
+        if(sr_rx_fill(sr) < 0)
+        { return -1; }
+    }
+    if(ret < 0)
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
         close(sr->sockfd);
         return -1;
     }
+    return sr_handle_command(sr, buf, len, expected_cmd, NULL);
+}/* -- sr_read_from_server_expect -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_recv_batch(..)
+ * Scope: Local
+ *
+ * Houses main while loop for communicating with the virtual router server.
+ * Waits for at least one command, then handles every complete command that
+ * arrived with it, so one recv serves a whole batch of packets. Packets are
+ * returned in place in the receive chunk; other commands are acted on here.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_recv_batch(struct sr_instance* sr, struct sr_frame* frames, int max)
+{
+    uint8_t *buf = 0;
+    int len = 0;
+    int ret, n = 0;
 
-    if((buf = malloc(len)) == 0)
+    while((ret = sr_rx_next(sr, &buf, &len)) == 0)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        if(sr_rx_fill(sr) < 0)
+        { return -1; }
+    }
+    if(ret < 0)
+    {
+        close(sr->sockfd);
         return -1;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    do
+    {
+        frames[n].buf = 0;
+        if(sr_handle_command(sr, buf, len, 0, &(frames[n])) != 1)
+        { return -1; }
+        if(frames[n].buf)
+        { n++; }
+    } while(n < max && sr_rx_next(sr, &buf, &len) == 1);
 
-    bytes_read = 0;
+    return n;
+}/* -- sr_vns_recv_batch -- */
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: Global
+ *
+ * Act on one command, which stays in the receive chunk. A packet is
+ * returned in *frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_handle_command(struct sr_instance* sr, uint8_t *buf, int len,
+                      int expected_cmd, struct sr_frame *frame)
+{
+    int command;
+    c_packet_ethernet_header* sr_pkt = 0;
+    int ret;
 
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
@@ -425,25 +520,19 @@ int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borr
 
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+            if(!frame || len < (int)sizeof(c_packet_ethernet_header))
             { break; }
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,nat,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+            /* -- hand back to sr_backend_poll, which passes it on to the router -- */
+            frame->iface = sr_get_interface(sr, sr_pkt->mInterfaceName);
+            if(!frame->iface)
+            {
+                Debug("Packet for unknown interface %.16s\n", sr_pkt->mInterfaceName);
+                break;
+            }
+            frame->buf = buf + sizeof(c_packet_header);
+            frame->len = len - sizeof(c_packet_ethernet_header) +
+                    sizeof(struct sr_ethernet_hdr);
 
             break;
 
@@ -453,9 +542,6 @@ int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borr
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -469,7 +555,9 @@ int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borr
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            if(sr_verify_routing_table(sr) != 0)
+            /* during the handshake the routing table is not loaded yet,
+               sr_main checks it once it is */
+            if(sr->routing_table && sr_verify_routing_table(sr) != 0)
             {
                 fprintf(stderr,"Routing table not consistent with hardware\n");
                 return -1;
@@ -501,167 +589,108 @@ int sr_read_from_server_expect(struct sr_instance* sr,struct sr_nat *nat /* borr
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_command -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_ether_addrs_match_interface(..)
+ * Method: sr_vns_send_batch(..)
  * Scope: Local
  *
- * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Write frames to the server, each behind a VNSPACKET header, with one
+ * writev per SR_VNS_TX_IOV frames (more if the socket takes a partial
+ * write).
  *
- *----------------------------------------------------------------------------*/
+ *---------------------------------------------------------------------------*/
 
-static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+static int sr_vns_send_batch(struct sr_instance* sr, const struct sr_frame* frames, int n)
 {
-    struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
+    c_packet_header hdr[SR_VNS_TX_IOV];
+    struct iovec iovs[2 * SR_VNS_TX_IOV];
+    int done, i;
 
-    /* -- REQUIRES -- */
-    assert(sr);
-    assert(buf);
-    assert(name);
-
-    ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
+    for(done = 0; done < n; done += SR_VNS_TX_IOV)
+    {
+        struct iovec *iov = iovs;
+        int count = (n - done < SR_VNS_TX_IOV) ? n - done : SR_VNS_TX_IOV;
+        int iovcnt = 2 * count;
 
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
+        for(i = 0; i < count; i++)
+        {
+            const struct sr_frame *frame = &(frames[done + i]);
+            hdr[i].mLen  = htonl(frame->len + sizeof(c_packet_header));
+            hdr[i].mType = htonl(VNSPACKET);
+            strncpy(hdr[i].mInterfaceName,frame->iface->name,16);
+            iovs[2 * i].iov_base = &(hdr[i]);
+            iovs[2 * i].iov_len = sizeof(c_packet_header);
+            iovs[2 * i + 1].iov_base = frame->buf;
+            iovs[2 * i + 1].iov_len = frame->len;
+        }
 
-    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
-        return 0;
+        while(iovcnt > 0)
+        {
+            ssize_t sent = writev(sr->sockfd, iov, iovcnt);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                { continue; }
+                fprintf(stderr, "Error writing packet\n");
+                return -1;
+            }
+            /* skip what went out, resuming a partial write mid iovec */
+            while(iovcnt > 0 && (size_t)sent >= iov->iov_len)
+            {
+                sent -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if(iovcnt > 0)
+            {
+                iov->iov_base = (uint8_t *)iov->iov_base + sent;
+                iov->iov_len -= sent;
+            }
+        }
     }
-
-    /* TODO */
-    /* Check destination, hardware address.  If it is private (i.e. destined
-     * to a virtual interface) ensure it is going to the correct topology
-     * Note: This check should really be done server side ...
-     */
-
-    return 1;
-
-} /* -- sr_ether_addrs_match_interface -- */
+    return 0;
+} /* -- sr_vns_send_batch -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
- * Scope: Global
+ * Method: sr_vns_open(..)
+ * Scope: Local
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * arg is server:port.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static int sr_vns_open(struct sr_instance* sr, const char* arg)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    char server[256];
+    const char *colon = strrchr(arg, ':');
+    size_t n = colon ? (size_t)(colon - arg) : strlen(arg);
 
-    /* REQUIRES */
-    assert(sr);
-    assert(buf);
-    assert(iface);
-
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
+    if(!colon || n == 0 || n >= sizeof(server))
+    {
+        fprintf(stderr, "vns backend needs server:port, got \"%s\"\n", arg);
         return -1;
     }
+    memcpy(server, arg, n);
+    server[n] = 0;
+    return sr_connect_to_server(sr, atoi(colon + 1), server);
+} /* -- sr_vns_open -- */
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
-
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
-
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
+static void sr_vns_close(struct sr_instance* sr)
+{
+    if(sr->sockfd >= 0)
+    {
+        close(sr->sockfd);
+        sr->sockfd = -1;
     }
-
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    if(sr->rx_buf)
+    {
+        sr_buf_free(sr->rx_buf);
+        sr->rx_buf = 0;
     }
+}
 
-    free(sr_pkt);
-
-    return 0;
-} /* -- sr_send_packet -- */
-
-/*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
- * Scope: Local
- *
- *---------------------------------------------------------------------------*/
-
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
-{
-    struct pcap_pkthdr h;
-    int size;
-
-    /* REQUIRES */
-    assert(sr);
-
-    if(!sr->logfile)
-    {return; }
-
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
-
-/*-----------------------------------------------------------------------------
- * Method: sr_arp_req_not_for_us()
- * Scope: Local
- *
- *---------------------------------------------------------------------------*/
-
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
-{
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
-    struct sr_arp_hdr*       a_hdr = 0;
-
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
-    { return 0; }
-
-    assert(iface);
-
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
-
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
-
-    return 0;
-} /* -- sr_arp_req_not_for_us -- */
+const struct sr_backend sr_vns_backend = {
+    "vns", 0, sr_vns_open, sr_vns_recv_batch, sr_vns_send_batch, sr_vns_close
+};
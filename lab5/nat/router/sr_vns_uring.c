@@ -0,0 +1,652 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vns_uring.c
+ *
+ * Description:
+ *
+ * VNS backend doing its socket I/O through io_uring, selected with
+ * -b vns-uring[:server:port]. The session is set up exactly as by the vns
+ * backend; after that:
+ *
+ * Receive: one multishot recv stays posted on the socket, drawing from a
+ * ring of SR_URING_NBUF buffers registered with the kernel. Every
+ * completion is one more piece of the command stream, in order, in its own
+ * buffer; commands are framed in place and the rare one split across two
+ * buffers is copied into a slot. A buffer is handed back to the kernel on
+ * the recv_batch after its last command was handled.
+ *
+ * Transmit: frames are copied behind their VNSPACKET header into one half
+ * of a registered staging buffer. One write covers the whole half, and
+ * while it is in flight the other half fills up. Writes queued by the
+ * thread that receives are submitted by its next wait for input, so a busy
+ * router makes one io_uring_enter per batch, whatever the packet rate.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_bufpool.h"
+#include "sr_backend.h"
+#include "vnscommand.h"
+
+#define SR_URING_ENTRIES  16                /* submission queue, at most a recv and a write */
+#define SR_URING_NBUF     8                 /* receive buffers, power of two */
+#define SR_URING_TX_HALF  (128 * 1024)      /* bytes per transmit half */
+#define SR_URING_WAIT_NS  1000000           /* wait for transmit room at most this long */
+
+#define SR_URING_RECV  1 /* user_data of the recv */
+#define SR_URING_WRITE 2 /* user_data of a write */
+#define SR_URING_WAKE  3 /* user_data of a nop that wakes the receiving thread */
+
+/* data received but not yet framed */
+struct sr_uring_seg {
+  uint8_t *p;
+  unsigned int len;
+  int bid; /* buffer it is in, SR_URING_NBUF for the handshake leftover */
+};
+
+struct sr_uring {
+  int fd;
+  void *ring_map;
+  size_t ring_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned int sq_pending; /* sqes queued but not yet entered */
+
+  /* receive */
+  struct io_uring_buf_ring *br;
+  uint16_t br_tail;
+  uint8_t *buf[SR_URING_NBUF + 1];
+  int armed;                              /* multishot recv posted */
+  struct sr_uring_seg seg[SR_URING_NBUF + 1];
+  unsigned int seg_head, nseg;            /* queue of complete recvs */
+  uint8_t *carry;                         /* command split across buffers */
+  unsigned int carry_len;
+  uint8_t *release[SR_BACKEND_BATCH + SR_URING_NBUF + 1]; /* after the batch */
+  int nrelease;
+  int repost[SR_URING_NBUF];              /* buffers to hand back after the batch */
+  int nrepost;
+  int eof;
+  pthread_t rx_thread;
+
+  /* transmit */
+  uint8_t *tx;                            /* two halves */
+  unsigned int tx_len[2];
+  int tx_out;                             /* half being written, -1 if none */
+  unsigned int tx_off;                    /* how much of it went out */
+  int tx_error;
+
+  pthread_mutex_t lock;
+};
+
+static int sr_uring_enter(struct sr_uring *u, unsigned int submit, unsigned int wait,
+  long timeout_ns)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+  if(timeout_ns <= 0)
+  { return syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, NULL, 0); }
+  memset(&arg, 0, sizeof(arg));
+  ts.tv_sec = 0;
+  ts.tv_nsec = timeout_ns;
+  arg.ts = (uint64_t)(uintptr_t)&ts;
+  return syscall(__NR_io_uring_enter, u->fd, submit, wait, flags | IORING_ENTER_EXT_ARG,
+                 &arg, sizeof(arg));
+}
+
+/* A zeroed sqe at the tail of the submission queue. Called locked. */
+static struct io_uring_sqe *sr_uring_sqe(struct sr_uring *u)
+{
+  unsigned int tail = *(u->sq_tail);
+  unsigned int idx = tail & *(u->sq_mask);
+  struct io_uring_sqe *sqe = &(u->sqes[idx]);
+
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[idx] = idx;
+  return sqe;
+}
+
+static void sr_uring_push(struct sr_uring *u)
+{
+  __atomic_store_n(u->sq_tail, *(u->sq_tail) + 1, __ATOMIC_RELEASE);
+  u->sq_pending++;
+}
+
+static void sr_uring_arm(struct sr_instance *sr, struct sr_uring *u)
+{
+  struct io_uring_sqe *sqe = sr_uring_sqe(u);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sr->sockfd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = SR_URING_RECV;
+  sr_uring_push(u);
+  u->armed = 1;
+}
+
+static void sr_uring_write(struct sr_instance *sr, struct sr_uring *u)
+{
+  struct io_uring_sqe *sqe = sr_uring_sqe(u);
+
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = sr->sockfd;
+  sqe->addr = (uint64_t)(uintptr_t)(u->tx + u->tx_out * SR_URING_TX_HALF + u->tx_off);
+  sqe->len = u->tx_len[u->tx_out] - u->tx_off;
+  sqe->buf_index = 0;
+  sqe->user_data = SR_URING_WRITE;
+  sr_uring_push(u);
+}
+
+/* Start writing the half that has been filling, if nothing is in flight. */
+static void sr_uring_tx_start(struct sr_instance *sr, struct sr_uring *u, int fill)
+{
+  if(u->tx_out >= 0 || u->tx_len[fill] == 0)
+  { return; }
+  u->tx_out = fill;
+  u->tx_off = 0;
+  sr_uring_write(sr, u);
+}
+
+/* Hand a buffer (back) to the kernel. */
+static void sr_uring_post(struct sr_uring *u, int bid)
+{
+  struct io_uring_buf *b = &(u->br->bufs[u->br_tail & (SR_URING_NBUF - 1)]);
+
+  b->addr = (uint64_t)(uintptr_t)u->buf[bid];
+  b->len = SR_BUFPOOL_CHUNK;
+  b->bid = bid;
+  u->br_tail++;
+  __atomic_store_n(&(u->br->tail), u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* Take every completion off the queue. Called locked. Returns the number
+   of recv completions. */
+static int sr_uring_reap(struct sr_instance *sr, struct sr_uring *u)
+{
+  unsigned int head = *(u->cq_head);
+  int nrecv = 0;
+
+  while(head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    struct io_uring_cqe *cqe = &(u->cqes[head & *(u->cq_mask)]);
+    head++;
+
+    if(cqe->user_data == SR_URING_RECV)
+    {
+      nrecv++;
+      if(!(cqe->flags & IORING_CQE_F_MORE))
+      { u->armed = 0; }
+      if(cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+      {
+        struct sr_uring_seg *s = &(u->seg[(u->seg_head + u->nseg++) % (SR_URING_NBUF + 1)]);
+        s->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        s->p = u->buf[s->bid];
+        s->len = cqe->res;
+      }
+      else if(cqe->res == 0)
+      {
+        fprintf(stderr,"Error: connection to server closed\n");
+        u->eof = 1;
+      }
+      else if(cqe->res != -ENOBUFS)
+      {
+        /* out of buffers just ends the multishot until they come back */
+        fprintf(stderr, "io_uring recv: %s%s\n", strerror(-cqe->res),
+                (cqe->res == -EINVAL) ? " (multishot recv needs Linux 6.0)" : "");
+        u->eof = 1;
+      }
+    }
+    else if(cqe->user_data == SR_URING_WRITE)
+    {
+      if(cqe->res < 0)
+      {
+        fprintf(stderr, "Error writing packet: %s\n", strerror(-cqe->res));
+        u->tx_error = 1;
+        u->tx_len[0] = u->tx_len[1] = 0;
+        u->tx_out = -1;
+      }
+      else if((u->tx_off += cqe->res) < u->tx_len[u->tx_out])
+      { sr_uring_write(sr, u); }
+      else
+      {
+        int fill = !u->tx_out;
+        u->tx_len[u->tx_out] = 0;
+        u->tx_out = -1;
+        sr_uring_tx_start(sr, u, fill);
+      }
+    }
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  return nrecv;
+}
+
+/* Queue a nop. Its completion ends the receiving thread's wait when
+   another thread has reaped what it was waiting for. Called locked. */
+static void sr_uring_wake(struct sr_uring *u)
+{
+  struct io_uring_sqe *sqe = sr_uring_sqe(u);
+
+  sqe->opcode = IORING_OP_NOP;
+  sqe->user_data = SR_URING_WAKE;
+  sr_uring_push(u);
+}
+
+static int sr_uring_setup(struct sr_uring *u)
+{
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  struct iovec iov;
+  uint8_t *ring;
+
+  memset(&p, 0, sizeof(p));
+  if((u->fd = syscall(__NR_io_uring_setup, SR_URING_ENTRIES, &p)) < 0)
+  {
+    perror("io_uring_setup");
+    return -1;
+  }
+  if(!(p.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    fprintf(stderr, "io_uring: kernel too old\n");
+    return -1;
+  }
+  u->ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  if(u->ring_len < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+  { u->ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe); }
+  u->ring_map = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 u->fd, IORING_OFF_SQES);
+  if(u->ring_map == MAP_FAILED || u->sqes == MAP_FAILED)
+  {
+    perror("io_uring mmap");
+    return -1;
+  }
+  ring = u->ring_map;
+  u->sq_head = (unsigned int *)(ring + p.sq_off.head);
+  u->sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+  u->sq_mask = (unsigned int *)(ring + p.sq_off.ring_mask);
+  u->sq_array = (unsigned int *)(ring + p.sq_off.array);
+  u->cq_head = (unsigned int *)(ring + p.cq_off.head);
+  u->cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+  u->cq_mask = (unsigned int *)(ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+  /* receive buffer ring */
+  u->br = mmap(NULL, SR_URING_NBUF * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(u->br == MAP_FAILED)
+  {
+    u->br = NULL;
+    return -1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+  reg.ring_entries = SR_URING_NBUF;
+  reg.bgid = 0;
+  if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    perror("io_uring buffer ring (needs Linux 5.19)");
+    return -1;
+  }
+
+  /* transmit staging buffer */
+  if((u->tx = malloc(2 * SR_URING_TX_HALF)) == NULL)
+  { return -1; }
+  iov.iov_base = u->tx;
+  iov.iov_len = 2 * SR_URING_TX_HALF;
+  if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+  {
+    perror("io_uring register buffers");
+    return -1;
+  }
+  return 0;
+}
+
+static void sr_uring_free(struct sr_uring *u)
+{
+  int i;
+
+  if(u->fd >= 0)
+  { close(u->fd); }
+  if(u->ring_map && u->ring_map != MAP_FAILED)
+  { munmap(u->ring_map, u->ring_len); }
+  if(u->sqes && u->sqes != MAP_FAILED)
+  { munmap(u->sqes, u->sqes_len); }
+  if(u->br)
+  { munmap(u->br, SR_URING_NBUF * sizeof(struct io_uring_buf)); }
+  for(i = 0; i <= SR_URING_NBUF; i++)
+  {
+    if(u->buf[i])
+    { sr_buf_free(u->buf[i]); }
+  }
+  for(i = 0; i < u->nrelease; i++)
+  { sr_buf_free(u->release[i]); }
+  if(u->carry)
+  { sr_buf_free(u->carry); }
+  free(u->tx);
+  pthread_mutex_destroy(&(u->lock));
+  free(u);
+}
+
+static void sr_vns_uring_close(struct sr_instance *sr);
+
+static int sr_vns_uring_open(struct sr_instance *sr, const char *arg)
+{
+  struct sr_uring *u;
+  int i;
+
+  /* the handshake is done with plain recv and writev */
+  if(sr_vns_backend.open(sr, arg) != 0)
+  { return -1; }
+
+  if((u = calloc(1, sizeof(struct sr_uring))) == NULL)
+  { return -1; }
+  u->fd = -1;
+  u->tx_out = -1;
+  pthread_mutex_init(&(u->lock), NULL);
+  sr->backend_state = u;
+  if(sr_uring_setup(u) != 0)
+  {
+    sr_vns_uring_close(sr);
+    return -1;
+  }
+  for(i = 0; i < SR_URING_NBUF; i++)
+  {
+    if((u->buf[i] = sr_buf_alloc_chunk()) == NULL && (u->buf[i] = malloc(SR_BUFPOOL_CHUNK)) == NULL)
+    {
+      sr_vns_uring_close(sr);
+      return -1;
+    }
+    sr_uring_post(u, i);
+  }
+
+  /* whatever the handshake reader got past its last command comes first */
+  if(sr->rx_buf && sr->rx_tail > sr->rx_head)
+  {
+    struct sr_uring_seg *s = &(u->seg[u->nseg++]);
+    u->buf[SR_URING_NBUF] = sr->rx_buf;
+    s->p = sr->rx_buf + sr->rx_head;
+    s->len = sr->rx_tail - sr->rx_head;
+    s->bid = SR_URING_NBUF;
+  }
+  else if(sr->rx_buf)
+  { sr_buf_free(sr->rx_buf); }
+  sr->rx_buf = 0;
+  sr->rx_head = sr->rx_tail = 0;
+
+  sr_uring_arm(sr, u);
+  return 0;
+}
+
+/* Free what the last batch was using and give the kernel fresh buffers
+   for the ones retired. Called locked, when no frame points into them. */
+static void sr_uring_recycle(struct sr_uring *u)
+{
+  int i;
+
+  for(i = 0; i < u->nrelease; i++)
+  { sr_buf_free(u->release[i]); }
+  u->nrelease = 0;
+  for(i = 0; i < u->nrepost; i++)
+  {
+    int bid = u->repost[i];
+    if((u->buf[bid] = sr_buf_alloc_chunk()) == NULL && (u->buf[bid] = malloc(SR_BUFPOOL_CHUNK)) == NULL)
+    { continue; }
+    sr_uring_post(u, bid);
+  }
+  u->nrepost = 0;
+}
+
+/* Done with the oldest segment: its buffer goes back after this batch. */
+static void sr_uring_seg_done(struct sr_uring *u)
+{
+  int bid = u->seg[u->seg_head].bid;
+
+  u->seg_head = (u->seg_head + 1) % (SR_URING_NBUF + 1);
+  u->nseg--;
+
+  u->release[u->nrelease++] = u->buf[bid];
+  u->buf[bid] = NULL;
+  if(bid < SR_URING_NBUF)
+  { u->repost[u->nrepost++] = bid; }
+}
+
+static int sr_uring_cmd_len(const uint8_t *p, uint32_t *cmd_len)
+{
+  memcpy(cmd_len, p, 4);
+  *cmd_len = ntohl(*cmd_len);
+  if(*cmd_len > SR_BUFPOOL_SLOT || *cmd_len < sizeof(c_base))
+  {
+    fprintf(stderr,"Error: command length to large %u\n",*cmd_len);
+    return -1;
+  }
+  return 0;
+}
+
+/* Frame the next command, like sr_rx_next. 1 and *buf, *len set if there is
+   a complete one, 0 if more data is needed, -1 if the stream is corrupt. */
+static int sr_uring_next(struct sr_uring *u, uint8_t **buf, int *len)
+{
+  uint32_t cmd_len;
+
+  while(1)
+  {
+    struct sr_uring_seg *s = u->nseg ? &(u->seg[u->seg_head]) : NULL;
+
+    if(u->carry_len > 0)
+    {
+      /* finish the command split across buffers */
+      unsigned int need = 4, take;
+      if(u->carry_len >= 4)
+      {
+        if(sr_uring_cmd_len(u->carry, &cmd_len) < 0)
+        { return -1; }
+        need = cmd_len;
+        if(u->carry_len == need)
+        {
+          *buf = u->carry;
+          *len = need;
+          u->release[u->nrelease++] = u->carry;
+          u->carry = NULL;
+          u->carry_len = 0;
+          return 1;
+        }
+      }
+      if(!s)
+      { return 0; }
+      take = (need - u->carry_len < s->len) ? need - u->carry_len : s->len;
+      memcpy(u->carry + u->carry_len, s->p, take);
+      u->carry_len += take;
+      s->p += take;
+      if((s->len -= take) == 0)
+      { sr_uring_seg_done(u); }
+      continue;
+    }
+
+    if(!s)
+    { return 0; }
+    if(s->len >= 4 && sr_uring_cmd_len(s->p, &cmd_len) < 0)
+    { return -1; }
+    if(s->len < 4 || s->len < cmd_len)
+    {
+      /* the rest is in the next buffer */
+      if(!u->carry && (u->carry = sr_buf_alloc()) == NULL &&
+         (u->carry = malloc(SR_BUFPOOL_SLOT)) == NULL)
+      { return -1; }
+      memcpy(u->carry, s->p, s->len);
+      u->carry_len = s->len;
+      sr_uring_seg_done(u);
+      continue;
+    }
+    *buf = s->p;
+    *len = cmd_len;
+    s->p += cmd_len;
+    if((s->len -= cmd_len) == 0)
+    { sr_uring_seg_done(u); }
+    return 1;
+  }
+}
+
+static int sr_vns_uring_recv_batch(struct sr_instance *sr, struct sr_frame *frames, int max)
+{
+  struct sr_uring *u = sr->backend_state;
+  uint8_t *buf = 0;
+  int len = 0;
+  int ret, n = 0;
+
+  pthread_mutex_lock(&(u->lock));
+  u->rx_thread = pthread_self();
+
+  /* the previous batch has been handled */
+  sr_uring_recycle(u);
+
+  while((ret = sr_uring_next(u, &buf, &len)) == 0 && !u->eof)
+  {
+    unsigned int submit;
+
+    /* a command spread over many recvs has been copied out of the buffers
+       it retired so far, so they can go back before the kernel runs out */
+    sr_uring_recycle(u);
+    if(!u->armed)
+    { sr_uring_arm(sr, u); }
+    submit = u->sq_pending;
+    u->sq_pending = 0;
+    pthread_mutex_unlock(&(u->lock));
+    ret = sr_uring_enter(u, submit, 1, 0);
+    pthread_mutex_lock(&(u->lock));
+    if(ret < 0 && errno != EINTR)
+    {
+      perror("io_uring_enter");
+      u->eof = 1;
+    }
+    sr_uring_reap(sr, u);
+  }
+
+  /* writes queued by the last batch, and the recv if buffers ran out */
+  if(!u->armed && !u->eof)
+  { sr_uring_arm(sr, u); }
+  if(u->sq_pending)
+  {
+    sr_uring_enter(u, u->sq_pending, 0, 0);
+    u->sq_pending = 0;
+  }
+
+  while(ret == 1)
+  {
+    frames[n].buf = 0;
+    if(sr_handle_command(sr, buf, len, 0, &(frames[n])) != 1)
+    {
+      ret = -1;
+      break;
+    }
+    if(frames[n].buf && ++n == max)
+    { break; }
+    ret = sr_uring_next(u, &buf, &len);
+  }
+  pthread_mutex_unlock(&(u->lock));
+
+  if(ret < 0 || (n == 0 && u->eof))
+  { return -1; }
+  return n;
+}
+
+static int sr_vns_uring_send_batch(struct sr_instance *sr, const struct sr_frame *frames, int n)
+{
+  struct sr_uring *u = sr->backend_state;
+  int i, fill, ret;
+
+  pthread_mutex_lock(&(u->lock));
+  for(i = 0; i < n; i++)
+  {
+    unsigned int need = sizeof(c_packet_header) + frames[i].len;
+    c_packet_header hdr;
+
+    /* wait for the half in flight if this one is full */
+    while(u->tx_len[fill = (u->tx_out == 0)] + need > SR_URING_TX_HALF && !u->tx_error)
+    {
+      unsigned int submit = u->sq_pending;
+      u->sq_pending = 0;
+      pthread_mutex_unlock(&(u->lock));
+      sr_uring_enter(u, submit, 1, SR_URING_WAIT_NS);
+      pthread_mutex_lock(&(u->lock));
+      if(sr_uring_reap(sr, u) > 0 && !pthread_equal(pthread_self(), u->rx_thread))
+      { sr_uring_wake(u); }
+    }
+    if(u->tx_error)
+    { break; }
+
+    hdr.mLen  = htonl(need);
+    hdr.mType = htonl(VNSPACKET);
+    strncpy(hdr.mInterfaceName,frames[i].iface->name,16);
+    memcpy(u->tx + fill * SR_URING_TX_HALF + u->tx_len[fill], &hdr, sizeof(hdr));
+    memcpy(u->tx + fill * SR_URING_TX_HALF + u->tx_len[fill] + sizeof(hdr),
+           frames[i].buf, frames[i].len);
+    u->tx_len[fill] += need;
+  }
+  sr_uring_tx_start(sr, u, (u->tx_out == 0));
+
+  /* the receiving thread submits with its next wait, anyone else now */
+  if(u->sq_pending && !pthread_equal(pthread_self(), u->rx_thread))
+  {
+    unsigned int submit = u->sq_pending;
+    u->sq_pending = 0;
+    sr_uring_enter(u, submit, 0, 0);
+  }
+  ret = u->tx_error ? -1 : 0;
+  u->tx_error = 0;
+  pthread_mutex_unlock(&(u->lock));
+  return ret;
+}
+
+static void sr_vns_uring_close(struct sr_instance *sr)
+{
+  struct sr_uring *u = sr->backend_state;
+
+  /* let queued frames go out, and the recv finish, before the buffers go */
+  if(u->cq_head)
+  {
+    int tries;
+    pthread_mutex_lock(&(u->lock));
+    for(tries = 0; tries < 100 && (u->tx_out >= 0 || u->armed); tries++)
+    {
+      if(u->tx_out < 0)
+      { shutdown(sr->sockfd, SHUT_RDWR); }
+      unsigned int submit = u->sq_pending;
+      u->sq_pending = 0;
+      pthread_mutex_unlock(&(u->lock));
+      sr_uring_enter(u, submit, 1, SR_URING_WAIT_NS);
+      pthread_mutex_lock(&(u->lock));
+      sr_uring_reap(sr, u);
+    }
+    pthread_mutex_unlock(&(u->lock));
+  }
+  sr_uring_free(u);
+  sr->backend_state = NULL;
+  sr_vns_backend.close(sr);
+}
+
+const struct sr_backend sr_vns_uring_backend = {
+  "vns-uring", 0, sr_vns_uring_open, sr_vns_uring_recv_batch, sr_vns_uring_send_batch,
+  sr_vns_uring_close
+};
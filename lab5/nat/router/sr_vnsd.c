@@ -0,0 +1,951 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_vnsd.c
+ *
+ * Description:
+ *
+ * Local stand-in for the VNS server, so the router can be run and loaded
+ * without network access. It speaks the vnscommand.h protocol to one router
+ * at a time (auth request/status, the template rtable, HWINFO, VNSPACKET)
+ * and emulates the hosts on the router's links: each answers ARP requests
+ * for its address, ICMP echo requests sent to it and UDP or TCP sent to its
+ * echo port. Every other frame is counted and dropped.
+ *
+ * With -g the first host sends traffic built by sr_gen.c through the router
+ * to the others, which answer it, keeping up to window frames in flight at
+ * pps per second (0 for as fast as the answers come back). -S, -P, -f, -d
+ * and -m set the size mix, protocol mix, flow count, how packets pick a
+ * flow and the share sent to a dark host. Per-second and final rates,
+ * drops and round trip times are printed, the session is closed at the
+ * end and the exit status is 0 only if every answer came back.
+ *
+ *   sr_vnsd [-p port] [-t topology file] [-k auth_key] [-v]
+ *           [-g src,dst[:dst...][,count[,pps]]] [-w window] [-f flows]
+ *           [-S 64|imix|1500|size:weight,...] [-P icmp|udp|tcp|mix|proto:weight,...]
+ *           [-d uniform|zipf[:s]|rr] [-m ARP miss percent]
+ *
+ *   ./sr_vnsd -g client,server1:server2,1000000 -S imix -P mix -f 1000 &
+ *   ./sr -s localhost -n
+ *
+ * The topology file has one line per router interface and per host, the
+ * host MAC being optional:
+ *
+ *   iface eth1 02:00:00:00:01:01 10.0.1.1 255.255.255.0
+ *   host client eth1 10.0.1.100 [02:00:00:01:00:01]
+ *   dark dark eth2 184.72.104.200
+ *
+ * Without one the lab topology that rtable and IP_CONFIG describe is used,
+ * plus the dark host. A dark host answers nothing, not even ARP; frames to
+ * it only miss in the router's ARP cache if its routing table has a route
+ * for it, as the rtable sent for a template (-T) does.
+ *
+ * With -k the auth reply is checked against the given key file, otherwise
+ * any reply is accepted.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "vnscommand.h"
+#include "sha1.h"
+#include "sr_gen.h"
+
+#define VNSD_DEFAULT_PORT 8888
+#define VNSD_IFACES       8
+#define VNSD_HOSTS        64
+#define VNSD_BUF_SIZE     (4 << 20)  /* each way */
+#define VNSD_MAX_CMD      (64 << 10) /* longest command accepted */
+#define VNSD_AUTH_KEY_LEN 64
+#define VNSD_SHA1_LEN     20
+#define VNSD_GEN_BURST    256        /* frames per loop at most */
+#define VNSD_HIST         128        /* round trip time buckets */
+#define VNSD_TIMEOUT_NS   1000000000ULL /* until an echo counts as lost */
+
+struct vnsd_iface {
+  char     name[16];
+  uint8_t  mac[ETHER_ADDR_LEN];
+  uint32_t ip, mask; /* network byte order */
+};
+
+struct vnsd_host {
+  char     name[32];
+  int      iface;
+  uint8_t  mac[ETHER_ADDR_LEN];
+  uint32_t ip;
+  int      silent; /* answers nothing, not even ARP */
+};
+
+enum vnsd_state { vnsd_auth, vnsd_open, vnsd_run };
+
+struct vnsd_conn {
+  int      fd;
+  enum vnsd_state state;
+  uint8_t  salt[VNSD_SHA1_LEN];
+  uint8_t *rx;
+  size_t   rx_len;
+  uint8_t *tx;
+  size_t   tx_len, tx_off;
+};
+
+struct vnsd_slot {
+  uint32_t seq;
+  uint64_t sent_ns; /* 0 once answered or given up */
+};
+
+struct vnsd_gen {
+  int      on, src;
+  struct sr_gen traffic;
+  unsigned long count, pps, window, nflows;
+  unsigned long offered;  /* frames, dark ones included */
+  unsigned long sent;     /* frames that should come back, and their seq */
+  unsigned long recvd, lost, late, dark, unreach;
+  uint64_t bytes;
+  struct vnsd_slot *slots; /* window entries, by seq */
+  uint64_t start_ns, last_ns, report_ns;
+  uint64_t rtt_sum, rtt_min, rtt_max;
+  unsigned long hist[VNSD_HIST];
+  unsigned long report_sent, report_recvd;
+  uint64_t report_rtt;
+};
+
+static struct vnsd_iface ifaces[VNSD_IFACES];
+static int niface;
+static struct vnsd_host hosts[VNSD_HOSTS];
+static int nhost;
+static char auth_key[VNSD_AUTH_KEY_LEN + 1];
+static int check_auth;
+static int verbose;
+
+static struct vnsd_gen gen;
+static unsigned long frames_in, frames_out, arp_replies, echo_replies;
+static unsigned long absorbed, unclaimed, tx_dropped;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------
+ * Topology
+ *---------------------------------------------------------------------*/
+
+static int parse_mac(const char *s, uint8_t *mac)
+{
+  unsigned int b[ETHER_ADDR_LEN];
+  int i;
+
+  if(sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+  { return -1; }
+  for(i = 0; i < ETHER_ADDR_LEN; i++)
+  { mac[i] = b[i]; }
+  return 0;
+}
+
+static int find_iface(const char *name)
+{
+  int i;
+  for(i = 0; i < niface; i++)
+  {
+    if(strncmp(ifaces[i].name, name, sizeof(ifaces[i].name)) == 0)
+    { return i; }
+  }
+  return -1;
+}
+
+static int find_host(const char *name)
+{
+  int i;
+  for(i = 0; i < nhost; i++)
+  {
+    if(strcmp(hosts[i].name, name) == 0)
+    { return i; }
+  }
+  return -1;
+}
+
+static int add_iface(const char *name, const char *mac, const char *ip, const char *mask)
+{
+  struct vnsd_iface *ifc = &ifaces[niface];
+
+  if(niface == VNSD_IFACES || strlen(name) >= sizeof(ifc->name))
+  { return -1; }
+  strcpy(ifc->name, name);
+  if(parse_mac(mac, ifc->mac) != 0 || inet_pton(AF_INET, ip, &ifc->ip) != 1 ||
+     inet_pton(AF_INET, mask, &ifc->mask) != 1)
+  { return -1; }
+  niface++;
+  return 0;
+}
+
+static int add_host(const char *name, const char *iface, const char *ip, const char *mac,
+  int silent)
+{
+  struct vnsd_host *h = &hosts[nhost];
+
+  if(nhost == VNSD_HOSTS || strlen(name) >= sizeof(h->name) ||
+     (h->iface = find_iface(iface)) < 0 || inet_pton(AF_INET, ip, &h->ip) != 1)
+  { return -1; }
+  strcpy(h->name, name);
+  h->silent = silent;
+  if(mac)
+  {
+    if(parse_mac(mac, h->mac) != 0)
+    { return -1; }
+  }
+  else
+  {
+    static const uint8_t base[ETHER_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x01, 0x00, 0x00 };
+    memcpy(h->mac, base, ETHER_ADDR_LEN);
+    h->mac[5] = nhost + 1;
+  }
+  nhost++;
+  return 0;
+}
+
+static void default_topology(void)
+{
+  add_iface("eth1", "02:00:00:00:01:01", "10.0.1.1", "255.255.255.0");
+  add_iface("eth2", "02:00:00:00:02:02", "184.72.104.221", "255.255.255.0");
+  add_host("client", "eth1", "10.0.1.100", NULL, 0);
+  add_host("server1", "eth2", "184.72.104.217", NULL, 0);
+  add_host("server2", "eth2", "107.23.87.29", NULL, 0);
+  add_host("dark", "eth2", "184.72.104.200", NULL, 1);
+}
+
+static int load_topology(const char *path)
+{
+  char line[256], kind[16], a[64], b[64], c[64], d[64];
+  FILE *fp = fopen(path, "r");
+  int n, lineno = 0;
+
+  if(!fp)
+  {
+    perror(path);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), fp))
+  {
+    lineno++;
+    if((n = sscanf(line, "%15s %63s %63s %63s %63s", kind, a, b, c, d)) <= 0 || kind[0] == '#')
+    { continue; }
+    if((strcmp(kind, "iface") == 0 && n == 5 && add_iface(a, b, c, d) == 0) ||
+       (strcmp(kind, "host") == 0 && n >= 4 && add_host(a, b, c, (n == 5) ? d : NULL, 0) == 0) ||
+       (strcmp(kind, "dark") == 0 && n == 4 && add_host(a, b, c, NULL, 1) == 0))
+    { continue; }
+    fprintf(stderr, "%s:%d: bad line\n", path, lineno);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Connection
+ *---------------------------------------------------------------------*/
+
+/* Room for len more bytes at the end of the transmit buffer, or NULL. */
+static uint8_t *tx_reserve(struct vnsd_conn *c, size_t len)
+{
+  if(c->tx_off > 0 && c->tx_len + len > VNSD_BUF_SIZE)
+  {
+    memmove(c->tx, c->tx + c->tx_off, c->tx_len - c->tx_off);
+    c->tx_len -= c->tx_off;
+    c->tx_off = 0;
+  }
+  if(c->tx_len + len > VNSD_BUF_SIZE)
+  { return NULL; }
+  return c->tx + c->tx_len;
+}
+
+static void send_cmd(struct vnsd_conn *c, uint32_t type, const void *body, size_t len)
+{
+  uint8_t *p = tx_reserve(c, sizeof(c_base) + len);
+  c_base base;
+
+  if(!p)
+  { return; }
+  base.mLen = htonl(sizeof(c_base) + len);
+  base.mType = htonl(type);
+  memcpy(p, &base, sizeof(base));
+  memcpy(p + sizeof(base), body, len);
+  c->tx_len += sizeof(c_base) + len;
+}
+
+static void send_frame(struct vnsd_conn *c, int iface, const uint8_t *frame, unsigned int len)
+{
+  uint8_t *p = tx_reserve(c, sizeof(c_packet_header) + len);
+  c_packet_header hdr;
+
+  if(!p)
+  {
+    tx_dropped++;
+    return;
+  }
+  hdr.mLen = htonl(sizeof(c_packet_header) + len);
+  hdr.mType = htonl(VNSPACKET);
+  memset(hdr.mInterfaceName, 0, sizeof(hdr.mInterfaceName));
+  strncpy(hdr.mInterfaceName, ifaces[iface].name, sizeof(hdr.mInterfaceName));
+  memcpy(p, &hdr, sizeof(hdr));
+  memcpy(p + sizeof(hdr), frame, len);
+  c->tx_len += sizeof(c_packet_header) + len;
+  frames_out++;
+}
+
+/* Write out what the socket takes. -1 if the router has gone. */
+static int flush(struct vnsd_conn *c)
+{
+  ssize_t n;
+
+  while(c->tx_off < c->tx_len)
+  {
+    if((n = write(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off)) < 0)
+    { return (errno == EAGAIN || errno == EINTR) ? 0 : -1; }
+    c->tx_off += n;
+  }
+  c->tx_off = c->tx_len = 0;
+  return 0;
+}
+
+static void send_auth_request(struct vnsd_conn *c)
+{
+  int i;
+  for(i = 0; i < VNSD_SHA1_LEN; i++)
+  { c->salt[i] = rand(); }
+  send_cmd(c, VNS_AUTH_REQUEST, c->salt, sizeof(c->salt));
+}
+
+static void send_auth_status(struct vnsd_conn *c, int ok, const char *msg)
+{
+  uint8_t body[128];
+
+  body[0] = ok;
+  strncpy((char *)body + 1, msg, sizeof(body) - 1);
+  send_cmd(c, VNS_AUTH_STATUS, body, 1 + strlen(msg));
+}
+
+static int auth_reply_ok(const uint8_t *salt, const uint8_t *buf, uint32_t len)
+{
+  const c_auth_reply *ar = (const c_auth_reply *)buf;
+  SHA1Context sha1;
+  uint32_t ulen;
+  int i;
+
+  if(len < sizeof(c_auth_reply))
+  { return 0; }
+  ulen = ntohl(ar->usernameLen);
+  if(ulen > len - sizeof(c_auth_reply) || len - sizeof(c_auth_reply) - ulen != VNSD_SHA1_LEN)
+  { return 0; }
+  if(!check_auth)
+  { return 1; }
+
+  /* the client hashes salt then key, and sends the digest words in
+     network byte order */
+  SHA1Reset(&sha1);
+  SHA1Input(&sha1, (unsigned char *)salt, VNSD_SHA1_LEN);
+  SHA1Input(&sha1, (unsigned char *)auth_key, VNSD_AUTH_KEY_LEN);
+  if(!SHA1Result(&sha1))
+  { return 0; }
+  for(i = 0; i < 5; i++)
+  { sha1.Message_Digest[i] = htonl(sha1.Message_Digest[i]); }
+  return memcmp(ar->username + ulen, sha1.Message_Digest, VNSD_SHA1_LEN) == 0;
+}
+
+static void send_rtable(struct vnsd_conn *c, const char *vhost)
+{
+  char body[IDSIZE + VNSD_HOSTS * 80], ip[INET_ADDRSTRLEN];
+  size_t len = IDSIZE;
+  int i;
+
+  memset(body, 0, IDSIZE);
+  strncpy(body, vhost, IDSIZE);
+  for(i = 0; i < nhost; i++)
+  {
+    inet_ntop(AF_INET, &hosts[i].ip, ip, sizeof(ip));
+    len += sprintf(body + len, "%s %s 255.255.255.255 %s\n", ip, ip, ifaces[hosts[i].iface].name);
+  }
+  send_cmd(c, VNS_RTABLE, body, len);
+}
+
+static void send_hwinfo(struct vnsd_conn *c)
+{
+  c_hw_entry hw[VNSD_IFACES * 4];
+  int i, n = 0;
+
+  memset(hw, 0, sizeof(hw));
+  for(i = 0; i < niface; i++)
+  {
+    hw[n].mKey = htonl(HWINTERFACE);
+    strncpy(hw[n++].value, ifaces[i].name, sizeof(hw[0].value));
+    hw[n].mKey = htonl(HWETHER);
+    memcpy(hw[n++].value, ifaces[i].mac, ETHER_ADDR_LEN);
+    hw[n].mKey = htonl(HWETHIP);
+    memcpy(hw[n++].value, &ifaces[i].ip, 4);
+    hw[n].mKey = htonl(HWMASK);
+    memcpy(hw[n++].value, &ifaces[i].mask, 4);
+  }
+  send_cmd(c, VNSHWINFO, hw, n * sizeof(c_hw_entry));
+}
+
+/*---------------------------------------------------------------------
+ * Emulated hosts
+ *---------------------------------------------------------------------*/
+
+static void arp_input(struct vnsd_conn *c, int iface, uint8_t *frame, unsigned int len)
+{
+  sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+  sr_arp_hdr_t *arp = (sr_arp_hdr_t *)(frame + sizeof(sr_ethernet_hdr_t));
+  int i;
+
+  if(len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) ||
+     ntohs(arp->ar_op) != arp_op_request)
+  {
+    absorbed++;
+    return;
+  }
+  for(i = 0; i < nhost; i++)
+  {
+    if(hosts[i].iface == iface && hosts[i].ip == arp->ar_tip && !hosts[i].silent)
+    { break; }
+  }
+  if(i == nhost)
+  {
+    unclaimed++;
+    return;
+  }
+
+  /* answer in place */
+  memcpy(eth->ether_dhost, arp->ar_sha, ETHER_ADDR_LEN);
+  memcpy(eth->ether_shost, hosts[i].mac, ETHER_ADDR_LEN);
+  arp->ar_op = htons(arp_op_reply);
+  memcpy(arp->ar_tha, arp->ar_sha, ETHER_ADDR_LEN);
+  arp->ar_tip = arp->ar_sip;
+  memcpy(arp->ar_sha, hosts[i].mac, ETHER_ADDR_LEN);
+  arp->ar_sip = hosts[i].ip;
+  send_frame(c, iface, frame, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+  arp_replies++;
+}
+
+static void probe_input(uint32_t seq)
+{
+  struct vnsd_slot *slot = &gen.slots[seq % gen.window];
+  uint64_t rtt;
+  unsigned int b;
+
+  if(slot->sent_ns == 0 || slot->seq != seq)
+  {
+    gen.late++;
+    return;
+  }
+  rtt = now_ns() - slot->sent_ns;
+  slot->sent_ns = 0;
+  gen.recvd++;
+  gen.rtt_sum += rtt;
+  gen.report_rtt += rtt;
+  if(rtt < gen.rtt_min || gen.rtt_min == 0)
+  { gen.rtt_min = rtt; }
+  if(rtt > gen.rtt_max)
+  { gen.rtt_max = rtt; }
+  /* four buckets per power of two from 1us */
+  b = (rtt < 1000) ? 0 : (unsigned int)(4 * log(rtt / 1000.0) / log(2.0));
+  gen.hist[(b < VNSD_HIST) ? b : VNSD_HIST - 1]++;
+}
+
+static void ip_input(struct vnsd_conn *c, int iface, uint8_t *frame, unsigned int len)
+{
+  sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+  sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(frame + sizeof(sr_ethernet_hdr_t));
+  unsigned int out;
+  uint32_t seq;
+  int i;
+
+  if(len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t))
+  {
+    unclaimed++;
+    return;
+  }
+  for(i = 0; i < nhost; i++)
+  {
+    if(hosts[i].iface == iface && hosts[i].ip == ip->ip_dst &&
+       memcmp(hosts[i].mac, eth->ether_dhost, ETHER_ADDR_LEN) == 0)
+    { break; }
+  }
+  if(i == nhost)
+  {
+    unclaimed++;
+    return;
+  }
+  if(gen.on && i == gen.src)
+  {
+    if(sr_gen_probe(frame, len, &seq))
+    {
+      probe_input(seq);
+      return;
+    }
+    if(ip->ip_p == ip_protocol_icmp && len > sizeof(sr_ethernet_hdr_t) + ip->ip_hl * 4 &&
+       frame[sizeof(sr_ethernet_hdr_t) + ip->ip_hl * 4] == 3)
+    {
+      gen.unreach++;
+      return;
+    }
+  }
+  if(hosts[i].silent || (out = sr_gen_reflect(frame, len, hosts[i].mac)) == 0)
+  {
+    absorbed++;
+    return;
+  }
+  send_frame(c, iface, frame, out);
+  echo_replies++;
+}
+
+static void frame_input(struct vnsd_conn *c, const c_packet_header *hdr, uint32_t len)
+{
+  uint8_t *frame = (uint8_t *)hdr + sizeof(c_packet_header);
+  char name[sizeof(hdr->mInterfaceName) + 1];
+  int iface;
+
+  frames_in++;
+  memcpy(name, hdr->mInterfaceName, sizeof(hdr->mInterfaceName));
+  name[sizeof(hdr->mInterfaceName)] = 0;
+  len -= sizeof(c_packet_header);
+  if((iface = find_iface(name)) < 0 || len < sizeof(sr_ethernet_hdr_t))
+  {
+    unclaimed++;
+    return;
+  }
+  switch(ntohs(((sr_ethernet_hdr_t *)frame)->ether_type))
+  {
+    case ethertype_arp: arp_input(c, iface, frame, len); break;
+    case ethertype_ip:  ip_input(c, iface, frame, len); break;
+    default:            absorbed++; break;
+  }
+}
+
+/*---------------------------------------------------------------------
+ * Load generator
+ *---------------------------------------------------------------------*/
+
+static void gen_send(struct vnsd_conn *c, uint64_t now)
+{
+  uint8_t frame[SR_GEN_MAX_FRAME];
+  unsigned int len;
+  int dark;
+
+  len = sr_gen_next(&gen.traffic, frame, gen.sent, &dark);
+  if(dark)
+  { gen.dark++; }
+  else
+  {
+    struct vnsd_slot *slot = &gen.slots[gen.sent % gen.window];
+    slot->seq = gen.sent;
+    slot->sent_ns = now;
+    gen.sent++;
+  }
+  send_frame(c, hosts[gen.src].iface, frame, len);
+  gen.offered++;
+  gen.bytes += len + 4;
+  gen.last_ns = now;
+}
+
+/* Round trip time below which frac of the answers came, in us. */
+static double gen_percentile(double frac)
+{
+  unsigned long want = (unsigned long)(gen.recvd * frac), seen = 0;
+  unsigned int b;
+
+  for(b = 0; b < VNSD_HIST; b++)
+  {
+    if((seen += gen.hist[b]) > want)
+    { break; }
+  }
+  return (b >= VNSD_HIST) ? gen.rtt_max / 1e3 : pow(2, (b + 1) / 4.0);
+}
+
+static void gen_report(uint64_t now, int final)
+{
+  double secs = (now - gen.start_ns) / 1e9;
+
+  if(!final)
+  {
+    unsigned long rx = gen.recvd - gen.report_recvd;
+    printf("%6.1fs  tx %8lu pps  rx %8lu pps  lost %lu  unreach %lu  rtt %.1f us\n", secs,
+           gen.offered - gen.report_sent, rx, gen.lost, gen.unreach,
+           rx ? gen.report_rtt / 1e3 / rx : 0.0);
+    gen.report_sent = gen.offered;
+    gen.report_recvd = gen.recvd;
+    gen.report_rtt = 0;
+    return;
+  }
+  if(secs <= 0)
+  { secs = 1e-9; }
+  printf("offered %lu (%.0f pps, %.1f Mb/s)  dark %lu  tx dropped %lu\n",
+         gen.offered, gen.offered / secs, gen.bytes * 8 / secs / 1e6, gen.dark, tx_dropped);
+  printf("answered %lu (%.0f pps)  lost %lu  late %lu  unreachable %lu  in %.2fs\n",
+         gen.recvd, gen.recvd / secs, gen.lost, gen.late, gen.unreach, secs);
+  printf("rtt min/avg/p50/p99/max %.1f/%.1f/%.1f/%.1f/%.1f us\n", gen.rtt_min / 1e3,
+         gen.recvd ? gen.rtt_sum / 1e3 / gen.recvd : 0.0, gen_percentile(0.5),
+         gen_percentile(0.99), gen.rtt_max / 1e3);
+}
+
+/* Each session starts a fresh run. */
+static void gen_reset(void)
+{
+  struct sr_gen *t = &gen.traffic;
+  int i;
+
+  memset(gen.slots, 0, gen.window * sizeof(struct vnsd_slot));
+  memset(gen.hist, 0, sizeof(gen.hist));
+  gen.offered = gen.sent = gen.recvd = gen.lost = gen.late = 0;
+  gen.dark = gen.unreach = 0;
+  gen.bytes = 0;
+  gen.start_ns = gen.last_ns = gen.report_ns = 0;
+  gen.rtt_sum = gen.rtt_min = gen.rtt_max = 0;
+  gen.report_sent = gen.report_recvd = 0;
+  gen.report_rtt = 0;
+  for(i = 0; i < (int)t->nflows; i++)
+  { t->flows[i].started = 0; }
+}
+
+/* Send what the rate and window allow. 1 once the run is over. */
+static int gen_tick(struct vnsd_conn *c)
+{
+  uint64_t now = now_ns();
+  unsigned long allowed = VNSD_GEN_BURST;
+  unsigned long i;
+
+  if(gen.start_ns == 0)
+  { gen.start_ns = gen.report_ns = now; }
+  if(now - gen.report_ns >= 1000000000ULL)
+  {
+    gen_report(now, 0);
+    gen.report_ns = now;
+  }
+
+  if(gen.pps)
+  {
+    uint64_t due = (now - gen.start_ns) * gen.pps / 1000000000ULL;
+    allowed = (due > gen.offered) ? due - gen.offered : 0;
+    if(allowed > VNSD_GEN_BURST)
+    { allowed = VNSD_GEN_BURST; }
+  }
+  /* keep the socket buffer from backing up into the transmit buffer */
+  for(i = 0; i < allowed && gen.offered < gen.count && c->tx_len < VNSD_BUF_SIZE / 2; i++)
+  {
+    struct vnsd_slot *slot = &gen.slots[gen.sent % gen.window];
+    if(slot->sent_ns)
+    {
+      /* window is full until its oldest frame comes back or times out */
+      if(now - slot->sent_ns < VNSD_TIMEOUT_NS)
+      { break; }
+      slot->sent_ns = 0;
+      gen.lost++;
+    }
+    gen_send(c, now);
+  }
+
+  if(gen.offered < gen.count)
+  { return 0; }
+  if(gen.recvd + gen.lost < gen.sent && now - gen.last_ns < VNSD_TIMEOUT_NS)
+  { return 0; }
+  gen.lost = gen.sent - gen.recvd;
+  gen_report(now, 1);
+  return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Server
+ *---------------------------------------------------------------------*/
+
+/* Act on one command from the router. -1 to end the session. */
+static int handle_command(struct vnsd_conn *c, uint8_t *buf, uint32_t len)
+{
+  uint32_t type = ntohl(((c_base *)buf)->mType);
+
+  if(type == VNSCLOSE)
+  {
+    fprintf(stderr, "router closed the session\n");
+    return -1;
+  }
+  switch(c->state)
+  {
+    case vnsd_auth:
+      if(type != VNS_AUTH_REPLY || !auth_reply_ok(c->salt, buf, len))
+      {
+        fprintf(stderr, "authentication failed\n");
+        send_auth_status(c, 0, "authentication failed");
+        return -1;
+      }
+      send_auth_status(c, 1, "authenticated with sr_vnsd");
+      c->state = vnsd_open;
+      break;
+
+    case vnsd_open:
+      if(type == VNS_OPEN_TEMPLATE && len >= sizeof(c_open_template))
+      {
+        char vhost[IDSIZE + 1];
+        memcpy(vhost, ((c_open_template *)buf)->mVirtualHostID, IDSIZE);
+        vhost[IDSIZE] = 0;
+        send_rtable(c, vhost);
+      }
+      else if(type != VNSOPEN)
+      {
+        fprintf(stderr, "expected open, got command %u\n", type);
+        return -1;
+      }
+      send_hwinfo(c);
+      c->state = vnsd_run;
+      fprintf(stderr, "router connected\n");
+      break;
+
+    case vnsd_run:
+      if(type == VNSPACKET && len >= sizeof(c_packet_header))
+      { frame_input(c, (c_packet_header *)buf, len); }
+      break;
+  }
+  return 0;
+}
+
+/* Read and handle what has arrived. -1 to end the session. */
+static int conn_input(struct vnsd_conn *c)
+{
+  size_t off = 0;
+  uint32_t len;
+  ssize_t n;
+
+  if((n = read(c->fd, c->rx + c->rx_len, VNSD_BUF_SIZE - c->rx_len)) <= 0)
+  {
+    if(n < 0 && (errno == EAGAIN || errno == EINTR))
+    { return 0; }
+    if(n == 0)
+    { fprintf(stderr, "router disconnected\n"); }
+    return -1;
+  }
+  c->rx_len += n;
+
+  while(c->rx_len - off >= sizeof(c_base))
+  {
+    len = ntohl(((c_base *)(c->rx + off))->mLen);
+    if(len < sizeof(c_base) || len > VNSD_MAX_CMD)
+    {
+      fprintf(stderr, "bad command length %u\n", len);
+      return -1;
+    }
+    if(c->rx_len - off < len)
+    { break; }
+    if(handle_command(c, c->rx + off, len) < 0)
+    { return -1; }
+    off += len;
+  }
+  memmove(c->rx, c->rx + off, c->rx_len - off);
+  c->rx_len -= off;
+  return 0;
+}
+
+static void print_stats(void)
+{
+  fprintf(stderr, "frames in %lu out %lu: arp replies %lu echo replies %lu "
+          "absorbed %lu unclaimed %lu dropped %lu\n", frames_in, frames_out,
+          arp_replies, echo_replies, absorbed, unclaimed, tx_dropped);
+}
+
+/* Serve one router until it leaves or the load run ends. 1 if it ended. */
+static int serve(struct vnsd_conn *c)
+{
+  struct pollfd pfd;
+  int one = 1, done = 0;
+
+  fcntl(c->fd, F_SETFL, O_NONBLOCK);
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c->state = vnsd_auth;
+  c->rx_len = c->tx_len = c->tx_off = 0;
+  send_auth_request(c);
+  if(gen.on)
+  { gen_reset(); }
+
+  while(!done)
+  {
+    pfd.fd = c->fd;
+    pfd.events = POLLIN | ((c->tx_len > c->tx_off) ? POLLOUT : 0);
+    if(poll(&pfd, 1, (gen.on && c->state == vnsd_run) ? 1 : 1000) < 0 && errno != EINTR)
+    { break; }
+    if((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && conn_input(c) < 0)
+    { break; }
+    if(gen.on && c->state == vnsd_run && gen_tick(c))
+    {
+      c_close cl;
+      memset(&cl, 0, sizeof(cl));
+      strcpy(cl.mErrorMessage, "load run finished");
+      send_cmd(c, VNSCLOSE, cl.mErrorMessage, sizeof(cl.mErrorMessage));
+      fcntl(c->fd, F_SETFL, 0);
+      done = 1;
+    }
+    if(flush(c) < 0)
+    { break; }
+  }
+  close(c->fd);
+  if(verbose)
+  { print_stats(); }
+  return done;
+}
+
+static int parse_gen(char *arg)
+{
+  struct sr_gen *t = &gen.traffic;
+  char *src = strtok(arg, ","), *dst = strtok(NULL, ","), *count = strtok(NULL, ","),
+       *pps = strtok(NULL, ","), *name, *save;
+  int i;
+
+  if(!src || !dst || (gen.src = find_host(src)) < 0)
+  { return -1; }
+  memcpy(t->src_mac, hosts[gen.src].mac, ETHER_ADDR_LEN);
+  memcpy(t->gw_mac, ifaces[hosts[gen.src].iface].mac, ETHER_ADDR_LEN);
+  t->src_ip = hosts[gen.src].ip;
+  for(name = strtok_r(dst, ":", &save); name; name = strtok_r(NULL, ":", &save))
+  {
+    if(t->ndst == SR_GEN_DSTS || (i = find_host(name)) < 0)
+    { return -1; }
+    t->dst_ip[t->ndst++] = hosts[i].ip;
+  }
+  /* misses go to the first host that never answers ARP */
+  for(i = 0; i < nhost && !hosts[i].silent; i++);
+  if(i < nhost)
+  { t->dark_ip = hosts[i].ip; }
+  else if(t->miss_pct)
+  {
+    fprintf(stderr, "-m needs a dark host in the topology\n");
+    return -1;
+  }
+  gen.count = count ? strtoul(count, NULL, 10) : 100000;
+  gen.pps = pps ? strtoul(pps, NULL, 10) : 0;
+  gen.on = 1;
+  return 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-p port] [-t topology file] [-k auth_key] [-v]\n"
+          "       [-g src,dst[:dst...][,count[,pps]]] [-w window] [-f flows]\n"
+          "       [-S 64|imix|1500|size:weight,...] [-P icmp|udp|tcp|mix|proto:weight,...]\n"
+          "       [-d uniform|zipf[:s]|rr] [-m ARP miss percent]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+  struct vnsd_conn conn;
+  struct sockaddr_in addr;
+  char *topology = NULL, *key = NULL, *gen_arg = NULL;
+  unsigned int port = VNSD_DEFAULT_PORT;
+  int c, lfd, one = 1;
+
+  gen.window = 256;
+  gen.nflows = 1;
+  sr_gen_defaults(&gen.traffic);
+  while((c = getopt(argc, argv, "p:t:k:g:w:f:S:P:d:m:v")) != EOF)
+  {
+    switch(c)
+    {
+      case 'p': port = atoi(optarg); break;
+      case 't': topology = optarg; break;
+      case 'k': key = optarg; break;
+      case 'g': gen_arg = optarg; break;
+      case 'w': gen.window = strtoul(optarg, NULL, 10); break;
+      case 'f': gen.nflows = strtoul(optarg, NULL, 10); break;
+      case 'm': gen.traffic.miss_pct = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      case 'S':
+        if(sr_gen_set_sizes(&gen.traffic, optarg) == 0)
+        { break; }
+        fprintf(stderr, "bad size mix %s\n", optarg);
+        return 1;
+      case 'P':
+        if(sr_gen_set_protos(&gen.traffic, optarg) == 0)
+        { break; }
+        fprintf(stderr, "bad protocol mix %s\n", optarg);
+        return 1;
+      case 'd':
+        if(sr_gen_set_dist(&gen.traffic, optarg) == 0)
+        { break; }
+        fprintf(stderr, "bad flow distribution %s\n", optarg);
+        return 1;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if(topology ? load_topology(topology) != 0 : (default_topology(), 0))
+  { return 1; }
+  if(niface == 0)
+  {
+    fprintf(stderr, "no interfaces in topology\n");
+    return 1;
+  }
+  if(key)
+  {
+    FILE *fp = fopen(key, "r");
+    if(!fp || !fgets(auth_key, sizeof(auth_key), fp))
+    {
+      perror(key);
+      return 1;
+    }
+    fclose(fp);
+    check_auth = 1;
+  }
+  if(gen_arg && parse_gen(gen_arg) != 0)
+  {
+    fprintf(stderr, "-g: unknown host\n");
+    return 1;
+  }
+  if(gen.on && (gen.window == 0 || gen.traffic.miss_pct > 100 ||
+     sr_gen_init(&gen.traffic, gen.nflows, time(NULL)) != 0 ||
+     (gen.slots = calloc(gen.window, sizeof(struct vnsd_slot))) == NULL))
+  {
+    fprintf(stderr, "bad load settings\n");
+    return 1;
+  }
+
+  conn.rx = malloc(VNSD_BUF_SIZE);
+  conn.tx = malloc(VNSD_BUF_SIZE);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(!conn.rx || !conn.tx || (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+     setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+     bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0)
+  {
+    perror("sr_vnsd");
+    return 1;
+  }
+  srand(time(NULL));
+  fprintf(stderr, "listening on 127.0.0.1:%u\n", port);
+
+  for(;;)
+  {
+    if((conn.fd = accept(lfd, NULL, NULL)) < 0)
+    {
+      if(errno == EINTR)
+      { continue; }
+      perror("accept");
+      return 1;
+    }
+    if(serve(&conn))
+    { break; }
+  }
+  close(lfd);
+  return (gen.lost == 0) ? 0 : 1;
+}